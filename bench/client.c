@@ -0,0 +1,600 @@
+#define _GNU_SOURCE
+#include "client.h"
+
+#include <errno.h>
+#include <linux/input-event-codes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#include "xdg-shell-client-protocol.h"
+#include "wlr-layer-shell-unstable-v1-client-protocol.h"
+
+#define BENCH_CLIENT_BUFFERS 2
+
+struct bench_buffer {
+    struct wl_buffer *wl_buffer;
+    uint32_t *data;
+    size_t size;
+    int width, height;
+    bool busy;
+};
+
+enum bench_window_role {
+    BENCH_WINDOW_TOPLEVEL,
+    BENCH_WINDOW_POPUP,
+    BENCH_WINDOW_LAYER,
+};
+
+struct bench_window {
+    struct bench_client_state *state;
+    enum bench_window_role role;
+    struct wl_surface *surface;
+    struct xdg_surface *xdg_surface;
+    struct xdg_toplevel *xdg_toplevel;
+    struct xdg_popup *xdg_popup;
+    struct zwlr_layer_surface_v1 *layer_surface;
+    struct bench_buffer buffers[BENCH_CLIENT_BUFFERS];
+
+    bool configured;
+    int width, height;
+    int pending_width, pending_height;
+    uint32_t frame;
+};
+
+struct bench_client_state {
+    struct bench_client *client;
+    struct wl_display *display;
+    struct wl_registry *registry;
+    struct wl_compositor *compositor;
+    struct wl_shm *shm;
+    struct xdg_wm_base *wm_base;
+    struct zwlr_layer_shell_v1 *layer_shell;
+    struct wl_seat *seat;
+    struct wl_pointer *pointer;
+
+    struct bench_window *windows;
+    int n_windows;
+    struct bench_window *pointer_focus;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
+    struct bench_buffer *buffer = data;
+    buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+static void buffer_finish(struct bench_buffer *buffer) {
+    if (buffer->wl_buffer) {
+        wl_buffer_destroy(buffer->wl_buffer);
+        munmap(buffer->data, buffer->size);
+    }
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+static bool buffer_init(struct bench_client_state *state, struct bench_buffer *buffer,
+        int width, int height) {
+    int stride = width * 4;
+    size_t size = (size_t)stride * height;
+
+    int fd = memfd_create("planar-bench-shm", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    struct wl_shm_pool *pool = wl_shm_create_pool(state->shm, fd, size);
+    buffer->wl_buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride,
+        WL_SHM_FORMAT_XRGB8888);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
+    buffer->data = data;
+    buffer->size = size;
+    buffer->width = width;
+    buffer->height = height;
+    buffer->busy = false;
+    return true;
+}
+
+static void window_resize_buffers(struct bench_window *window, int width, int height) {
+    /* Buffers are allocated on first use, so surfaces that only commit once
+     * never pay for a second one. */
+    for (int i = 0; i < BENCH_CLIENT_BUFFERS; i++) {
+        buffer_finish(&window->buffers[i]);
+    }
+    window->width = width;
+    window->height = height;
+}
+
+static void window_draw(struct bench_window *window) {
+    struct bench_client *client = window->state->client;
+    struct bench_buffer *buffer = NULL;
+    for (int i = 0; i < BENCH_CLIENT_BUFFERS; i++) {
+        if (!window->buffers[i].busy) {
+            buffer = &window->buffers[i];
+            break;
+        }
+    }
+    if (!buffer) {
+        /* The compositor still holds both buffers, skip this tick. */
+        return;
+    }
+    if (!buffer->wl_buffer &&
+            !buffer_init(window->state, buffer, window->width, window->height)) {
+        return;
+    }
+
+    /* Repaint a horizontal band that sweeps down the window, so each commit
+     * damages damage_percent of the buffer. */
+    int band = buffer->height * client->config.damage_percent / 100;
+    if (band < 1) {
+        band = 1;
+    }
+    int y = (window->frame * band) % buffer->height;
+    if (y + band > buffer->height) {
+        band = buffer->height - y;
+    }
+    uint32_t color = 0xff000000 | (window->frame * 0x010203u);
+    for (int row = y; row < y + band; row++) {
+        uint32_t *pixels = buffer->data + (size_t)row * buffer->width;
+        for (int x = 0; x < buffer->width; x++) {
+            pixels[x] = color;
+        }
+    }
+
+    wl_surface_attach(window->surface, buffer->wl_buffer, 0, 0);
+    wl_surface_damage_buffer(window->surface, 0, y, buffer->width, band);
+    wl_surface_commit(window->surface);
+    buffer->busy = true;
+    window->frame++;
+
+    atomic_fetch_add(&client->commits, 1);
+    atomic_fetch_add(&client->bytes_damaged, (uint64_t)band * buffer->width * 4);
+}
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
+        uint32_t serial) {
+    struct bench_window *window = data;
+    xdg_surface_ack_configure(xdg_surface, serial);
+    atomic_fetch_add(&window->state->client->configures, 1);
+
+    int width = window->pending_width > 0 ?
+        window->pending_width : window->state->client->config.width;
+    int height = window->pending_height > 0 ?
+        window->pending_height : window->state->client->config.height;
+    if (width != window->width || height != window->height) {
+        window_resize_buffers(window, width, height);
+    }
+
+    window->configured = true;
+    window_draw(window);
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    .configure = xdg_surface_configure,
+};
+
+static void xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+        int32_t width, int32_t height, struct wl_array *states) {
+    struct bench_window *window = data;
+    window->pending_width = width;
+    window->pending_height = height;
+}
+
+static void xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel) {
+    /* Synthetic windows live until the benchmark stops them. */
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+    .configure = xdg_toplevel_configure,
+    .close = xdg_toplevel_close,
+};
+
+static void xdg_popup_configure(void *data, struct xdg_popup *xdg_popup,
+        int32_t x, int32_t y, int32_t width, int32_t height) {
+    struct bench_window *window = data;
+    window->pending_width = width;
+    window->pending_height = height;
+}
+
+static void xdg_popup_done(void *data, struct xdg_popup *xdg_popup) {
+}
+
+static const struct xdg_popup_listener xdg_popup_listener = {
+    .configure = xdg_popup_configure,
+    .popup_done = xdg_popup_done,
+};
+
+static void layer_surface_configure(void *data, struct zwlr_layer_surface_v1 *layer_surface,
+        uint32_t serial, uint32_t width, uint32_t height) {
+    struct bench_window *window = data;
+    zwlr_layer_surface_v1_ack_configure(layer_surface, serial);
+    atomic_fetch_add(&window->state->client->configures, 1);
+
+    if (width == 0) {
+        width = window->state->client->config.width;
+    }
+    if (height == 0) {
+        height = window->state->client->config.height;
+    }
+    if ((int)width != window->width || (int)height != window->height) {
+        window_resize_buffers(window, width, height);
+    }
+
+    window->configured = true;
+    window_draw(window);
+}
+
+static void layer_surface_closed(void *data, struct zwlr_layer_surface_v1 *layer_surface) {
+}
+
+static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
+    .configure = layer_surface_configure,
+    .closed = layer_surface_closed,
+};
+
+static void wm_base_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial) {
+    xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+    .ping = wm_base_ping,
+};
+
+static struct bench_window *window_from_surface(struct bench_client_state *state,
+        struct wl_surface *surface) {
+    for (int i = 0; i < state->n_windows; i++) {
+        if (state->windows[i].surface == surface) {
+            return &state->windows[i];
+        }
+    }
+    return NULL;
+}
+
+static void pointer_enter(void *data, struct wl_pointer *pointer, uint32_t serial,
+        struct wl_surface *surface, wl_fixed_t sx, wl_fixed_t sy) {
+    struct bench_client_state *state = data;
+    state->pointer_focus = window_from_surface(state, surface);
+}
+
+static void pointer_leave(void *data, struct wl_pointer *pointer, uint32_t serial,
+        struct wl_surface *surface) {
+    struct bench_client_state *state = data;
+    state->pointer_focus = NULL;
+}
+
+static void pointer_motion(void *data, struct wl_pointer *pointer, uint32_t time,
+        wl_fixed_t sx, wl_fixed_t sy) {
+}
+
+static void pointer_button(void *data, struct wl_pointer *pointer, uint32_t serial,
+        uint32_t time, uint32_t button, uint32_t button_state) {
+    struct bench_client_state *state = data;
+    struct bench_window *window = state->pointer_focus;
+    if (!window || window->role != BENCH_WINDOW_TOPLEVEL || button_state != WL_POINTER_BUTTON_STATE_PRESSED) {
+        return;
+    }
+    if (button == BTN_LEFT) {
+        xdg_toplevel_move(window->xdg_toplevel, state->seat, serial);
+    } else if (button == BTN_RIGHT) {
+        xdg_toplevel_resize(window->xdg_toplevel, state->seat, serial,
+            XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT);
+    }
+}
+
+static void pointer_axis(void *data, struct wl_pointer *pointer, uint32_t time,
+        uint32_t axis, wl_fixed_t value) {
+}
+
+static void pointer_frame(void *data, struct wl_pointer *pointer) {
+}
+
+static void pointer_axis_source(void *data, struct wl_pointer *pointer,
+        uint32_t axis_source) {
+}
+
+static void pointer_axis_stop(void *data, struct wl_pointer *pointer, uint32_t time,
+        uint32_t axis) {
+}
+
+static void pointer_axis_discrete(void *data, struct wl_pointer *pointer, uint32_t axis,
+        int32_t discrete) {
+}
+
+static const struct wl_pointer_listener pointer_listener = {
+    .enter = pointer_enter,
+    .leave = pointer_leave,
+    .motion = pointer_motion,
+    .button = pointer_button,
+    .axis = pointer_axis,
+    .frame = pointer_frame,
+    .axis_source = pointer_axis_source,
+    .axis_stop = pointer_axis_stop,
+    .axis_discrete = pointer_axis_discrete,
+};
+
+static void seat_capabilities(void *data, struct wl_seat *seat, uint32_t caps) {
+    struct bench_client_state *state = data;
+    if ((caps & WL_SEAT_CAPABILITY_POINTER) && !state->pointer) {
+        state->pointer = wl_seat_get_pointer(seat);
+        wl_pointer_add_listener(state->pointer, &pointer_listener, state);
+    }
+}
+
+static void seat_name(void *data, struct wl_seat *seat, const char *name) {
+}
+
+static const struct wl_seat_listener seat_listener = {
+    .capabilities = seat_capabilities,
+    .name = seat_name,
+};
+
+static void registry_global(void *data, struct wl_registry *registry, uint32_t name,
+        const char *interface, uint32_t version) {
+    struct bench_client_state *state = data;
+    if (strcmp(interface, wl_compositor_interface.name) == 0) {
+        state->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        state->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        state->wm_base = wl_registry_bind(registry, name, &xdg_wm_base_interface, 3);
+        xdg_wm_base_add_listener(state->wm_base, &wm_base_listener, state);
+    } else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0) {
+        state->layer_shell = wl_registry_bind(registry, name,
+            &zwlr_layer_shell_v1_interface, 1);
+    } else if (strcmp(interface, wl_seat_interface.name) == 0 && !state->seat) {
+        state->seat = wl_registry_bind(registry, name, &wl_seat_interface,
+            version < 5 ? version : 5);
+        wl_seat_add_listener(state->seat, &seat_listener, state);
+    }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *registry, uint32_t name) {
+}
+
+static const struct wl_registry_listener registry_listener = {
+    .global = registry_global,
+    .global_remove = registry_global_remove,
+};
+
+static void toplevel_init(struct bench_client_state *state, struct bench_window *window,
+        int index) {
+    window->state = state;
+    window->role = BENCH_WINDOW_TOPLEVEL;
+    window->surface = wl_compositor_create_surface(state->compositor);
+    window->xdg_surface = xdg_wm_base_get_xdg_surface(state->wm_base, window->surface);
+    xdg_surface_add_listener(window->xdg_surface, &xdg_surface_listener, window);
+    window->xdg_toplevel = xdg_surface_get_toplevel(window->xdg_surface);
+    xdg_toplevel_add_listener(window->xdg_toplevel, &xdg_toplevel_listener, window);
+
+    char title[64];
+    snprintf(title, sizeof(title), "planar-bench %d.%d", state->client->index, index);
+    xdg_toplevel_set_title(window->xdg_toplevel, title);
+    wl_surface_commit(window->surface);
+}
+
+static void popup_init(struct bench_client_state *state, struct bench_window *window,
+        struct bench_window *parent) {
+    const struct bench_client_config *config = &state->client->config;
+    window->state = state;
+    window->role = BENCH_WINDOW_POPUP;
+    window->surface = wl_compositor_create_surface(state->compositor);
+    window->xdg_surface = xdg_wm_base_get_xdg_surface(state->wm_base, window->surface);
+    xdg_surface_add_listener(window->xdg_surface, &xdg_surface_listener, window);
+
+    /* A menu-sized popup hanging off the parent's bottom-right corner. */
+    struct xdg_positioner *positioner = xdg_wm_base_create_positioner(state->wm_base);
+    xdg_positioner_set_size(positioner, config->width / 2 + 1, config->height / 2 + 1);
+    xdg_positioner_set_anchor_rect(positioner, 0, 0, config->width, config->height);
+    window->xdg_popup = xdg_surface_get_popup(window->xdg_surface, parent->xdg_surface,
+        positioner);
+    xdg_positioner_destroy(positioner);
+    xdg_popup_add_listener(window->xdg_popup, &xdg_popup_listener, window);
+    wl_surface_commit(window->surface);
+}
+
+static void layer_init(struct bench_client_state *state, struct bench_window *window,
+        int index) {
+    const struct bench_client_config *config = &state->client->config;
+    window->state = state;
+    window->role = BENCH_WINDOW_LAYER;
+    window->surface = wl_compositor_create_surface(state->compositor);
+    window->layer_surface = zwlr_layer_shell_v1_get_layer_surface(state->layer_shell,
+        window->surface, NULL,
+        index % 2 ? ZWLR_LAYER_SHELL_V1_LAYER_TOP : ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM,
+        "planar-bench");
+    zwlr_layer_surface_v1_add_listener(window->layer_surface, &layer_surface_listener, window);
+
+    /* Spread layer surfaces with a cheap deterministic hash of the index. */
+    uint32_t hash = (uint32_t)(index + 1) * 2654435761u + state->client->index;
+    int area_width = config->layer_area_width > config->width ?
+        config->layer_area_width - config->width : 1;
+    int area_height = config->layer_area_height > config->height ?
+        config->layer_area_height - config->height : 1;
+    zwlr_layer_surface_v1_set_size(window->layer_surface, config->width, config->height);
+    zwlr_layer_surface_v1_set_anchor(window->layer_surface,
+        ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP | ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT);
+    zwlr_layer_surface_v1_set_margin(window->layer_surface,
+        (hash >> 16) % area_height, 0, 0, hash % area_width);
+    wl_surface_commit(window->surface);
+}
+
+static void window_finish(struct bench_window *window) {
+    for (int i = 0; i < BENCH_CLIENT_BUFFERS; i++) {
+        buffer_finish(&window->buffers[i]);
+    }
+    if (window->xdg_popup) {
+        xdg_popup_destroy(window->xdg_popup);
+    }
+    if (window->xdg_toplevel) {
+        xdg_toplevel_destroy(window->xdg_toplevel);
+    }
+    if (window->xdg_surface) {
+        xdg_surface_destroy(window->xdg_surface);
+    }
+    if (window->layer_surface) {
+        zwlr_layer_surface_v1_destroy(window->layer_surface);
+    }
+    if (window->surface) {
+        wl_surface_destroy(window->surface);
+    }
+}
+
+static void client_dispatch(struct bench_client_state *state, int timeout_ms) {
+    struct wl_display *display = state->display;
+    while (wl_display_prepare_read(display) != 0) {
+        wl_display_dispatch_pending(display);
+    }
+    wl_display_flush(display);
+
+    struct pollfd pfd = { .fd = wl_display_get_fd(display), .events = POLLIN };
+    if (poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & POLLIN)) {
+        wl_display_read_events(display);
+    } else {
+        wl_display_cancel_read(display);
+    }
+    wl_display_dispatch_pending(display);
+}
+
+static void *client_thread(void *data) {
+    struct bench_client *client = data;
+    struct bench_client_state *state = client->state;
+
+    state->display = wl_display_connect(client->config.display);
+    if (!state->display) {
+        fprintf(stderr, "bench client %d: unable to connect to %s\n",
+            client->index, client->config.display);
+        atomic_store(&client->ready, true);
+        return NULL;
+    }
+
+    state->registry = wl_display_get_registry(state->display);
+    wl_registry_add_listener(state->registry, &registry_listener, state);
+    wl_display_roundtrip(state->display);
+    if (!state->compositor || !state->shm || !state->wm_base) {
+        fprintf(stderr, "bench client %d: missing globals\n", client->index);
+        atomic_store(&client->ready, true);
+        wl_display_disconnect(state->display);
+        return NULL;
+    }
+
+    const struct bench_client_config *config = &client->config;
+    int popups = config->popups < config->windows ? config->popups : config->windows;
+    int layers = state->layer_shell ? config->layer_surfaces : 0;
+    state->windows = calloc(config->windows + popups + layers, sizeof(*state->windows));
+    for (int i = 0; i < config->windows; i++) {
+        toplevel_init(state, &state->windows[state->n_windows++], i);
+    }
+    /* Popups need a configured parent, so wait for the toplevels first. */
+    wl_display_roundtrip(state->display);
+    for (int i = 0; i < popups; i++) {
+        popup_init(state, &state->windows[state->n_windows++], &state->windows[i]);
+    }
+    for (int i = 0; i < layers; i++) {
+        layer_init(state, &state->windows[state->n_windows++], i);
+    }
+    wl_display_roundtrip(state->display);
+    atomic_store(&client->ready, true);
+
+    uint64_t period_ns = client->config.commit_hz > 0 ?
+        1000000000ull / client->config.commit_hz : 0;
+    uint64_t next_commit = now_ns() + period_ns;
+
+    while (atomic_load(&client->running)) {
+        int timeout_ms = 50;
+        if (period_ns) {
+            uint64_t now = now_ns();
+            timeout_ms = now >= next_commit ? 0 : (int)((next_commit - now) / 1000000);
+        }
+        client_dispatch(state, timeout_ms);
+
+        if (period_ns && now_ns() >= next_commit) {
+            for (int i = 0; i < state->n_windows; i++) {
+                if (state->windows[i].configured) {
+                    window_draw(&state->windows[i]);
+                }
+            }
+            next_commit += period_ns;
+        }
+        if (wl_display_get_error(state->display)) {
+            fprintf(stderr, "bench client %d: protocol error\n", client->index);
+            break;
+        }
+    }
+
+    /* Children go first so popups never outlive their parent. */
+    for (int i = state->n_windows - 1; i >= 0; i--) {
+        window_finish(&state->windows[i]);
+    }
+    free(state->windows);
+    if (state->pointer) {
+        wl_pointer_destroy(state->pointer);
+    }
+    if (state->seat) {
+        wl_seat_destroy(state->seat);
+    }
+    if (state->layer_shell) {
+        zwlr_layer_shell_v1_destroy(state->layer_shell);
+    }
+    xdg_wm_base_destroy(state->wm_base);
+    wl_shm_destroy(state->shm);
+    wl_compositor_destroy(state->compositor);
+    wl_registry_destroy(state->registry);
+    wl_display_flush(state->display);
+    wl_display_disconnect(state->display);
+    return NULL;
+}
+
+bool bench_client_start(struct bench_client *client, int index,
+        const struct bench_client_config *config) {
+    memset(client, 0, sizeof(*client));
+    client->index = index;
+    client->config = *config;
+    client->state = calloc(1, sizeof(*client->state));
+    if (!client->state) {
+        return false;
+    }
+    client->state->client = client;
+    atomic_store(&client->running, true);
+
+    if (pthread_create(&client->thread, NULL, client_thread, client) != 0) {
+        free(client->state);
+        client->state = NULL;
+        return false;
+    }
+    return true;
+}
+
+void bench_client_stop(struct bench_client *client) {
+    if (!client->state) {
+        return;
+    }
+    atomic_store(&client->running, false);
+    pthread_join(client->thread, NULL);
+    free(client->state);
+    client->state = NULL;
+}
@@ -0,0 +1,47 @@
+#ifndef PLANAR_BENCH_CLIENT_H
+#define PLANAR_BENCH_CLIENT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct bench_client_config {
+    const char *display;
+    int windows;
+    int width, height;
+    int commit_hz;
+    int damage_percent;
+
+    /* Extra surfaces for scene-size benchmarks: popups are attached to the
+     * first toplevels, layer surfaces are spread over layer_area using
+     * top/left margins. */
+    int popups;
+    int layer_surfaces;
+    int layer_area_width, layer_area_height;
+};
+
+/* A synthetic Wayland client running on its own thread with its own
+ * wl_display connection. Each surface commits a fresh shm buffer at
+ * commit_hz (or once, if commit_hz is 0), and toplevels answer left/right
+ * button presses with an interactive move/resize request so the
+ * compositor's grab paths can be driven. */
+struct bench_client {
+    int index;
+    struct bench_client_config config;
+    pthread_t thread;
+    atomic_bool running;
+    atomic_bool ready;
+
+    atomic_uint_fast64_t commits;
+    atomic_uint_fast64_t bytes_damaged;
+    atomic_uint_fast64_t configures;
+
+    struct bench_client_state *state;
+};
+
+bool bench_client_start(struct bench_client *client, int index,
+        const struct bench_client_config *config);
+void bench_client_stop(struct bench_client *client);
+
+#endif // PLANAR_BENCH_CLIENT_H
@@ -0,0 +1,78 @@
+#include "harness.h"
+#include "server.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <wlr/backend/headless.h>
+#include <wlr/util/log.h>
+
+void samples_add(struct bench_samples *samples, uint64_t value) {
+    if (samples->len == samples->cap) {
+        size_t cap = samples->cap ? samples->cap * 2 : 1024;
+        uint64_t *values = realloc(samples->values, cap * sizeof(*values));
+        if (!values) {
+            return;
+        }
+        samples->values = values;
+        samples->cap = cap;
+    }
+    samples->values[samples->len++] = value;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+double samples_percentile_us(struct bench_samples *samples, double p) {
+    if (samples->len == 0) {
+        return 0;
+    }
+    qsort(samples->values, samples->len, sizeof(uint64_t), compare_u64);
+    size_t index = (size_t)(p * (samples->len - 1) + 0.5);
+    return samples->values[index] / 1000.0;
+}
+
+void samples_finish(struct bench_samples *samples) {
+    free(samples->values);
+    samples->values = NULL;
+    samples->len = samples->cap = 0;
+}
+
+struct wlr_output *bench_server_start(struct planar_server *server, int width, int height) {
+    /* Always run GPU-less: headless outputs rendered with pixman. The
+     * backend would add a 1280x720 output of its own, which would take the
+     * layout origin the windows map at, so the measured output is the only
+     * one. */
+    setenv("WLR_BACKENDS", "headless", true);
+    setenv("WLR_HEADLESS_OUTPUTS", "0", true);
+    setenv("WLR_RENDERER", "pixman", true);
+    wlr_log_init(WLR_ERROR, NULL);
+
+    server_init(server);
+    if (!server->socket || !wlr_backend_start(server->backend)) {
+        fprintf(stderr, "Unable to start the headless backend\n");
+        return NULL;
+    }
+
+    struct wlr_backend *headless = server_headless_backend(server);
+    if (!headless) {
+        fprintf(stderr, "No headless backend available\n");
+        return NULL;
+    }
+    return wlr_headless_add_output(headless, width, height);
+}
+
+void bench_dispatch(struct planar_server *server, int timeout_ms) {
+    wl_event_loop_dispatch(wl_display_get_event_loop(server->wl_display), timeout_ms);
+    wl_display_flush_clients(server->wl_display);
+}
+
+void bench_dispatch_until(struct planar_server *server, uint64_t deadline_ns) {
+    uint64_t now;
+    while ((now = stats_now_ns()) < deadline_ns) {
+        bench_dispatch(server, (int)((deadline_ns - now + 999999) / 1000000));
+    }
+}
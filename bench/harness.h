@@ -0,0 +1,27 @@
+#ifndef PLANAR_BENCH_HARNESS_H
+#define PLANAR_BENCH_HARNESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct planar_server;
+struct wlr_output;
+
+struct bench_samples {
+    uint64_t *values;
+    size_t len, cap;
+};
+
+void samples_add(struct bench_samples *samples, uint64_t value);
+double samples_percentile_us(struct bench_samples *samples, double p);
+void samples_finish(struct bench_samples *samples);
+
+/* Bring up the compositor on the headless backend with the pixman renderer
+ * and a single output of the given size. */
+struct wlr_output *bench_server_start(struct planar_server *server, int width, int height);
+
+void bench_dispatch(struct planar_server *server, int timeout_ms);
+void bench_dispatch_until(struct planar_server *server, uint64_t deadline_ns);
+
+#endif // PLANAR_BENCH_HARNESS_H
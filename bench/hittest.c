@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "output.h"
+#include "toplevel.h"
+#include "layers.h"
+#include "stats.h"
+#include "client.h"
+#include "harness.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HITTEST_MAX_STEPS 16
+
+struct hittest_options {
+    int steps[HITTEST_MAX_STEPS];
+    int n_steps;
+    int windows_per_client;
+    int popup_ratio;
+    int layer_ratio;
+    int queries;
+    int width, height;
+    int canvas_width, canvas_height;
+    int output_width, output_height;
+};
+
+struct hittest_point {
+    double x, y;
+};
+
+struct hittest_result {
+    double ns_per_query;
+    double hit_ratio;
+};
+
+struct hittest_state {
+    struct planar_server server;
+    struct hittest_options options;
+    struct wlr_output *output;
+    struct bench_client *clients;
+    int n_clients;
+    int toplevels, popups, layers;
+    uint64_t rng;
+};
+
+static uint64_t rng_next(struct hittest_state *state) {
+    /* xorshift64, seeded once so every run queries the same points. */
+    state->rng ^= state->rng << 13;
+    state->rng ^= state->rng >> 7;
+    state->rng ^= state->rng << 17;
+    return state->rng;
+}
+
+static double rng_range(struct hittest_state *state, int range) {
+    return range > 0 ? (double)(rng_next(state) % (uint64_t)range) : 0;
+}
+
+static int count_scene_nodes(struct wlr_scene_node *node) {
+    int count = 1;
+    if (node->type == WLR_SCENE_NODE_TREE) {
+        struct wlr_scene_tree *tree = wlr_scene_tree_from_node(node);
+        struct wlr_scene_node *child;
+        wl_list_for_each(child, &tree->children, link) {
+            count += count_scene_nodes(child);
+        }
+    }
+    return count;
+}
+
+static bool hittest_grow(struct hittest_state *state, int target) {
+    /* Add clients until the scene holds the requested number of toplevels,
+     * with popups and layer surfaces in the configured proportions. */
+    struct hittest_options *options = &state->options;
+    int added = 0;
+    while (state->toplevels + added < target) {
+        int windows = target - state->toplevels - added;
+        if (windows > options->windows_per_client) {
+            windows = options->windows_per_client;
+        }
+        struct bench_client_config config = {
+            .display = state->server.socket,
+            .windows = windows,
+            .width = options->width,
+            .height = options->height,
+            .commit_hz = 0,
+            .damage_percent = 100,
+            .popups = options->popup_ratio ? windows / options->popup_ratio : 0,
+            .layer_surfaces = options->layer_ratio ? windows / options->layer_ratio : 0,
+            .layer_area_width = options->output_width,
+            .layer_area_height = options->output_height,
+        };
+        struct bench_client *client = &state->clients[state->n_clients];
+        if (!bench_client_start(client, state->n_clients, &config)) {
+            return false;
+        }
+        state->n_clients++;
+        state->popups += config.popups;
+        state->layers += config.layer_surfaces;
+        added += windows;
+    }
+    state->toplevels += added;
+
+    /* Clients only report ready after a roundtrip, by which point their
+     * surfaces are mapped. */
+    for (int i = 0; i < state->n_clients; i++) {
+        while (!atomic_load(&state->clients[i].ready)) {
+            bench_dispatch(&state->server, 10);
+        }
+    }
+    return wl_list_length(&state->server.toplevels) >= target;
+}
+
+static void hittest_scatter(struct hittest_state *state) {
+    /* Everything maps at the canvas origin, spread it over the canvas. */
+    struct planar_toplevel *toplevel;
+    wl_list_for_each(toplevel, &state->server.toplevels, link) {
+        wlr_scene_node_set_position(&toplevel->scene_tree->node,
+            rng_range(state, state->options.canvas_width - state->options.width),
+            rng_range(state, state->options.canvas_height - state->options.height));
+    }
+}
+
+static void hittest_render_frame(struct hittest_state *state) {
+    struct planar_output *output = state->output->data;
+    uint64_t frames = output->stats.frames;
+    wlr_output_schedule_frame(state->output);
+    uint64_t deadline = stats_now_ns() + 1000000000ull;
+    while (output->stats.frames == frames && stats_now_ns() < deadline) {
+        bench_dispatch(&state->server, 5);
+    }
+}
+
+static struct hittest_result measure_toplevel_at(struct hittest_state *state,
+        const struct hittest_point *points, int n) {
+    /* Points are in layout coordinates, as process_cursor_motion passes
+     * them; the canvas tree carries the pan. */
+    struct planar_server *server = &state->server;
+    int hits = 0;
+    uint64_t start = stats_now_ns();
+    for (int i = 0; i < n; i++) {
+        double x = points[i].x, y = points[i].y, sx, sy;
+        struct wlr_surface *surface = NULL;
+        if (desktop_toplevel_at(server, x, y, &surface, &sx, &sy)) {
+            hits++;
+        }
+    }
+    uint64_t elapsed = stats_now_ns() - start;
+    return (struct hittest_result){
+        .ns_per_query = (double)elapsed / n,
+        .hit_ratio = (double)hits / n,
+    };
+}
+
+static struct hittest_result measure_layer_surface_at(struct hittest_state *state,
+        const struct hittest_point *points, int n) {
+    struct planar_server *server = &state->server;
+    int hits = 0;
+    uint64_t start = stats_now_ns();
+    for (int i = 0; i < n; i++) {
+        double sx, sy;
+        struct wlr_surface *surface = NULL;
+        if (layer_surface_at(server, points[i].x, points[i].y, &surface, &sx, &sy)) {
+            hits++;
+        }
+    }
+    uint64_t elapsed = stats_now_ns() - start;
+    return (struct hittest_result){
+        .ns_per_query = (double)elapsed / n,
+        .hit_ratio = (double)hits / n,
+    };
+}
+
+static void hittest_run_step(struct hittest_state *state) {
+    struct hittest_options *options = &state->options;
+    struct planar_server *server = &state->server;
+    int n = options->queries;
+
+    struct hittest_point *canvas = calloc(n, sizeof(*canvas));
+    struct hittest_point *screen = calloc(n, sizeof(*screen));
+    for (int i = 0; i < n; i++) {
+        canvas[i].x = rng_range(state, options->canvas_width);
+        canvas[i].y = rng_range(state, options->canvas_height);
+        screen[i].x = rng_range(state, options->output_width);
+        screen[i].y = rng_range(state, options->output_height);
+    }
+
+    server->global_offset.x = 0;
+    server->global_offset.y = 0;
+    hittest_render_frame(state);
+    struct hittest_result toplevel = measure_toplevel_at(state, canvas, n);
+    struct hittest_result layer = measure_layer_surface_at(state, screen, n);
+
+    /* Pan into the middle of the canvas and let a frame go through, then
+     * query on-screen points like pointer events would. */
+    server->global_offset.x = -options->canvas_width / 2.0;
+    server->global_offset.y = -options->canvas_height / 2.0;
+    hittest_render_frame(state);
+    struct hittest_result toplevel_panned = measure_toplevel_at(state, screen, n);
+    struct hittest_result layer_panned = measure_layer_surface_at(state, screen, n);
+
+    printf("%9d %7d %7d %7d %11.0f %6.1f%% %11.0f %6.1f%% %11.0f %6.1f%% %11.0f\n",
+        state->toplevels, state->popups, state->layers,
+        count_scene_nodes(&server->scene->tree.node),
+        toplevel.ns_per_query, toplevel.hit_ratio * 100,
+        layer.ns_per_query, layer.hit_ratio * 100,
+        toplevel_panned.ns_per_query, toplevel_panned.hit_ratio * 100,
+        layer_panned.ns_per_query);
+    fflush(stdout);
+
+    free(canvas);
+    free(screen);
+}
+
+static bool parse_size(const char *arg, int *width, int *height) {
+    return sscanf(arg, "%dx%d", width, height) == 2 && *width > 0 && *height > 0;
+}
+
+static bool parse_steps(const char *arg, struct hittest_options *options) {
+    options->n_steps = 0;
+    char *copy = strdup(arg);
+    for (char *tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+        int step = atoi(tok);
+        if (step <= 0 || options->n_steps == HITTEST_MAX_STEPS ||
+                (options->n_steps > 0 && step <= options->steps[options->n_steps - 1])) {
+            free(copy);
+            return false;
+        }
+        options->steps[options->n_steps++] = step;
+    }
+    free(copy);
+    return options->n_steps > 0;
+}
+
+static void usage(const char *name) {
+    printf("Usage: %s [-n toplevel counts, ascending, comma separated]\n"
+        "       [-q queries per measurement] [-p toplevels per popup]\n"
+        "       [-l toplevels per layer surface] [-c toplevels per client]\n"
+        "       [-s WxH surface size] [-C WxH canvas size] [-o WxH output size]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    struct hittest_state state = {
+        .options = {
+            .steps = { 100, 1000, 5000, 10000 },
+            .n_steps = 4,
+            .windows_per_client = 500,
+            .popup_ratio = 10,
+            .layer_ratio = 100,
+            .queries = 20000,
+            .width = 48, .height = 48,
+            .canvas_width = 20000, .canvas_height = 20000,
+            .output_width = 1920, .output_height = 1080,
+        },
+        .rng = 0x9e3779b97f4a7c15ull,
+    };
+    struct hittest_options *options = &state.options;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:q:p:l:c:s:C:o:h")) != -1) {
+        bool ok = true;
+        switch (c) {
+        case 'n':
+            ok = parse_steps(optarg, options);
+            break;
+        case 'q':
+            options->queries = atoi(optarg);
+            ok = options->queries > 0;
+            break;
+        case 'p':
+            options->popup_ratio = atoi(optarg);
+            break;
+        case 'l':
+            options->layer_ratio = atoi(optarg);
+            break;
+        case 'c':
+            options->windows_per_client = atoi(optarg);
+            ok = options->windows_per_client > 0;
+            break;
+        case 's':
+            ok = parse_size(optarg, &options->width, &options->height);
+            break;
+        case 'C':
+            ok = parse_size(optarg, &options->canvas_width, &options->canvas_height);
+            break;
+        case 'o':
+            ok = parse_size(optarg, &options->output_width, &options->output_height);
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    state.output = bench_server_start(&state.server,
+        options->output_width, options->output_height);
+    if (!state.output) {
+        return 1;
+    }
+
+    int max_toplevels = options->steps[options->n_steps - 1];
+    state.clients = calloc(max_toplevels / options->windows_per_client + options->n_steps,
+        sizeof(*state.clients));
+
+    printf("planar-hittest: %dx%d surfaces on a %dx%d canvas, %d queries per cell\n",
+        options->width, options->height, options->canvas_width, options->canvas_height,
+        options->queries);
+    printf("%9s %7s %7s %7s %11s %7s %11s %7s %11s %7s %11s\n",
+        "toplevels", "popups", "layers", "nodes", "top ns/q", "hit",
+        "layer ns/q", "hit", "panned ns/q", "hit", "pan lyr ns/q");
+
+    for (int i = 0; i < options->n_steps; i++) {
+        if (!hittest_grow(&state, options->steps[i])) {
+            fprintf(stderr, "Only %d of %d toplevels mapped\n",
+                wl_list_length(&state.server.toplevels), options->steps[i]);
+            break;
+        }
+        hittest_scatter(&state);
+        hittest_run_step(&state);
+    }
+
+    for (int i = 0; i < state.n_clients; i++) {
+        bench_client_stop(&state.clients[i]);
+    }
+    free(state.clients);
+    server_finish(&state.server);
+    return 0;
+}
@@ -0,0 +1,378 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "output.h"
+#include "stats.h"
+#include "virtual-input.h"
+#include "client.h"
+#include "harness.h"
+
+#include <inttypes.h>
+#include <linux/input-event-codes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+struct bench_options {
+    int clients;
+    int windows;
+    int width, height;
+    int commit_hz;
+    int damage_percent;
+    int input_hz;
+    double phase_seconds;
+    int output_width, output_height;
+    bool render_threads;
+    int upload_workers;
+};
+
+struct bench_phase {
+    const char *name;
+    struct bench_samples frames;
+    struct bench_samples input;
+    /* How late each input event was handled, i.e. how long the main loop
+     * was busy elsewhere when it was due. */
+    struct bench_samples late;
+    uint64_t wall_ns;
+    uint64_t cpu_main_ns;
+    uint64_t cpu_total_ns;
+    uint64_t commits;
+    bool skipped;
+};
+
+struct bench_state {
+    struct planar_server server;
+    struct bench_options options;
+    struct planar_virtual_input *input;
+    struct wlr_output *output;
+    struct wl_listener output_frame;
+    struct bench_client *clients;
+    struct bench_phase *phase;
+    uint32_t time_msec;
+};
+
+static uint64_t cpu_time_ns(int who) {
+    struct rusage usage;
+    getrusage(who, &usage);
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ull +
+        (uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ull;
+}
+
+static uint64_t total_commits(struct bench_state *bench) {
+    uint64_t commits = 0;
+    for (int i = 0; i < bench->options.clients; i++) {
+        commits += atomic_load(&bench->clients[i].commits);
+    }
+    return commits;
+}
+
+static void bench_output_frame(struct wl_listener *listener, void *data) {
+    /* Runs after output_frame, so the output's stats hold this frame. */
+    struct bench_state *bench = wl_container_of(listener, bench, output_frame);
+    struct planar_output *output = bench->output->data;
+    if (bench->phase && output) {
+        samples_add(&bench->phase->frames, output->stats.last_duration_ns);
+    }
+}
+
+static bool bench_wait_cursor_mode(struct bench_state *bench, enum planar_cursor_mode mode) {
+    /* Grabs are requested by the client in response to the button event, so
+     * keep the loop spinning until its request arrives. */
+    uint64_t deadline = stats_now_ns() + 1000000000ull;
+    while (bench->server.cursor_mode != mode) {
+        if (stats_now_ns() >= deadline) {
+            return false;
+        }
+        bench_dispatch(&bench->server, 1);
+    }
+    return true;
+}
+
+static void bench_warp(struct bench_state *bench, double x, double y) {
+    struct wlr_box box;
+    wlr_output_layout_get_box(bench->server.output_layout, NULL, &box);
+    virtual_input_motion_absolute(bench->input, bench->time_msec,
+        (x - box.x) / box.width, (y - box.y) / box.height);
+    virtual_input_frame(bench->input);
+}
+
+static void bench_drive_motion(struct bench_state *bench, double radius) {
+    /* Emit relative motion along a circle at input_hz for the phase length,
+     * timing the compositor's handling of each event. */
+    struct bench_options *options = &bench->options;
+    uint64_t period_ns = 1000000000ull / options->input_hz;
+    uint64_t start = stats_now_ns();
+    uint64_t end = start + (uint64_t)(options->phase_seconds * 1e9);
+    uint64_t next = start;
+    double angle = 0, step = 2 * M_PI / options->input_hz;
+
+    while (next < end) {
+        bench_dispatch_until(&bench->server, next);
+
+        double dx = radius * (cos(angle + step) - cos(angle));
+        double dy = radius * (sin(angle + step) - sin(angle));
+        angle += step;
+        bench->time_msec += period_ns / 1000000 ? period_ns / 1000000 : 1;
+
+        uint64_t before = stats_now_ns();
+        samples_add(&bench->phase->late, before - next);
+        virtual_input_motion(bench->input, bench->time_msec, dx, dy);
+        virtual_input_frame(bench->input);
+        samples_add(&bench->phase->input, stats_now_ns() - before);
+
+        next += period_ns;
+    }
+}
+
+static void bench_run_phase(struct bench_state *bench, struct bench_phase *phase) {
+    struct planar_server *server = &bench->server;
+    int cx = bench->options.output_width / 2;
+    int cy = bench->options.output_height / 2;
+
+    server->global_offset.x = 0;
+    server->global_offset.y = 0;
+    bench->phase = phase;
+
+    uint64_t wall = stats_now_ns();
+    uint64_t cpu_main = cpu_time_ns(RUSAGE_THREAD);
+    uint64_t cpu_total = cpu_time_ns(RUSAGE_SELF);
+    uint64_t commits = total_commits(bench);
+
+    if (strcmp(phase->name, "idle") == 0) {
+        bench_dispatch_until(server, wall + (uint64_t)(bench->options.phase_seconds * 1e9));
+    } else if (strcmp(phase->name, "hover") == 0) {
+        bench_warp(bench, cx, cy);
+        bench_drive_motion(bench, cy / 2.0);
+    } else if (strcmp(phase->name, "pan") == 0) {
+        bench_warp(bench, cx, cy);
+        virtual_input_button(bench->input, ++bench->time_msec, BTN_MIDDLE, true);
+        bench_drive_motion(bench, cy / 2.0);
+        virtual_input_button(bench->input, ++bench->time_msec, BTN_MIDDLE, false);
+    } else {
+        bool move = strcmp(phase->name, "move") == 0;
+        uint32_t button = move ? BTN_LEFT : BTN_RIGHT;
+        /* Toplevels are mapped at the canvas origin, aim inside them. */
+        bench_warp(bench, bench->options.width / 4, bench->options.height / 4);
+        virtual_input_button(bench->input, ++bench->time_msec, button, true);
+        virtual_input_frame(bench->input);
+        if (bench_wait_cursor_mode(bench,
+                move ? PLANAR_CURSOR_MOVE : PLANAR_CURSOR_RESIZE)) {
+            bench_drive_motion(bench, bench->options.height / 4.0);
+        } else {
+            phase->skipped = true;
+        }
+        virtual_input_button(bench->input, ++bench->time_msec, button, false);
+        virtual_input_frame(bench->input);
+    }
+
+    phase->wall_ns = stats_now_ns() - wall;
+    phase->cpu_main_ns = cpu_time_ns(RUSAGE_THREAD) - cpu_main;
+    phase->cpu_total_ns = cpu_time_ns(RUSAGE_SELF) - cpu_total;
+    phase->commits = total_commits(bench) - commits;
+    bench->phase = NULL;
+}
+
+static void bench_report(struct bench_state *bench, struct bench_phase *phases, size_t n) {
+    struct bench_options *options = &bench->options;
+    printf("planar-bench: %d clients x %d windows, %dx%d buffers @ %d Hz, "
+        "%d%% damage, input %d Hz, output %dx%d, render %s, %d upload workers\n",
+        options->clients, options->windows, options->width, options->height,
+        options->commit_hz, options->damage_percent, options->input_hz,
+        options->output_width, options->output_height,
+        options->render_threads ? "threaded" : "inline",
+        bench->server.uploads ? bench->server.uploads->n_threads : 0);
+    printf("%-7s %7s %9s %9s %9s %9s %9s %9s %9s %9s %9s %10s %10s %9s\n",
+        "phase", "frames", "frame50", "frame90", "frame99", "framemax",
+        "input50", "input99", "inputmax", "late99", "latemax",
+        "cpu_main", "cpu_total", "commits/s");
+    for (size_t i = 0; i < n; i++) {
+        struct bench_phase *phase = &phases[i];
+        if (phase->skipped) {
+            printf("%-7s skipped: client did not start the grab\n", phase->name);
+            continue;
+        }
+        double seconds = phase->wall_ns / 1e9;
+        printf("%-7s %7zu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f "
+            "%9.1fms %9.1fms %9.0f\n",
+            phase->name, phase->frames.len,
+            samples_percentile_us(&phase->frames, 0.50),
+            samples_percentile_us(&phase->frames, 0.90),
+            samples_percentile_us(&phase->frames, 0.99),
+            samples_percentile_us(&phase->frames, 1.0),
+            samples_percentile_us(&phase->input, 0.50),
+            samples_percentile_us(&phase->input, 0.99),
+            samples_percentile_us(&phase->input, 1.0),
+            samples_percentile_us(&phase->late, 0.99),
+            samples_percentile_us(&phase->late, 1.0),
+            phase->cpu_main_ns / 1e6, phase->cpu_total_ns / 1e6,
+            seconds > 0 ? phase->commits / seconds : 0);
+    }
+    printf("frame, input and late columns are in microseconds; frames are main loop "
+        "time, without drawing when threaded; late is how long input waited on "
+        "the main loop\n");
+    const struct planar_upload_pool *pool = bench->server.uploads;
+    if (pool) {
+        printf("uploads: %" PRIu64 " on workers, %" PRIu64 " inline, %" PRIu64 " skipped, "
+            "%.1f MiB copied\n", pool->async_uploads, pool->sync_uploads, pool->skipped,
+            pool->bytes / (1024.0 * 1024.0));
+    }
+}
+
+static bool parse_size(const char *arg, int *width, int *height) {
+    return sscanf(arg, "%dx%d", width, height) == 2 && *width > 0 && *height > 0;
+}
+
+static void usage(const char *name) {
+    printf("Usage: %s [-c clients] [-n windows per client] [-s WxH buffer size]\n"
+        "       [-r commit Hz] [-d damage %%] [-i input Hz] [-t seconds per phase]\n"
+        "       [-o WxH output size] [-T render on a thread]\n"
+        "       [-U upload workers, with -T]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    struct bench_state bench = {
+        .options = {
+            .clients = 4,
+            .windows = 1,
+            .width = 800, .height = 600,
+            .commit_hz = 60,
+            .damage_percent = 25,
+            .input_hz = 1000,
+            .phase_seconds = 2.0,
+            .output_width = 1920, .output_height = 1080,
+        },
+    };
+    struct bench_options *options = &bench.options;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:n:s:r:d:i:t:o:TU:h")) != -1) {
+        switch (c) {
+        case 'c':
+            options->clients = atoi(optarg);
+            break;
+        case 'n':
+            options->windows = atoi(optarg);
+            break;
+        case 's':
+            if (!parse_size(optarg, &options->width, &options->height)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            options->commit_hz = atoi(optarg);
+            break;
+        case 'd':
+            options->damage_percent = atoi(optarg);
+            break;
+        case 'i':
+            options->input_hz = atoi(optarg);
+            break;
+        case 't':
+            options->phase_seconds = atof(optarg);
+            break;
+        case 'o':
+            if (!parse_size(optarg, &options->output_width, &options->output_height)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'T':
+            options->render_threads = true;
+            break;
+        case 'U':
+            options->upload_workers = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (options->clients < 0 || options->windows < 1 || options->input_hz < 1 ||
+            options->damage_percent < 0 || options->damage_percent > 100 ||
+            options->upload_workers < 0 ||
+            (options->upload_workers && !options->render_threads)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct planar_server *server = &bench.server;
+    server->render_threads = options->render_threads;
+    bench.output = bench_server_start(server, options->output_width, options->output_height);
+    if (!bench.output) {
+        return 1;
+    }
+    bench.output_frame.notify = bench_output_frame;
+    wl_signal_add(&bench.output->events.frame, &bench.output_frame);
+
+    if (options->upload_workers && !upload_init(server, options->upload_workers)) {
+        fprintf(stderr, "Unable to start upload workers\n");
+        return 1;
+    }
+    bench.input = virtual_input_create(server);
+
+    struct bench_client_config config = {
+        .display = server->socket,
+        .windows = options->windows,
+        .width = options->width,
+        .height = options->height,
+        .commit_hz = options->commit_hz,
+        .damage_percent = options->damage_percent,
+    };
+    bench.clients = calloc(options->clients > 0 ? options->clients : 1, sizeof(*bench.clients));
+    for (int i = 0; i < options->clients; i++) {
+        if (!bench_client_start(&bench.clients[i], i, &config)) {
+            fprintf(stderr, "Unable to start client %d\n", i);
+            for (int j = 0; j < i; j++) {
+                bench_client_stop(&bench.clients[j]);
+            }
+            free(bench.clients);
+            wl_list_remove(&bench.output_frame.link);
+            virtual_input_destroy(bench.input);
+            server_finish(server);
+            return 1;
+        }
+    }
+
+    /* Let every client map its windows before measuring. */
+    int expected = options->clients * options->windows;
+    uint64_t deadline = stats_now_ns() + 10000000000ull;
+    while (wl_list_length(&server->toplevels) < expected && stats_now_ns() < deadline) {
+        bench_dispatch(&bench.server, 10);
+    }
+    if (wl_list_length(&server->toplevels) < expected) {
+        fprintf(stderr, "Only %d of %d windows mapped\n",
+            wl_list_length(&server->toplevels), expected);
+    }
+
+    struct bench_phase phases[] = {
+        { .name = "idle" },
+        { .name = "hover" },
+        { .name = "pan" },
+        { .name = "move" },
+        { .name = "resize" },
+    };
+    size_t n_phases = sizeof(phases) / sizeof(phases[0]);
+    for (size_t i = 0; i < n_phases; i++) {
+        bench_run_phase(&bench, &phases[i]);
+    }
+
+    bench_report(&bench, phases, n_phases);
+
+    for (int i = 0; i < options->clients; i++) {
+        bench_client_stop(&bench.clients[i]);
+    }
+    free(bench.clients);
+    for (size_t i = 0; i < n_phases; i++) {
+        samples_finish(&phases[i].frames);
+        samples_finish(&phases[i].input);
+        samples_finish(&phases[i].late);
+    }
+
+    wl_list_remove(&bench.output_frame.link);
+    virtual_input_destroy(bench.input);
+    server_finish(server);
+    return 0;
+}
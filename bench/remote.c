@@ -0,0 +1,349 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "remote.h"
+#include "stats.h"
+#include "client.h"
+#include "harness.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+/* Runs the compositor on a headless remote output and reads the ring from
+ * a forked consumer, the way an encoder would: it keeps its own copy of
+ * the screen up to date from damage rects alone, and at the end checks
+ * that copy against the newest full frame, and that frame for the clients'
+ * windows. */
+
+#define CONSUMER_POLL_US 1000
+
+struct remote_options {
+    int clients;
+    int windows;
+    int width, height;
+    int commit_hz;
+    int damage_percent;
+    double seconds;
+    int output_width, output_height;
+};
+
+struct consumer {
+    int fd;
+    struct planar_remote_ring *ring;
+    size_t size;
+    uint8_t *screen;
+    uint64_t seen;
+
+    uint64_t frames, full_copies, torn, reopens;
+    uint64_t bytes_copied, bytes_full;
+};
+
+static bool consumer_open(struct consumer *consumer, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct planar_remote_ring)) {
+        close(fd);
+        return false;
+    }
+    struct planar_remote_ring *ring = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    if (ring->magic != PLANAR_REMOTE_MAGIC || ring->version != PLANAR_REMOTE_VERSION ||
+            ring->n_slots != PLANAR_REMOTE_SLOTS) {
+        munmap(ring, st.st_size);
+        close(fd);
+        return false;
+    }
+
+    if (consumer->ring) {
+        munmap(consumer->ring, consumer->size);
+        close(consumer->fd);
+        consumer->reopens++;
+    }
+    consumer->fd = fd;
+    consumer->ring = ring;
+    consumer->size = st.st_size;
+    free(consumer->screen);
+    consumer->screen = calloc(ring->height, ring->stride);
+    consumer->seen = 0;
+    return consumer->screen != NULL;
+}
+
+static size_t consumer_copy_rect(struct consumer *consumer, const uint8_t *frame,
+        const struct planar_remote_rect *rect) {
+    struct planar_remote_ring *ring = consumer->ring;
+    size_t row = (size_t)rect->width * 4;
+    for (int y = rect->y; y < rect->y + rect->height; y++) {
+        size_t offset = (size_t)y * ring->stride + (size_t)rect->x * 4;
+        memcpy(consumer->screen + offset, frame + offset, row);
+    }
+    return row * rect->height;
+}
+
+static void consumer_update(struct consumer *consumer) {
+    struct planar_remote_ring *ring = consumer->ring;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == 0 || head == consumer->seen) {
+        return;
+    }
+
+    /* Gather the damage of every frame since the last one seen. */
+    struct planar_remote_rect rects[PLANAR_REMOTE_SLOTS * PLANAR_REMOTE_MAX_RECTS];
+    size_t n_rects = 0;
+    bool full = consumer->seen == 0 || head - consumer->seen > PLANAR_REMOTE_SLOTS;
+    for (uint64_t seq = consumer->seen + 1; !full && seq <= head; seq++) {
+        struct planar_remote_slot *slot = &ring->slots[seq % PLANAR_REMOTE_SLOTS];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != seq) {
+            full = true;
+            break;
+        }
+        uint32_t n = slot->n_rects;
+        if (n > PLANAR_REMOTE_MAX_RECTS) {
+            n = PLANAR_REMOTE_MAX_RECTS;
+        }
+        memcpy(&rects[n_rects], slot->rects, n * sizeof(*rects));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+            full = true;
+            break;
+        }
+        n_rects += n;
+    }
+
+    struct planar_remote_slot *slot = &ring->slots[head % PLANAR_REMOTE_SLOTS];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != head) {
+        consumer->torn++;
+        return;
+    }
+    const uint8_t *frame = (const uint8_t *)ring + slot->offset;
+    struct planar_remote_rect whole = { 0, 0, ring->width, ring->height };
+    size_t bytes = 0;
+    if (full) {
+        bytes = consumer_copy_rect(consumer, frame, &whole);
+    } else {
+        for (size_t i = 0; i < n_rects; i++) {
+            bytes += consumer_copy_rect(consumer, frame, &rects[i]);
+        }
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != head) {
+        /* Overwritten while copying, start over from a full frame. */
+        consumer->torn++;
+        consumer->seen = 0;
+        return;
+    }
+
+    consumer->frames++;
+    consumer->full_copies += full;
+    consumer->bytes_copied += bytes;
+    consumer->bytes_full += (size_t)ring->stride * ring->height;
+    consumer->seen = head;
+}
+
+static uint64_t consumer_verify(struct consumer *consumer) {
+    struct planar_remote_ring *ring = consumer->ring;
+    struct planar_remote_slot *slot = &ring->slots[consumer->seen % PLANAR_REMOTE_SLOTS];
+    const uint8_t *frame = (const uint8_t *)ring + slot->offset;
+    uint64_t mismatched = 0;
+    for (uint32_t y = 0; y < ring->height; y++) {
+        const uint32_t *a = (const uint32_t *)(consumer->screen + (size_t)y * ring->stride);
+        const uint32_t *b = (const uint32_t *)(frame + (size_t)y * ring->stride);
+        for (uint32_t x = 0; x < ring->width; x++) {
+            /* XRGB: the padding byte is undefined. */
+            mismatched += (a[x] & 0xffffff) != (b[x] & 0xffffff);
+        }
+    }
+    return mismatched;
+}
+
+static uint64_t consumer_drawn(struct consumer *consumer) {
+    /* The background is black, the clients' bands are the only colour. An
+     * empty screen would pass the damage check just as well. */
+    struct planar_remote_ring *ring = consumer->ring;
+    struct planar_remote_slot *slot = &ring->slots[consumer->seen % PLANAR_REMOTE_SLOTS];
+    const uint8_t *frame = (const uint8_t *)ring + slot->offset;
+    uint64_t drawn = 0;
+    for (uint32_t y = 0; y < ring->height; y++) {
+        const uint32_t *row = (const uint32_t *)(frame + (size_t)y * ring->stride);
+        for (uint32_t x = 0; x < ring->width; x++) {
+            drawn += (row[x] & 0xffffff) != 0;
+        }
+    }
+    return drawn;
+}
+
+static int consumer_run(const char *path, double seconds, bool expect_clients) {
+    struct consumer consumer = { .fd = -1 };
+    uint64_t start = stats_now_ns();
+    uint64_t deadline = start + (uint64_t)(seconds * 1e9);
+    while (!consumer.ring && stats_now_ns() < deadline) {
+        consumer_open(&consumer, path);
+        usleep(CONSUMER_POLL_US);
+    }
+    if (!consumer.ring) {
+        fprintf(stderr, "No remote ring at %s\n", path);
+        return 1;
+    }
+
+    while (stats_now_ns() < deadline) {
+        if (atomic_load_explicit(&consumer.ring->stale, memory_order_acquire)) {
+            consumer_open(&consumer, path);
+        }
+        consumer_update(&consumer);
+        usleep(CONSUMER_POLL_US);
+    }
+    consumer_update(&consumer);
+
+    uint64_t mismatched = consumer.seen ? consumer_verify(&consumer) : 0;
+    uint64_t drawn = consumer.seen ? consumer_drawn(&consumer) : 0;
+    uint64_t published = atomic_load_explicit(&consumer.ring->head, memory_order_acquire);
+    printf("%-20s %10" PRIu64 "\n", "frames published", published);
+    printf("%-20s %10" PRIu64 "\n", "frames read", consumer.frames);
+    printf("%-20s %10" PRIu64 "\n", "full copies", consumer.full_copies);
+    printf("%-20s %10" PRIu64 "\n", "torn reads", consumer.torn);
+    printf("%-20s %10" PRIu64 "\n", "reopens", consumer.reopens);
+    printf("%-20s %9.1f%%\n", "bytes copied",
+        consumer.bytes_full ? 100.0 * consumer.bytes_copied / consumer.bytes_full : 0);
+    printf("%-20s %10" PRIu64 "\n", "mismatched pixels", mismatched);
+    printf("%-20s %10" PRIu64 "\n", "client pixels", drawn);
+    if (expect_clients && drawn == 0) {
+        fprintf(stderr, "No client pixels in the remote ring\n");
+        return 1;
+    }
+    return consumer.seen && mismatched == 0 ? 0 : 1;
+}
+
+static bool parse_size(const char *arg, int *width, int *height) {
+    return sscanf(arg, "%dx%d", width, height) == 2 && *width > 0 && *height > 0;
+}
+
+static void usage(const char *name) {
+    printf("Usage: %s [-c clients] [-n windows per client] [-s WxH buffer size]\n"
+        "       [-r commit Hz] [-d damage %%] [-t seconds] [-o WxH output size]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    struct remote_options options = {
+        .clients = 2,
+        .windows = 1,
+        .width = 640, .height = 480,
+        .commit_hz = 60,
+        .damage_percent = 10,
+        .seconds = 3.0,
+        .output_width = 1920, .output_height = 1080,
+    };
+
+    int c;
+    while ((c = getopt(argc, argv, "c:n:s:r:d:t:o:h")) != -1) {
+        switch (c) {
+        case 'c':
+            options.clients = atoi(optarg);
+            break;
+        case 'n':
+            options.windows = atoi(optarg);
+            break;
+        case 's':
+            if (!parse_size(optarg, &options.width, &options.height)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            options.commit_hz = atoi(optarg);
+            break;
+        case 'd':
+            options.damage_percent = atoi(optarg);
+            break;
+        case 't':
+            options.seconds = atof(optarg);
+            break;
+        case 'o':
+            if (!parse_size(optarg, &options.output_width, &options.output_height)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (options.clients < 0 || options.windows < 1 || options.seconds <= 0 ||
+            options.damage_percent < 0 || options.damage_percent > 100) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* Without the default output the remote one is the whole layout, so
+     * the windows map on it. */
+    setenv("WLR_BACKENDS", "headless", true);
+    setenv("WLR_HEADLESS_OUTPUTS", "0", true);
+    setenv("WLR_RENDERER", "pixman", true);
+    wlr_log_init(WLR_ERROR, NULL);
+
+    struct planar_server server = {0};
+    server_init(&server);
+    if (!server.socket || !remote_init(&server, options.output_width, options.output_height) ||
+            !wlr_backend_start(server.backend)) {
+        fprintf(stderr, "Unable to start the headless backend\n");
+        return 1;
+    }
+
+    /* Fork before any client thread exists. The consumer gets a little
+     * longer than the run so it sees the last frames land. */
+    fflush(stdout);
+    pid_t consumer = fork();
+    if (consumer == 0) {
+        _exit(consumer_run(server.remote->path, options.seconds + 0.5, options.clients > 0));
+    }
+
+    struct bench_client_config config = {
+        .display = server.socket,
+        .windows = options.windows,
+        .width = options.width,
+        .height = options.height,
+        .commit_hz = options.commit_hz,
+        .damage_percent = options.damage_percent,
+    };
+    struct bench_client *clients = calloc(options.clients > 0 ? options.clients : 1,
+        sizeof(*clients));
+    for (int i = 0; i < options.clients; i++) {
+        if (!bench_client_start(&clients[i], i, &config)) {
+            fprintf(stderr, "Unable to start client %d\n", i);
+            for (int j = 0; j < i; j++) {
+                bench_client_stop(&clients[j]);
+            }
+            free(clients);
+            kill(consumer, SIGTERM);
+            waitpid(consumer, NULL, 0);
+            server_finish(&server);
+            return 1;
+        }
+    }
+
+    bench_dispatch_until(&server, stats_now_ns() + (uint64_t)(options.seconds * 1e9));
+    for (int i = 0; i < options.clients; i++) {
+        bench_client_stop(&clients[i]);
+    }
+    free(clients);
+
+    int status = 1;
+    while (waitpid(consumer, &status, WNOHANG) == 0) {
+        bench_dispatch(&server, 10);
+    }
+    server_finish(&server);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
@@ -0,0 +1,28 @@
+#ifndef PLANAR_BUDGET_H
+#define PLANAR_BUDGET_H
+
+#include <stdint.h>
+
+struct planar_server;
+struct planar_toplevel;
+
+/* Texture memory accounting. Each toplevel's committed buffers (its own
+ * and its subsurfaces') are sized at 4 bytes per pixel, and those the
+ * renderer has imported are counted again as textures. Totals roll up to
+ * the client and the server. Over the limit, the biggest toplevels not
+ * shown on any output are suspended so their clients can drop buffers;
+ * they resume as soon as they are shown again. */
+struct planar_budget {
+    /* Bytes of textures allowed, 0 for no limit. */
+    uint64_t limit;
+    uint64_t buffer_bytes;
+    uint64_t texture_bytes;
+    uint32_t suspended;
+};
+
+void budget_toplevel_commit(struct planar_toplevel *toplevel);
+void budget_toplevel_destroy(struct planar_toplevel *toplevel);
+/* Called once per output frame, after the scene has been updated. */
+void budget_frame(struct planar_server *server);
+
+#endif // PLANAR_BUDGET_H
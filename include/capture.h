@@ -0,0 +1,30 @@
+#ifndef PLANAR_CAPTURE_H
+#define PLANAR_CAPTURE_H
+
+#include <wayland-server-core.h>
+
+struct planar_server;
+struct planar_toplevel;
+
+/* Screen capture through ext-image-copy-capture. Output sources are
+ * served by wlroots from the output commits; toplevel sources render the
+ * toplevel's scene subtree on its own, so windows panned off-screen can
+ * still be captured. Either way frames report damage and can target
+ * dmabufs, so recorders only copy what changed and never through the
+ * CPU. Toplevels are advertised through ext-foreign-toplevel-list. */
+struct planar_capture {
+    struct wlr_ext_foreign_toplevel_list_v1 *foreign_toplevel_list;
+    struct wlr_ext_foreign_toplevel_image_capture_source_manager_v1 *toplevel_sources;
+    struct wl_listener new_toplevel_request;
+};
+
+void capture_init(struct planar_server *server);
+void capture_finish(struct planar_server *server);
+
+/* Toplevel lifecycle hooks, a toplevel is listed while mapped. */
+void capture_toplevel_map(struct planar_toplevel *toplevel);
+void capture_toplevel_unmap(struct planar_toplevel *toplevel);
+void capture_toplevel_update(struct planar_toplevel *toplevel);
+void capture_toplevel_destroy(struct planar_toplevel *toplevel);
+
+#endif // PLANAR_CAPTURE_H
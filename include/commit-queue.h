@@ -0,0 +1,56 @@
+#ifndef PLANAR_COMMIT_QUEUE_H
+#define PLANAR_COMMIT_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/util/addon.h>
+
+struct planar_server;
+struct wlr_output;
+struct wlr_surface;
+
+/* A commit held back by wp_fifo_v1 or wp_commit_timing_v1. seq is the
+ * surface lock keeping it cached, 0 for commits that only queue up
+ * behind a locked one. */
+struct planar_commit_entry {
+    struct wl_list link;
+    uint32_t seq;
+    bool wait_barrier;
+    bool set_barrier;
+    uint64_t target_ns;
+};
+
+/* Per-surface state shared by a surface's fifo and commit timer. Commits
+ * that have to wait are locked in wlroots' cached state, in order, and
+ * released from the output frame handler once their barrier is cleared
+ * and their target time falls within the next frame. */
+struct planar_commit_queue {
+    struct wl_list link;
+    struct planar_server *server;
+    struct wlr_surface *surface;
+    struct wlr_addon addon;
+    struct wl_listener client_commit;
+
+    struct wl_resource *fifo;
+    struct wl_resource *timer;
+
+    /* Set by an applied commit, cleared once an output latches it. */
+    bool barrier;
+    struct planar_commit_entry pending;
+    struct wl_list entries;
+};
+
+struct planar_commit_queues {
+    struct wl_global *fifo_manager;
+    struct wl_global *timing_manager;
+    struct wl_list queues;
+};
+
+void commit_queue_init(struct planar_server *server);
+/* Called by output_frame after the scene is committed. frame_start_ns is
+ * when the frame began, on CLOCK_MONOTONIC. */
+void commit_queue_frame(struct planar_server *server, struct wlr_output *output,
+        uint64_t frame_start_ns);
+
+#endif // PLANAR_COMMIT_QUEUE_H
@@ -6,12 +6,28 @@
 #include <wlr/types/wlr_cursor.h>
 #include <wlr/types/wlr_xcursor_manager.h>
 
+struct planar_toplevel;
+struct planar_layer_surface;
+
 void cursor_init(struct planar_server *server);
 void cursor_destroy(struct planar_server *server);
 
+/* Preloads the cursor theme for outputs of this scale. */
+void cursor_load_theme(struct planar_server *server, float scale);
+/* Shows the named xcursor. name must outlive the cursor image, it is kept
+ * to tell whether the next request changes anything. */
+void cursor_set_image(struct planar_server *server, const char *name);
+
 void process_cursor_motion(struct planar_server *server, double cx, double cy, uint32_t time);
 void process_cursor_move(struct planar_server *server, uint32_t time);
 void process_cursor_resize(struct planar_server *server, uint32_t time);
+/* The surface under a point in layout coordinates, layer surfaces first and
+ * then toplevels on the canvas, with surface-local coordinates in sx, sy.
+ * The owning toplevel or layer surface is returned through the optional
+ * out parameters. Shared by every seat device that needs a hit-test. */
+struct wlr_surface *input_surface_at(struct planar_server *server, double lx, double ly,
+        double *sx, double *sy, struct planar_toplevel **toplevel,
+        struct planar_layer_surface **layer_surface);
 
 static void server_cursor_motion(struct wl_listener *listener, void *data);
 static void server_cursor_motion_absolute(struct wl_listener *listener, void *data);
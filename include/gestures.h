@@ -0,0 +1,42 @@
+#ifndef PLANAR_GESTURES_H
+#define PLANAR_GESTURES_H
+
+#include <stdbool.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_pointer_gestures_v1.h>
+
+/* Swipes with this many fingers pan the canvas. */
+#define PLANAR_GESTURE_PAN_FINGERS 3
+
+struct planar_server;
+
+/* Touchpad gestures. Swipes with PLANAR_GESTURE_PAN_FINGERS fingers pan
+ * and pinches over the bare canvas zoom; everything else is forwarded to
+ * the client under the pointer. Compositor gestures only accumulate here
+ * and are applied once per frame by gestures_frame. */
+struct planar_gestures {
+    struct wlr_pointer_gestures_v1 *pointer_gestures;
+
+    struct wl_listener swipe_begin;
+    struct wl_listener swipe_update;
+    struct wl_listener swipe_end;
+    struct wl_listener pinch_begin;
+    struct wl_listener pinch_update;
+    struct wl_listener pinch_end;
+    struct wl_listener hold_begin;
+    struct wl_listener hold_end;
+
+    bool panning;
+    bool zooming;
+    double pending_dx, pending_dy;
+    /* Pinch scale relative to the start of the gesture, requested and
+     * already applied to the outputs. */
+    double pending_scale, applied_scale;
+};
+
+void gestures_init(struct planar_server *server);
+void gestures_finish(struct planar_server *server);
+/* Applies the gesture state accumulated since the last frame. */
+void gestures_frame(struct planar_server *server);
+
+#endif // PLANAR_GESTURES_H
@@ -2,19 +2,33 @@
 #define PLANAR_INPUT_H
 
 #include "server.h"
+#include <xkbcommon/xkbcommon.h>
 
 struct planar_keyboard {
     struct wl_list link;
     struct planar_server *server;
     struct wlr_keyboard *wlr_keyboard;
+    /* Grouped keyboards deliver their events through the keyboard group, so
+     * only their destroy listener is connected. */
+    bool grouped;
 
     struct wl_listener modifiers;
     struct wl_listener key;
     struct wl_listener destroy;
 };
 
-int keyboard_repeat_func(void *data);
+/* A compiled keymap, shared by every keyboard using the same RMLVO names.
+ * Compiling one takes tens of milliseconds, so each is built only once. */
+struct planar_keymap {
+    struct wl_list link;
+    char *rules, *model, *layout, *variant, *options;
+    struct xkb_keymap *keymap;
+};
 
+void input_init(struct planar_server *server);
+void input_finish(struct planar_server *server);
+struct xkb_keymap *keymap_get(struct planar_server *server,
+        const struct xkb_rule_names *names);
 
 static void keyboard_handle_modifiers(struct wl_listener *listener, void *data);
 static void keyboard_handle_key(struct wl_listener *listener, void *data);
@@ -0,0 +1,53 @@
+#ifndef PLANAR_IPC_H
+#define PLANAR_IPC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/un.h>
+#include <wayland-server-core.h>
+
+#define PLANAR_IPC_MAX_PENDING (1 << 20)
+
+struct planar_server;
+
+/* A growable string buffer used to assemble JSON replies. */
+struct planar_ipc_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+struct planar_ipc_client {
+    struct wl_list link;
+    struct planar_server *server;
+    int fd;
+    struct wl_event_source *source;
+    bool subscribed;
+
+    char read_buf[256];
+    size_t read_len;
+    struct planar_ipc_buf write_buf;
+};
+
+/* Statistics socket, separate from the Wayland socket. Clients send
+ * newline-terminated commands ("stats", "subscribe", "unsubscribe",
+ * "trace") and receive one JSON object per line. */
+struct planar_ipc {
+    int fd;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    struct wl_event_source *source;
+    struct wl_list clients;
+};
+
+bool ipc_init(struct planar_server *server);
+void ipc_finish(struct planar_server *server);
+void ipc_broadcast_stats(struct planar_server *server);
+
+void ipc_buf_append(struct planar_ipc_buf *buf, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void ipc_buf_append_string(struct planar_ipc_buf *buf, const char *str);
+void ipc_buf_finish(struct planar_ipc_buf *buf);
+
+void ipc_stats_json(struct planar_server *server, struct planar_ipc_buf *buf);
+
+#endif // PLANAR_IPC_H
@@ -0,0 +1,72 @@
+#ifndef PLANAR_KEYBINDINGS_H
+#define PLANAR_KEYBINDINGS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <xkbcommon/xkbcommon.h>
+
+#define PLANAR_KEYBINDINGS_MAX_HELD 8
+
+struct planar_server;
+
+enum planar_action_type {
+    PLANAR_ACTION_QUIT,
+    PLANAR_ACTION_PAN,
+    PLANAR_ACTION_FOCUS_NEXT,
+    PLANAR_ACTION_FOCUS_PREV,
+    PLANAR_ACTION_ZOOM,
+    PLANAR_ACTION_ZOOM_RESET,
+    PLANAR_ACTION_JUMP,
+    PLANAR_ACTION_JUMP_FOCUSED,
+};
+
+struct planar_action {
+    enum planar_action_type type;
+    /* pan: delta, jump: canvas position, zoom: scale factor in x */
+    double x, y;
+};
+
+struct planar_keybinding {
+    uint32_t modifiers;
+    xkb_keysym_t sym;
+    /* Fire when the key is released rather than pressed. */
+    bool release;
+    /* Keep firing at the repeat rate while the key is held. */
+    bool repeat;
+    struct planar_action action;
+};
+
+/* Bindings live in an array; lookups go through an open-addressed hash
+ * table of indices keyed by (modifiers, keysym, release), rebuilt whenever
+ * the bindings change so the key path never walks the list. */
+struct planar_keybindings {
+    struct planar_keybinding *bindings;
+    size_t n_bindings;
+
+    int32_t *table;
+    size_t table_mask;
+
+    const struct planar_keybinding *held[PLANAR_KEYBINDINGS_MAX_HELD];
+    size_t n_held;
+    struct wl_event_source *repeat_source;
+};
+
+void keybindings_init(struct planar_server *server);
+void keybindings_finish(struct planar_server *server);
+/* Replaces the defaults with the bindings in path. A NULL path means
+ * $XDG_CONFIG_HOME/planar/keybindings, which may be missing. One binding
+ * per line, # starts a comment:
+ *
+ *     bind [--release] [--repeat] Mod+Mod+Keysym action [args]
+ *
+ * Actions: quit, pan DX DY, focus next|prev, zoom in|out|reset,
+ * jump X Y, jump focused. */
+bool keybindings_load(struct planar_server *server, const char *path);
+
+/* Returns true if the key was consumed by a binding. */
+bool keybindings_handle_key(struct planar_server *server, uint32_t modifiers,
+        const xkb_keysym_t *syms, int nsyms, bool pressed);
+
+#endif // PLANAR_KEYBINDINGS_H
@@ -11,6 +11,7 @@ struct planar_layer_surface {
     struct planar_surface_tree_node *surface_tree;
 
     struct planar_output *output;
+    struct planar_client_stats *client_stats;
 
     struct wl_listener surface_map;
     struct wl_listener surface_unmap;
@@ -3,22 +3,48 @@
 
 #include "server.h"
 
+struct planar_render;
+
 struct planar_output {
     struct wl_list link;
     struct planar_server *server;
     struct wlr_output *wlr_output;
     struct wl_listener frame;
+    struct wl_listener present;
     struct wl_listener request_state;
     struct wl_listener destroy;
 
     struct wl_list layer_views;
 
     struct wlr_box usable_area;
+
+    /* NULL when rendering inline on the main loop. */
+    struct planar_render *render;
+
+    /* Time spent in output_frame, which with a render thread leaves out
+     * drawing; that is in render_stats. */
+    struct planar_frame_stats stats;
+    struct planar_frame_stats render_stats;
+    struct planar_latency_stats latency;
 };
 
 void output_frame(struct wl_listener *listener, void *data);
+/* The rest of a frame once the output is committed: frame callbacks and
+ * queued commits. rendered is whether a new frame was shown. */
+void output_frame_committed(struct planar_output *output, uint64_t frame_start_ns,
+        bool rendered);
+void output_present(struct wl_listener *listener, void *data);
 void output_request_state(struct wl_listener *listener, void *data);
 void output_destroy(struct wl_listener *listener, void *data);
 void output_create(struct wl_listener *listener, void *data);
 
+/* Requests a frame on every output. Requests made before the next frame
+ * are coalesced by wlroots, so this is cheap to call per input event. */
+void output_schedule_frames(struct planar_server *server);
+/* Animates the global offset to x, y over the next few frames. */
+void output_pan_to(struct planar_server *server, double x, double y);
+/* Multiplies every output's scale by factor, within the zoom limits. */
+void output_zoom(struct planar_server *server, double factor);
+void output_zoom_reset(struct planar_server *server);
+
 #endif // PLANAR_OUTPUT_H
\ No newline at end of file
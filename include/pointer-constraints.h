@@ -0,0 +1,30 @@
+#ifndef PLANAR_POINTER_CONSTRAINTS_H
+#define PLANAR_POINTER_CONSTRAINTS_H
+
+#include <stdbool.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_pointer.h>
+#include <wlr/types/wlr_pointer_constraints_v1.h>
+#include <wlr/types/wlr_relative_pointer_v1.h>
+
+struct planar_server;
+
+struct planar_pointer_constraint {
+    struct planar_server *server;
+    struct wlr_pointer_constraint_v1 *constraint;
+    struct wl_listener set_region;
+    struct wl_listener destroy;
+};
+
+void pointer_constraints_init(struct planar_server *server);
+void pointer_constraints_finish(struct planar_server *server);
+/* Activates the constraint of the surface holding both pointer and keyboard
+ * focus, if any, and deactivates whichever was active before. */
+void pointer_constraints_update(struct planar_server *server);
+/* Sends relative motion and applies the active constraint. Returns true if
+ * the motion was fully handled, in which case the usual cursor motion and
+ * hit-testing must be skipped. */
+bool pointer_constraints_motion(struct planar_server *server,
+        struct wlr_pointer_motion_event *event);
+
+#endif // PLANAR_POINTER_CONSTRAINTS_H
@@ -7,7 +7,9 @@
 struct planar_server;
 
 struct planar_popup {
+    struct planar_server *server;
     struct wlr_xdg_popup *xdg_popup;
+    struct planar_client_stats *client_stats;
     struct wl_listener commit;
     struct wl_listener destroy;
 };
@@ -0,0 +1,82 @@
+#ifndef PLANAR_REMOTE_H
+#define PLANAR_REMOTE_H
+
+#include <pixman.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+#define PLANAR_REMOTE_MAGIC 0x524e4c50 /* "PLNR" */
+#define PLANAR_REMOTE_VERSION 1
+#define PLANAR_REMOTE_SLOTS 4
+#define PLANAR_REMOTE_MAX_RECTS 64
+
+struct planar_server;
+struct wlr_output;
+
+/* Shared memory layout of the remote desktop ring, read by an encoder in
+ * another process. The file holds this header followed by one full
+ * XRGB8888 frame per slot, at each slot's offset.
+ *
+ * Frame n lives in slots[n % PLANAR_REMOTE_SLOTS] and its rects are the
+ * damage since frame n - 1, in buffer pixels. A reader that last saw
+ * frame m and finds head h copies the union of the rects of frames
+ * m + 1 .. h out of frame h's slot, or the whole frame if it fell more
+ * than a ring behind. A slot's seq is 0 while it's being rewritten, so
+ * readers check it before and after copying. When the compositor
+ * replaces the file, on resize, the old one is marked stale and readers
+ * reopen the path. */
+struct planar_remote_rect {
+    int32_t x, y, width, height;
+};
+
+struct planar_remote_slot {
+    _Atomic uint64_t seq;
+    uint64_t time_ns;
+    uint64_t offset;
+    uint32_t n_rects;
+    uint32_t reserved;
+    struct planar_remote_rect rects[PLANAR_REMOTE_MAX_RECTS];
+};
+
+struct planar_remote_ring {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t stale;
+    uint32_t format;
+    uint32_t width, height, stride;
+    uint32_t n_slots;
+    _Atomic uint64_t head;
+    struct planar_remote_slot slots[PLANAR_REMOTE_SLOTS];
+};
+
+/* Headless output whose frames are published to the ring. The ring is
+ * only written when a commit carries damage, and only the regions a slot
+ * is missing are copied into it. */
+struct planar_remote {
+    struct planar_server *server;
+    struct wlr_output *output;
+    struct wl_listener output_commit;
+    struct wl_listener output_destroy;
+    int width, height;
+
+    char path[256];
+    int fd;
+    struct planar_remote_ring *ring;
+    size_t size;
+    uint64_t seq;
+
+    /* Damage not yet published, and per slot the regions that are behind
+     * the newest frame. */
+    pixman_region32_t pending;
+    pixman_region32_t stale[PLANAR_REMOTE_SLOTS];
+};
+
+/* Adds a headless output of the given size once the backend is started
+ * and publishes its frames at $XDG_RUNTIME_DIR/planar-remote.<pid>. Fails
+ * if XDG_RUNTIME_DIR is not set. */
+bool remote_init(struct planar_server *server, int width, int height);
+void remote_finish(struct planar_server *server);
+
+#endif // PLANAR_REMOTE_H
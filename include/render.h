@@ -0,0 +1,91 @@
+#ifndef PLANAR_RENDER_H
+#define PLANAR_RENDER_H
+
+#include <pixman.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/util/box.h>
+
+struct planar_output;
+struct planar_upload_image;
+struct wlr_buffer;
+struct wlr_scene_output;
+struct wlr_surface;
+
+/* One node of a scene snapshot, in output buffer pixels. Buffers and
+ * upload images are held for as long as the snapshot lives; a locked
+ * buffer also keeps wlroots from updating a client buffer in place
+ * underneath the render thread. */
+struct planar_render_item {
+    struct wlr_box dst;
+    float opacity;
+    /* NULL for a solid rect of color. */
+    void *data;
+    int width, height;
+    uint32_t format;
+    size_t stride;
+    struct wlr_fbox src;
+    float color[4];
+    /* What holds data: an uploaded copy of the surface, or the buffer
+     * itself. */
+    struct planar_upload_image *image;
+    struct wlr_buffer *buffer;
+};
+
+/* A surface whose primary output is the one the frame in flight is for. It
+ * gets presentation feedback once the frame is committed, which the scene
+ * would otherwise do while rendering. */
+struct planar_render_surface {
+    struct wl_list link;
+    struct wlr_surface *surface;
+    struct wl_listener destroy;
+};
+
+/* Per-output render thread. At frame time the main loop snapshots what the
+ * scene shows on the output and acquires a swapchain buffer, the thread
+ * composites the snapshot into it with pixman, and the main loop commits
+ * it once woken through the eventfd. Meanwhile clients and input keep
+ * being dispatched. Only one frame is in flight; frames requested while
+ * it's drawn are coalesced into one more when it lands. */
+struct planar_render {
+    struct planar_output *output;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int event_fd;
+    struct wl_event_source *event_source;
+
+    /* Owned by the main loop unless busy. */
+    struct planar_render_item *items;
+    size_t n_items, cap_items;
+    struct wl_list surfaces; // planar_render_surface.link
+    struct wlr_buffer *target;
+    void *target_data;
+    uint32_t target_format;
+    size_t target_stride;
+    pixman_region32_t damage;
+    uint64_t frame_start_ns;
+    bool busy;
+    bool again;
+
+    /* Under lock. */
+    bool queued;
+    bool done;
+    bool stop;
+    uint64_t render_ns;
+};
+
+/* Returns NULL if the renderer can't be used off the main thread, in which
+ * case the output keeps rendering inline. */
+struct planar_render *render_create(struct planar_output *output);
+/* Waits for a frame in flight and drops it. */
+void render_destroy(struct planar_render *render);
+/* Hands the frame to the render thread. Returns false if this frame has to
+ * be rendered inline instead, e.g. for buffers that aren't in memory. */
+bool render_frame(struct planar_render *render, struct wlr_scene_output *scene_output,
+        uint64_t frame_start_ns);
+
+#endif // PLANAR_RENDER_H
@@ -0,0 +1,76 @@
+#ifndef PLANAR_REPLAY_H
+#define PLANAR_REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <wayland-server-core.h>
+
+#define PLANAR_RECORDING_MAGIC "PLNRREC"
+#define PLANAR_RECORDING_VERSION 1
+
+struct planar_server;
+struct planar_virtual_input;
+struct wlr_output;
+
+enum planar_record_type {
+    PLANAR_RECORD_MOTION = 1,
+    PLANAR_RECORD_MOTION_ABSOLUTE,
+    PLANAR_RECORD_BUTTON,
+    PLANAR_RECORD_AXIS,
+    PLANAR_RECORD_FRAME,
+    PLANAR_RECORD_KEY,
+};
+
+/* On-disk layout, little endian. The header is followed by fixed-size
+ * records until end of file. */
+struct planar_recording_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    int32_t layout_width, layout_height;
+};
+
+struct planar_record {
+    uint8_t type;
+    uint8_t state;
+    uint8_t aux;
+    uint8_t reserved;
+    uint32_t time_msec;
+    uint64_t time_ns;
+    uint32_t code;
+    int32_t discrete;
+    double x, y;
+};
+
+struct planar_recorder {
+    FILE *file;
+    uint64_t start_ns;
+    uint64_t records;
+};
+
+struct planar_replay {
+    struct planar_server *server;
+    struct planar_virtual_input *input;
+    struct wlr_output *output;
+    struct wl_listener output_frame;
+
+    struct planar_record *records;
+    size_t n_records, next;
+    int32_t layout_width, layout_height;
+    double speed;
+
+    struct wl_event_source *timer;
+    uint64_t start_ns;
+    uint64_t *frame_ns;
+    size_t n_frames, frames_cap;
+};
+
+bool recorder_init(struct planar_server *server, const char *path);
+void recorder_finish(struct planar_server *server);
+void recorder_record(struct planar_server *server, const struct planar_record *record);
+
+bool replay_init(struct planar_server *server, const char *path, double speed);
+void replay_finish(struct planar_server *server);
+
+#endif // PLANAR_REPLAY_H
@@ -6,5 +6,7 @@
 
 void seat_init(struct planar_server *server);
 void seat_finish(struct planar_server *server);
+/* Advertises the device classes currently plugged in. */
+void seat_update_capabilities(struct planar_server *server);
 
 #endif // PLANAR_SEAT_H
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_input_device.h>
 #include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_keyboard_group.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_pointer.h>
@@ -18,6 +19,21 @@
 #include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/types/wlr_xdg_shell.h>
 
+#include "budget.h"
+#include "capture.h"
+#include "commit-queue.h"
+#include "ipc.h"
+#include "gestures.h"
+#include "keybindings.h"
+#include "pointer-constraints.h"
+#include "remote.h"
+#include "replay.h"
+#include "stats.h"
+#include "tablet.h"
+#include "touch.h"
+#include "trace.h"
+#include "upload.h"
+
 
 enum planar_cursor_mode {
     PLANAR_CURSOR_PASSTHROUGH,
@@ -31,6 +47,10 @@ struct planar_server {
 	struct wlr_backend *backend;
 	struct wlr_renderer *renderer;
 	struct wlr_allocator *allocator;
+	struct wlr_compositor *compositor;
+	struct wlr_viewporter *viewporter;
+	struct wlr_fractional_scale_manager_v1 *fractional_scale_manager;
+	struct wlr_linux_dmabuf_v1 *linux_dmabuf;
 	struct wlr_scene *scene;
 	struct wlr_scene_output_layout *scene_layout;
 
@@ -39,8 +59,16 @@ struct planar_server {
 	struct wl_listener new_xdg_toplevel;
 	struct wl_listener new_xdg_popup;
 	struct wl_list toplevels;
+	/* Mapped toplevels, most recently focused first. While Alt+F1 cycles
+	 * the stack stays put and focus_cycle is the current target. */
+	struct wl_list focus_stack;
+	struct planar_toplevel *focus_cycle;
 
 	struct wlr_scene_tree *layers[4];
+	/* Toplevels, between the bottom and top layers. The tree sits at the
+	 * global offset so toplevel nodes keep their canvas coordinates and the
+	 * scene knows which outputs each surface is really on. */
+	struct wlr_scene_tree *canvas;
     struct wl_listener new_layer_shell_surface;
 
 	struct wlr_cursor *cursor;
@@ -50,21 +78,31 @@ struct planar_server {
 	struct wl_listener cursor_button;
 	struct wl_listener cursor_axis;
 	struct wl_listener cursor_frame;
+	/* The xcursor currently shown, NULL while a client surface is. */
+	const char *cursor_image;
+	struct wlr_cursor_shape_manager_v1 *cursor_shape_manager;
+
+	struct wlr_relative_pointer_manager_v1 *relative_pointer_manager;
+	struct wlr_pointer_constraints_v1 *pointer_constraints;
+	struct wl_listener new_pointer_constraint;
+	struct wlr_pointer_constraint_v1 *active_constraint;
+	struct planar_gestures gestures;
+	struct planar_touch touch;
+	struct planar_tablets tablets;
 	const char* socket;
 
-	struct {
-        bool left_pressed;
-        bool right_pressed;
-        bool up_pressed;
-        bool down_pressed;
-    } key_state;
-    struct wl_event_source *keyboard_repeat_source;
+	struct planar_keybindings keybindings;
 
 	struct wlr_seat *seat;
 	struct wl_listener new_input;
 	struct wl_listener request_cursor;
+	struct wl_listener request_set_cursor_shape;
 	struct wl_listener request_set_selection;
 	struct wl_list keyboards;
+	struct xkb_context *xkb_context;
+	struct wl_list keymaps;
+	struct wlr_keyboard_group *keyboard_group;
+	struct planar_keyboard *group_keyboard;
 	enum planar_cursor_mode cursor_mode;
 	struct planar_toplevel *grabbed_toplevel;
 	double grab_x, grab_y;
@@ -76,9 +114,33 @@ struct planar_server {
         double y;
     } global_offset;
 
+    /* Animated viewport move, stepped at the start of every output frame.
+     * Only the progress since the last step is added to the offset, so
+     * panning by hand during the animation still works. */
+    struct {
+        bool active;
+        double dx, dy;
+        double progress;
+        uint64_t start_ns;
+    } pan_animation;
+
 	struct wlr_output_layout *output_layout;
 	struct wl_list outputs;
 	struct wl_listener new_output;
+
+	struct planar_capture capture;
+	struct planar_budget budget;
+	struct planar_commit_queues commit_queues;
+	struct planar_stats stats;
+	struct planar_ipc ipc;
+	struct wl_event_source *trace_signal;
+	struct planar_recorder *recorder;
+	struct planar_replay *replay;
+	struct planar_remote *remote;
+	struct planar_upload_pool *uploads;
+	/* Draw each output on its own thread, see render.c. Read when outputs
+	 * are created. */
+	bool render_threads;
 };
 
 void convert_scene_coords_to_global(struct planar_server *server, double *x, double *y);
@@ -86,6 +148,9 @@ void convert_global_coords_to_scene(struct planar_server *server, double *x, dou
 
 void server_init(struct planar_server *server);
 void server_run(struct planar_server *server);
+/* The headless backend, whether on its own or inside the multi backend.
+ * NULL if there is none. */
+struct wlr_backend *server_headless_backend(struct planar_server *server);
 void server_finish(struct planar_server *server);
 
 #endif // PLANAR_SERVER_H
\ No newline at end of file
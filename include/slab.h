@@ -0,0 +1,38 @@
+#ifndef PLANAR_SLAB_H
+#define PLANAR_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PLANAR_SLAB_PAGE_SIZE 16384
+
+struct planar_slab_page;
+
+/* Fixed-size object pool. Objects are carved out of pages and recycled
+ * through a free list, so allocating and freeing are a few pointer moves
+ * and popup storms don't churn the heap. Pages are only returned when the
+ * slab is finished. Built with PLANAR_SLAB_DEBUG, freed objects are
+ * poisoned and checked again when reused, which catches writes after
+ * free and most double frees. */
+struct planar_slab {
+    const char *name;
+    size_t object_size;
+    size_t per_page;
+    void *free_list;
+    struct planar_slab_page *pages;
+    size_t n_pages;
+
+    uint32_t live;
+    uint32_t peak;
+    uint64_t allocs;
+};
+
+void slab_init(struct planar_slab *slab, const char *name, size_t object_size);
+/* Logs objects still live, they leaked. */
+void slab_finish(struct planar_slab *slab);
+
+/* Returns a zeroed object, or NULL when out of memory. */
+void *slab_alloc(struct planar_slab *slab);
+void slab_free(struct planar_slab *slab, void *object);
+
+#endif // PLANAR_SLAB_H
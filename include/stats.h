@@ -0,0 +1,160 @@
+#ifndef PLANAR_STATS_H
+#define PLANAR_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <wayland-server-core.h>
+
+#include "slab.h"
+
+#define PLANAR_FRAME_HISTORY 128
+#define PLANAR_STATS_INTERVAL_MS 1000
+#define PLANAR_LATENCY_HISTORY 128
+/* An input that no frame on an output reflected within this long had no
+ * visible effect there and is not counted. */
+#define PLANAR_LATENCY_TIMEOUT_NS 500000000ull
+
+struct planar_server;
+struct planar_output;
+struct planar_stats;
+struct wlr_output;
+struct wlr_output_event_present;
+struct wlr_surface;
+
+/* Per-output frame counters, updated from the output frame and present
+ * handlers. Durations are the CPU time spent inside output_frame. */
+struct planar_frame_stats {
+    uint64_t frames;
+    uint64_t presented;
+    uint64_t dropped;
+
+    uint64_t last_duration_ns;
+    uint64_t max_duration_ns;
+    uint64_t total_duration_ns;
+
+    uint64_t durations_ns[PLANAR_FRAME_HISTORY];
+    size_t history_head;
+    size_t history_len;
+};
+
+enum planar_latency_stage {
+    /* Device timestamp to the compositor's input handler. */
+    PLANAR_LATENCY_DISPATCH,
+    /* Input handler to the commit of the first frame rendered after it. */
+    PLANAR_LATENCY_RENDER,
+    /* Frame commit to presentation on the display. */
+    PLANAR_LATENCY_DISPLAY,
+    PLANAR_LATENCY_TOTAL,
+    PLANAR_LATENCY_STAGES,
+};
+
+/* Per-output input-to-present latency. Input handlers stamp the outputs
+ * they may change; the earliest stamp waiting on an output rides along
+ * with its next rendered frame and becomes a sample once that frame is
+ * presented. */
+struct planar_latency_stats {
+    uint64_t pending_event_ns;
+    uint64_t pending_dispatch_ns;
+
+    bool in_flight;
+    uint32_t in_flight_seq;
+    uint64_t in_flight_event_ns;
+    uint64_t in_flight_dispatch_ns;
+    uint64_t in_flight_commit_ns;
+
+    uint64_t samples;
+    uint64_t expired;
+
+    uint64_t history_ns[PLANAR_LATENCY_STAGES][PLANAR_LATENCY_HISTORY];
+    size_t history_head;
+    size_t history_len;
+};
+
+/* Per-client accounting, created lazily the first time a client's surface
+ * commits and freed when the client disconnects. Uploads are counted as
+ * damaged buffer pixels at 4 bytes each. */
+struct planar_client_stats {
+    struct wl_list link;
+    struct planar_stats *stats;
+    struct wl_client *client;
+    struct wl_listener destroy;
+    pid_t pid;
+
+    uint64_t commits;
+    uint64_t commits_sampled;
+    double commit_rate;
+
+    uint64_t bytes_uploaded;
+    uint64_t bytes_sampled;
+    double upload_rate;
+
+    /* Sums over the client's toplevels, see budget.h. */
+    uint64_t buffer_bytes;
+    uint64_t texture_bytes;
+
+    /* Token bucket against the commit budget. A client that runs it dry
+     * is throttled: its frame callbacks are paced to the budget until it
+     * slows down. */
+    double tokens;
+    uint64_t tokens_ns;
+    bool throttled;
+    uint64_t last_frame_done_ns;
+    uint64_t frames_deferred;
+};
+
+/* Compositor objects come out of per-type slabs, whose live, peak and
+ * allocation counts double as the object counters. */
+struct planar_object_stats {
+    struct planar_slab toplevels;
+    struct planar_slab popups;
+    struct planar_slab layer_surfaces;
+    struct planar_slab keyboards;
+    struct planar_slab outputs;
+};
+
+struct planar_stats {
+    struct planar_object_stats objects;
+    struct wl_list clients;
+    /* Commits per second allowed per client, 0 for no limit. */
+    uint32_t commit_budget;
+    uint32_t throttled_clients;
+    struct wl_event_source *sample_timer;
+    struct timespec last_sample;
+};
+
+void stats_init(struct planar_server *server);
+void stats_finish(struct planar_server *server);
+/* The object slabs outlive everything else, they are set up first thing
+ * in server_init and torn down last in server_finish. */
+void stats_objects_init(struct planar_server *server);
+void stats_objects_finish(struct planar_server *server);
+
+struct planar_client_stats *stats_client_get(struct planar_server *server,
+        struct wl_client *client);
+void stats_client_commit(struct planar_client_stats *client, struct wlr_surface *surface);
+/* Whether a frame callback may be sent to surface now. All callbacks of
+ * one frame share now_ns, so a client's surfaces are paced together. */
+bool stats_client_frame_allowed(struct planar_server *server, struct wlr_surface *surface,
+        uint64_t now_ns);
+
+void stats_frame_record(struct planar_frame_stats *stats, uint64_t duration_ns);
+uint64_t stats_frame_percentile(const struct planar_frame_stats *stats, double p);
+
+/* Stamps an input event with the time it reached its handler. time_msec is
+ * the device timestamp, output the output its effect shows on or NULL if
+ * it may show on any of them (panning, focus changes, keys). */
+void stats_input_stamp(struct planar_server *server, struct wlr_output *output,
+        uint32_t time_msec);
+/* Called after an output committed a newly rendered frame. */
+void stats_latency_commit(struct planar_latency_stats *stats, uint32_t commit_seq);
+void stats_latency_present(struct planar_latency_stats *stats,
+        const struct wlr_output_event_present *event);
+uint64_t stats_latency_percentile(const struct planar_latency_stats *stats,
+        enum planar_latency_stage stage, double p);
+
+uint64_t stats_timespec_to_ns(const struct timespec *ts);
+uint64_t stats_now_ns(void);
+
+#endif // PLANAR_STATS_H
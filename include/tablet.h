@@ -0,0 +1,66 @@
+#ifndef PLANAR_TABLET_H
+#define PLANAR_TABLET_H
+
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_input_device.h>
+#include <wlr/types/wlr_tablet_v2.h>
+
+struct planar_server;
+
+struct planar_tablet_tool {
+    struct wl_list link;
+    struct planar_server *server;
+    struct wlr_tablet_v2_tablet_tool *tool_v2;
+    /* The tablet the tool was last used on. */
+    struct wlr_tablet_v2_tablet *tablet_v2;
+
+    /* Axes reported since the last flush, WLR_TABLET_TOOL_AXIS_* bits,
+     * and their latest values. The position is in layout coordinates. */
+    uint32_t pending;
+    double lx, ly;
+    double pressure, distance, tilt_x, tilt_y, rotation, slider;
+    double wheel_delta;
+    uint32_t time_msec;
+
+    struct wl_listener destroy;
+};
+
+struct planar_tablet_pad {
+    struct wl_list link;
+    struct planar_server *server;
+    struct wlr_tablet_v2_tablet_pad *pad_v2;
+    /* The surface the pad was entered on, if any. */
+    struct wlr_surface *focus;
+
+    struct wl_listener button;
+    struct wl_listener ring;
+    struct wl_listener strip;
+    struct wl_listener focus_destroy;
+    struct wl_listener destroy;
+};
+
+/* Drawing tablets through tablet-v2. Tools report at several hundred Hz,
+ * far above any refresh rate, so axis events only move the cursor and
+ * record the tool state; tablet_frame hit-tests once per tool and sends
+ * the coalesced motion and axes before the frame is drawn. Tip, button and
+ * proximity events flush first so clients see them in order. */
+struct planar_tablets {
+    struct wlr_tablet_manager_v2 *manager;
+    struct wl_list tools;
+    struct wl_list pads;
+
+    struct wl_listener axis;
+    struct wl_listener proximity;
+    struct wl_listener tip;
+    struct wl_listener button;
+};
+
+void tablet_init(struct planar_server *server);
+void tablet_finish(struct planar_server *server);
+void server_new_tablet(struct planar_server *server, struct wlr_input_device *device);
+void server_new_tablet_pad(struct planar_server *server, struct wlr_input_device *device);
+/* Sends the tool motion accumulated since the last frame. */
+void tablet_frame(struct planar_server *server);
+
+#endif // PLANAR_TABLET_H
@@ -4,12 +4,27 @@
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include "server.h"
+#include "transaction.h"
 
 struct planar_toplevel {
     struct wl_list link;
+    struct wl_list focus_link;
     struct planar_server *server;
     struct wlr_xdg_toplevel *xdg_toplevel;
     struct wlr_scene_tree *scene_tree;
+    struct planar_client_stats *client_stats;
+    /* The transaction move/resize waiting on this toplevel, if any. While
+     * one is outstanding new geometry only replaces the pending one, which
+     * is sent when the client catches up. */
+    struct planar_transaction_instruction *instruction;
+    bool resize_pending;
+    int pending_x, pending_y;
+    int pending_width, pending_height;
+
+    /* Texture memory accounting, see budget.h. */
+    uint64_t buffer_bytes;
+    uint64_t texture_bytes;
+    bool suspended;
 
     struct wl_listener map;
     struct wl_listener unmap;
@@ -19,11 +34,28 @@ struct planar_toplevel {
     struct wl_listener request_resize;
     struct wl_listener request_maximize;
     struct wl_listener request_fullscreen;
+    struct wl_listener set_title;
+    struct wl_listener set_app_id;
+
+    struct wlr_ext_foreign_toplevel_handle_v1 *foreign_handle;
+    struct wlr_ext_image_capture_source_v1 *capture_source;
+    struct wl_listener capture_source_destroy;
 };
 
 void server_new_xdg_toplevel(struct wl_listener *listener, void *data);
+/* Moves and resizes the toplevel in one transaction, with at most one
+ * configure in flight. x, y is the scene position of the node. */
+void toplevel_configure(struct planar_toplevel *toplevel, int x, int y,
+        int width, int height);
 void focus_toplevel(struct planar_toplevel *toplevel, struct wlr_surface *surface);
-static struct planar_toplevel *desktop_toplevel_at(struct planar_server *server, double lx, double ly,
+/* Focuses the next (or previous) toplevel in most recently used order and
+ * pans to it. Consecutive calls walk the stack without reordering it until
+ * focus_cycle_end, which moves the target to the front. */
+void focus_cycle(struct planar_server *server, bool next);
+void focus_cycle_end(struct planar_server *server);
+/* The global offset that centers toplevel in the output layout. */
+void toplevel_center_offset(struct planar_toplevel *toplevel, double *x, double *y);
+struct planar_toplevel *desktop_toplevel_at(struct planar_server *server, double lx, double ly,
                                             struct wlr_surface **surface, double *sx, double *sy);
 
 #endif // PLANAR_TOPLEVEL_H
\ No newline at end of file
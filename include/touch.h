@@ -0,0 +1,43 @@
+#ifndef PLANAR_TOUCH_H
+#define PLANAR_TOUCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_input_device.h>
+
+/* Simultaneous touch points tracked, further points are ignored. */
+#define PLANAR_TOUCH_POINTS 10
+
+struct planar_server;
+
+struct planar_touch_point {
+    int32_t id;
+    bool active;
+    /* Down on a surface: the surface origin in layout coordinates, so
+     * motion needs no hit-test. Down on the canvas: the last position,
+     * the point drags the canvas. */
+    bool canvas;
+    double x, y;
+};
+
+/* Touch screens. Touches on a surface go to its client through the seat,
+ * touches on the bare canvas pan it the same way a three finger swipe
+ * does, batched into the next frame by gestures_frame. */
+struct planar_touch {
+    struct wl_listener down;
+    struct wl_listener up;
+    struct wl_listener motion;
+    struct wl_listener cancel;
+    struct wl_listener frame;
+
+    struct planar_touch_point points[PLANAR_TOUCH_POINTS];
+    int n_canvas_points;
+    int n_devices;
+};
+
+void touch_init(struct planar_server *server);
+void touch_finish(struct planar_server *server);
+void server_new_touch(struct planar_server *server, struct wlr_input_device *device);
+
+#endif // PLANAR_TOUCH_H
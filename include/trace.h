@@ -0,0 +1,52 @@
+#ifndef PLANAR_TRACE_H
+#define PLANAR_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+/* Must be a power of two. */
+#define PLANAR_TRACE_EVENTS (1 << 16)
+
+struct planar_server;
+
+/* Tracing spans, compiled in with -DPLANAR_TRACE (make TRACE=1) and
+ * compiled out entirely otherwise. Finished spans land in a fixed-size,
+ * lock-free ring shared by every thread; the oldest events are overwritten.
+ *
+ *     TRACE_SCOPE("output_frame");          ends when the scope is left
+ *     TRACE_BEGIN(commit, "scene_commit");  explicit begin/end pair
+ *     TRACE_END(commit);
+ */
+struct planar_trace_span {
+    const char *name;
+    uint64_t start_ns;
+};
+
+void trace_span_end(struct planar_trace_span *span);
+
+#ifdef PLANAR_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+    struct planar_trace_span TRACE_CONCAT(trace_span_, __LINE__) \
+        __attribute__((cleanup(trace_span_end))) = { (name), stats_now_ns() }
+#define TRACE_BEGIN(var, name) \
+    struct planar_trace_span var = { (name), stats_now_ns() }
+#define TRACE_END(var) trace_span_end(&(var))
+#else
+#define TRACE_SCOPE(name) do { } while (0)
+#define TRACE_BEGIN(var, name) do { } while (0)
+#define TRACE_END(var) do { } while (0)
+#endif
+
+/* Dumps are triggered with SIGUSR1 or the "trace" IPC command and written
+ * as Chrome trace JSON, which Perfetto and chrome://tracing both load. */
+void trace_init(struct planar_server *server);
+void trace_finish(struct planar_server *server);
+bool trace_dump(const char *path);
+void trace_default_path(char *path, size_t size);
+
+#endif // PLANAR_TRACE_H
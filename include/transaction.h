@@ -0,0 +1,51 @@
+#ifndef PLANAR_TRANSACTION_H
+#define PLANAR_TRANSACTION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+/* Clients that take longer than this to catch up get moved regardless. */
+#define PLANAR_TRANSACTION_TIMEOUT_MS 200
+
+struct planar_server;
+struct planar_toplevel;
+
+struct planar_transaction_instruction {
+    struct wl_list link;
+    struct planar_transaction *transaction;
+    struct planar_toplevel *toplevel;
+    /* Scene position to apply. */
+    int x, y;
+    /* Configure the client has to ack and commit first, 0 once it has. */
+    uint32_t serial;
+};
+
+/* A set of toplevel moves and resizes that become visible together. Sizes
+ * are sent to the clients right away, positions are held back until every
+ * client has committed a buffer for its new size, so a frame never shows a
+ * window at its new position with its old size or the other way round.
+ * Each toplevel is in at most one transaction, adding it to a new one
+ * drops it from the old. */
+struct planar_transaction {
+    struct planar_server *server;
+    struct wl_list instructions;
+    size_t n_waiting;
+    bool committed;
+    struct wl_event_source *timer;
+};
+
+struct planar_transaction *transaction_create(struct planar_server *server);
+/* Stages moving toplevel to x, y in the scene with the given size. */
+void transaction_add(struct planar_transaction *transaction,
+        struct planar_toplevel *toplevel, int x, int y, int width, int height);
+/* Applies the transaction once all clients are ready, or at the timeout.
+ * The transaction frees itself when applied. */
+void transaction_commit(struct planar_transaction *transaction);
+
+/* Hooks for the toplevel commit and destroy handlers. */
+void transaction_toplevel_commit(struct planar_toplevel *toplevel);
+void transaction_toplevel_destroy(struct planar_toplevel *toplevel);
+
+#endif // PLANAR_TRANSACTION_H
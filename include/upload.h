@@ -0,0 +1,84 @@
+#ifndef PLANAR_UPLOAD_H
+#define PLANAR_UPLOAD_H
+
+#include <pixman.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/util/addon.h>
+
+#define PLANAR_UPLOAD_IMAGES 4
+
+struct planar_server;
+struct wlr_surface;
+
+/* Compositor-owned copy of a surface's shm buffer, drawn by render threads
+ * instead of client memory. An image isn't written while anyone but its
+ * surface holds a reference, so a surface cycles through a few of them;
+ * each one only catches up on what changed since it was last written. */
+struct planar_upload_image {
+    int refs;
+    void *data;
+    int width, height;
+    size_t stride;
+    uint32_t format;
+    /* Buffer regions that differ from the surface's latest commit. */
+    pixman_region32_t stale;
+};
+
+struct planar_upload_surface {
+    struct wl_list link;
+    struct planar_upload_pool *pool;
+    struct wlr_surface *surface;
+    struct wlr_addon addon;
+    struct wl_listener client_commit;
+    struct wl_listener commit;
+
+    struct planar_upload_image *images[PLANAR_UPLOAD_IMAGES];
+    /* The image matching the applied state, NULL if it wasn't uploaded. */
+    struct planar_upload_image *current;
+    /* Commits with a new buffer not applied yet, oldest first. */
+    struct wl_list uploads;
+};
+
+/* Copies large shm damage into upload images on worker threads. The commit
+ * is held in wlroots' cached state until its copy is done, the fence, so
+ * the applied state never points at a half-written image. Small damage is
+ * copied right away on the main loop. */
+struct planar_upload_pool {
+    struct planar_server *server;
+    struct wl_listener new_surface;
+    struct wl_list surfaces;
+    pthread_t *threads;
+    int n_threads;
+    int event_fd;
+    struct wl_event_source *event_source;
+    /* Uploads whose bands are queued or being copied. */
+    struct wl_list in_flight;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* Under lock. */
+    struct wl_list bands;
+    struct wl_list done;
+    bool stop;
+
+    uint64_t async_uploads;
+    uint64_t sync_uploads;
+    uint64_t skipped;
+    uint64_t bytes;
+};
+
+/* Starts n_threads workers and tracks every surface from then on. */
+bool upload_init(struct planar_server *server, int n_threads);
+void upload_finish(struct planar_server *server);
+
+/* The image for what the surface currently shows, NULL if there is none. */
+struct planar_upload_image *upload_surface_image(struct planar_server *server,
+        struct wlr_surface *surface);
+struct planar_upload_image *upload_image_ref(struct planar_upload_image *image);
+void upload_image_unref(struct planar_upload_image *image);
+
+#endif // PLANAR_UPLOAD_H
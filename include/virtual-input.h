@@ -0,0 +1,34 @@
+#ifndef PLANAR_VIRTUAL_INPUT_H
+#define PLANAR_VIRTUAL_INPUT_H
+
+#include <stdint.h>
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_pointer.h>
+
+struct planar_server;
+
+/* A pointer and keyboard owned by the compositor itself. Events emitted on
+ * these go through wlr_cursor and the keyboard listeners exactly like events
+ * from real devices, which lets headless runs drive the normal input path. */
+struct planar_virtual_input {
+    struct planar_server *server;
+    struct wlr_pointer pointer;
+    struct wlr_keyboard keyboard;
+};
+
+struct planar_virtual_input *virtual_input_create(struct planar_server *server);
+void virtual_input_destroy(struct planar_virtual_input *input);
+
+void virtual_input_motion(struct planar_virtual_input *input, uint32_t time_msec,
+        double dx, double dy);
+void virtual_input_motion_absolute(struct planar_virtual_input *input, uint32_t time_msec,
+        double x, double y);
+void virtual_input_button(struct planar_virtual_input *input, uint32_t time_msec,
+        uint32_t button, bool pressed);
+void virtual_input_axis(struct planar_virtual_input *input, uint32_t time_msec,
+        enum wl_pointer_axis orientation, double delta, int32_t delta_discrete);
+void virtual_input_frame(struct planar_virtual_input *input);
+void virtual_input_key(struct planar_virtual_input *input, uint32_t time_msec,
+        uint32_t keycode, bool pressed);
+
+#endif // PLANAR_VIRTUAL_INPUT_H
@@ -0,0 +1,117 @@
+#include "budget.h"
+#include "server.h"
+#include "stats.h"
+#include "toplevel.h"
+
+#include <inttypes.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/log.h>
+
+struct budget_usage {
+    uint64_t buffer_bytes;
+    uint64_t texture_bytes;
+};
+
+static void budget_surface_iter(struct wlr_surface *surface, int sx, int sy, void *data) {
+    struct budget_usage *usage = data;
+    struct wlr_client_buffer *buffer = surface->buffer;
+    if (!buffer) {
+        return;
+    }
+    usage->buffer_bytes += (uint64_t)buffer->base.width * buffer->base.height * 4;
+    if (buffer->texture) {
+        usage->texture_bytes += (uint64_t)buffer->texture->width * buffer->texture->height * 4;
+    }
+}
+
+static void budget_toplevel_set(struct planar_toplevel *toplevel,
+        const struct budget_usage *usage) {
+    struct planar_budget *budget = &toplevel->server->budget;
+    struct planar_client_stats *client = toplevel->client_stats;
+
+    budget->buffer_bytes += usage->buffer_bytes - toplevel->buffer_bytes;
+    budget->texture_bytes += usage->texture_bytes - toplevel->texture_bytes;
+    if (client) {
+        client->buffer_bytes += usage->buffer_bytes - toplevel->buffer_bytes;
+        client->texture_bytes += usage->texture_bytes - toplevel->texture_bytes;
+    }
+    toplevel->buffer_bytes = usage->buffer_bytes;
+    toplevel->texture_bytes = usage->texture_bytes;
+}
+
+void budget_toplevel_commit(struct planar_toplevel *toplevel) {
+    struct budget_usage usage = {0};
+    wlr_surface_for_each_surface(toplevel->xdg_toplevel->base->surface,
+        budget_surface_iter, &usage);
+    if (usage.buffer_bytes != toplevel->buffer_bytes ||
+            usage.texture_bytes != toplevel->texture_bytes) {
+        budget_toplevel_set(toplevel, &usage);
+    }
+}
+
+void budget_toplevel_destroy(struct planar_toplevel *toplevel) {
+    struct budget_usage usage = {0};
+    budget_toplevel_set(toplevel, &usage);
+    if (toplevel->suspended) {
+        toplevel->server->budget.suspended--;
+    }
+}
+
+static void budget_suspend(struct planar_toplevel *toplevel, bool suspended) {
+    toplevel->suspended = suspended;
+    if (suspended) {
+        toplevel->server->budget.suspended++;
+    } else {
+        toplevel->server->budget.suspended--;
+    }
+    wlr_xdg_toplevel_set_suspended(toplevel->xdg_toplevel, suspended);
+}
+
+static bool budget_toplevel_visible(struct planar_toplevel *toplevel) {
+    return !wl_list_empty(&toplevel->xdg_toplevel->base->surface->current_outputs);
+}
+
+void budget_frame(struct planar_server *server) {
+    struct planar_budget *budget = &server->budget;
+    bool over = budget->limit && budget->texture_bytes > budget->limit;
+    if (!over && budget->suspended == 0) {
+        return;
+    }
+
+    /* Suspended toplevels are already asked to shrink, only the rest
+     * counts against the limit. */
+    uint64_t unsuspended = budget->texture_bytes;
+    struct planar_toplevel *toplevel;
+    wl_list_for_each(toplevel, &server->toplevels, link) {
+        if (!toplevel->suspended) {
+            continue;
+        }
+        if (budget_toplevel_visible(toplevel)) {
+            budget_suspend(toplevel, false);
+        } else {
+            unsuspended -= toplevel->texture_bytes;
+        }
+    }
+
+    while (budget->limit && unsuspended > budget->limit) {
+        struct planar_toplevel *largest = NULL;
+        wl_list_for_each(toplevel, &server->toplevels, link) {
+            if (toplevel->suspended || toplevel->texture_bytes == 0 ||
+                    budget_toplevel_visible(toplevel)) {
+                continue;
+            }
+            if (!largest || toplevel->texture_bytes > largest->texture_bytes) {
+                largest = toplevel;
+            }
+        }
+        if (!largest) {
+            break;
+        }
+        wlr_log(WLR_DEBUG, "Texture budget exceeded, suspending %s (%" PRIu64 " bytes)",
+            largest->xdg_toplevel->app_id ? largest->xdg_toplevel->app_id : "toplevel",
+            largest->texture_bytes);
+        budget_suspend(largest, true);
+        unsuspended -= largest->texture_bytes;
+    }
+}
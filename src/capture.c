@@ -0,0 +1,100 @@
+#include "capture.h"
+#include "server.h"
+#include "toplevel.h"
+
+#include <wlr/types/wlr_ext_foreign_toplevel_list_v1.h>
+#include <wlr/types/wlr_ext_image_capture_source_v1.h>
+#include <wlr/types/wlr_ext_image_copy_capture_v1.h>
+#include <wlr/util/log.h>
+
+static void capture_source_destroy(struct wl_listener *listener, void *data) {
+    struct planar_toplevel *toplevel =
+        wl_container_of(listener, toplevel, capture_source_destroy);
+    wl_list_remove(&toplevel->capture_source_destroy.link);
+    toplevel->capture_source = NULL;
+}
+
+static void capture_new_toplevel_request(struct wl_listener *listener, void *data) {
+    struct planar_server *server =
+        wl_container_of(listener, server, capture.new_toplevel_request);
+    struct wlr_ext_foreign_toplevel_image_capture_source_manager_v1_request *request = data;
+    struct planar_toplevel *toplevel = request->toplevel_handle->data;
+    if (!toplevel) {
+        return;
+    }
+
+    /* One source per toplevel, shared by every client capturing it. */
+    if (!toplevel->capture_source) {
+        toplevel->capture_source = wlr_ext_image_capture_source_v1_create_with_scene_node(
+            &toplevel->scene_tree->node, wl_display_get_event_loop(server->wl_display),
+            server->allocator, server->renderer);
+        if (!toplevel->capture_source) {
+            wlr_log(WLR_ERROR, "Unable to create a capture source for toplevel");
+            return;
+        }
+        toplevel->capture_source_destroy.notify = capture_source_destroy;
+        wl_signal_add(&toplevel->capture_source->events.destroy,
+            &toplevel->capture_source_destroy);
+    }
+    wlr_ext_foreign_toplevel_image_capture_source_manager_v1_request_accept(request,
+        toplevel->capture_source);
+}
+
+static struct wlr_ext_foreign_toplevel_handle_v1_state capture_toplevel_state(
+        struct planar_toplevel *toplevel) {
+    return (struct wlr_ext_foreign_toplevel_handle_v1_state){
+        .title = toplevel->xdg_toplevel->title,
+        .app_id = toplevel->xdg_toplevel->app_id,
+    };
+}
+
+void capture_toplevel_map(struct planar_toplevel *toplevel) {
+    struct planar_capture *capture = &toplevel->server->capture;
+    struct wlr_ext_foreign_toplevel_handle_v1_state state = capture_toplevel_state(toplevel);
+    toplevel->foreign_handle = wlr_ext_foreign_toplevel_handle_v1_create(
+        capture->foreign_toplevel_list, &state);
+    if (toplevel->foreign_handle) {
+        toplevel->foreign_handle->data = toplevel;
+    }
+}
+
+void capture_toplevel_unmap(struct planar_toplevel *toplevel) {
+    if (toplevel->foreign_handle) {
+        wlr_ext_foreign_toplevel_handle_v1_destroy(toplevel->foreign_handle);
+        toplevel->foreign_handle = NULL;
+    }
+}
+
+void capture_toplevel_update(struct planar_toplevel *toplevel) {
+    if (toplevel->foreign_handle) {
+        struct wlr_ext_foreign_toplevel_handle_v1_state state =
+            capture_toplevel_state(toplevel);
+        wlr_ext_foreign_toplevel_handle_v1_update_state(toplevel->foreign_handle, &state);
+    }
+}
+
+void capture_toplevel_destroy(struct planar_toplevel *toplevel) {
+    /* The source itself goes away with the scene node. */
+    if (toplevel->capture_source) {
+        wl_list_remove(&toplevel->capture_source_destroy.link);
+        toplevel->capture_source = NULL;
+    }
+}
+
+void capture_init(struct planar_server *server) {
+    struct planar_capture *capture = &server->capture;
+    wlr_ext_image_copy_capture_manager_v1_create(server->wl_display, 1);
+    wlr_ext_output_image_capture_source_manager_v1_create(server->wl_display, 1);
+
+    capture->foreign_toplevel_list =
+        wlr_ext_foreign_toplevel_list_v1_create(server->wl_display, 1);
+    capture->toplevel_sources =
+        wlr_ext_foreign_toplevel_image_capture_source_manager_v1_create(server->wl_display, 1);
+    capture->new_toplevel_request.notify = capture_new_toplevel_request;
+    wl_signal_add(&capture->toplevel_sources->events.new_request,
+        &capture->new_toplevel_request);
+}
+
+void capture_finish(struct planar_server *server) {
+    wl_list_remove(&server->capture.new_toplevel_request.link);
+}
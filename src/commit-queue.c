@@ -0,0 +1,369 @@
+#include "commit-queue.h"
+#include "server.h"
+#include "output.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+
+#include "commit-timing-v1-protocol.h"
+#include "fifo-v1-protocol.h"
+
+#define COMMIT_QUEUE_FIFO_VERSION 1
+#define COMMIT_QUEUE_TIMING_VERSION 1
+#define COMMIT_QUEUE_DEFAULT_REFRESH_NS 16666667ull
+
+static bool commit_entry_ready(struct planar_commit_queue *queue,
+        const struct planar_commit_entry *entry, uint64_t deadline_ns) {
+    if (entry->wait_barrier && queue->barrier) {
+        return false;
+    }
+    return entry->target_ns == 0 || entry->target_ns <= deadline_ns;
+}
+
+static void commit_queue_destroy(struct planar_commit_queue *queue) {
+    /* Locked commits go with the surface, or were released already. */
+    struct planar_commit_entry *entry, *tmp;
+    wl_list_for_each_safe(entry, tmp, &queue->entries, link) {
+        wl_list_remove(&entry->link);
+        free(entry);
+    }
+    if (queue->fifo) {
+        wl_resource_set_user_data(queue->fifo, NULL);
+    }
+    if (queue->timer) {
+        wl_resource_set_user_data(queue->timer, NULL);
+    }
+    wlr_addon_finish(&queue->addon);
+    wl_list_remove(&queue->client_commit.link);
+    wl_list_remove(&queue->link);
+    free(queue);
+}
+
+static void commit_queue_flush(struct planar_commit_queue *queue, uint64_t deadline_ns) {
+    while (!wl_list_empty(&queue->entries)) {
+        struct planar_commit_entry *entry =
+            wl_container_of(queue->entries.next, entry, link);
+        if (!commit_entry_ready(queue, entry, deadline_ns)) {
+            break;
+        }
+        wl_list_remove(&entry->link);
+        if (entry->set_barrier) {
+            queue->barrier = true;
+        }
+        uint32_t seq = entry->seq;
+        free(entry);
+        if (seq) {
+            /* Applies this commit and any unlocked ones cached behind it,
+             * which are the next entries and are always ready. */
+            wlr_surface_unlock_cached(queue->surface, seq);
+        }
+    }
+}
+
+static void commit_queue_maybe_destroy(struct planar_commit_queue *queue) {
+    if (!queue->fifo && !queue->timer && wl_list_empty(&queue->entries)) {
+        commit_queue_destroy(queue);
+    }
+}
+
+static void commit_queue_handle_client_commit(struct wl_listener *listener, void *data) {
+    struct planar_commit_queue *queue = wl_container_of(listener, queue, client_commit);
+    struct planar_commit_entry pending = queue->pending;
+    queue->pending = (struct planar_commit_entry){0};
+
+    if (wl_list_empty(&queue->entries) &&
+            commit_entry_ready(queue, &pending, stats_now_ns())) {
+        if (pending.set_barrier) {
+            queue->barrier = true;
+        }
+        return;
+    }
+
+    struct planar_commit_entry *entry = calloc(1, sizeof(*entry));
+    if (!entry) {
+        wl_client_post_no_memory(wl_resource_get_client(queue->surface->resource));
+        return;
+    }
+    *entry = pending;
+    if (entry->wait_barrier || entry->target_ns) {
+        entry->seq = wlr_surface_lock_pending(queue->surface);
+    }
+    wl_list_insert(queue->entries.prev, &entry->link);
+    /* Released from output frames, make sure there is one. */
+    output_schedule_frames(queue->server);
+}
+
+static void commit_queue_addon_destroy(struct wlr_addon *addon) {
+    struct planar_commit_queue *queue = wl_container_of(addon, queue, addon);
+    commit_queue_destroy(queue);
+}
+
+static const struct wlr_addon_interface commit_queue_addon_impl = {
+    .name = "planar_commit_queue",
+    .destroy = commit_queue_addon_destroy,
+};
+
+static struct planar_commit_queue *commit_queue_get(struct planar_server *server,
+        struct wlr_surface *surface) {
+    struct wlr_addon *addon = wlr_addon_find(&surface->addons,
+        &server->commit_queues, &commit_queue_addon_impl);
+    if (addon) {
+        struct planar_commit_queue *queue = wl_container_of(addon, queue, addon);
+        return queue;
+    }
+
+    struct planar_commit_queue *queue = calloc(1, sizeof(*queue));
+    if (!queue) {
+        return NULL;
+    }
+    queue->server = server;
+    queue->surface = surface;
+    wl_list_init(&queue->entries);
+    wlr_addon_init(&queue->addon, &surface->addons, &server->commit_queues,
+        &commit_queue_addon_impl);
+    queue->client_commit.notify = commit_queue_handle_client_commit;
+    wl_signal_add(&surface->events.client_commit, &queue->client_commit);
+    wl_list_insert(&server->commit_queues.queues, &queue->link);
+    return queue;
+}
+
+static bool commit_queue_on_output(struct planar_commit_queue *queue,
+        struct wlr_output *output) {
+    /* Surfaces nobody sees are paced by whichever output comes by. */
+    if (wl_list_empty(&queue->surface->current_outputs)) {
+        return true;
+    }
+    struct wlr_surface_output *surface_output;
+    wl_list_for_each(surface_output, &queue->surface->current_outputs, link) {
+        if (surface_output->output == output) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void commit_queue_frame(struct planar_server *server, struct wlr_output *output,
+        uint64_t frame_start_ns) {
+    if (wl_list_empty(&server->commit_queues.queues)) {
+        return;
+    }
+    /* What is released now is rendered by the next frame, presented about
+     * two refresh cycles after this one started. */
+    uint64_t refresh_ns = output->refresh > 0 ?
+        1000000000000ull / output->refresh : COMMIT_QUEUE_DEFAULT_REFRESH_NS;
+    uint64_t deadline_ns = frame_start_ns + 2 * refresh_ns;
+
+    bool waiting = false;
+    struct planar_commit_queue *queue, *tmp;
+    wl_list_for_each_safe(queue, tmp, &server->commit_queues.queues, link) {
+        if (!commit_queue_on_output(queue, output)) {
+            continue;
+        }
+        /* Whatever set the barrier has been latched by this frame. */
+        queue->barrier = false;
+        commit_queue_flush(queue, deadline_ns);
+        if (!wl_list_empty(&queue->entries)) {
+            waiting = true;
+        } else {
+            commit_queue_maybe_destroy(queue);
+        }
+    }
+    if (waiting) {
+        wlr_output_schedule_frame(output);
+    }
+}
+
+static struct planar_commit_queue *commit_queue_from_fifo(struct wl_resource *resource) {
+    return wl_resource_get_user_data(resource);
+}
+
+static void fifo_handle_set_barrier(struct wl_client *client, struct wl_resource *resource) {
+    struct planar_commit_queue *queue = commit_queue_from_fifo(resource);
+    if (!queue) {
+        wl_resource_post_error(resource, WP_FIFO_V1_ERROR_SURFACE_DESTROYED,
+            "The surface was destroyed");
+        return;
+    }
+    queue->pending.set_barrier = true;
+}
+
+static void fifo_handle_wait_barrier(struct wl_client *client, struct wl_resource *resource) {
+    struct planar_commit_queue *queue = commit_queue_from_fifo(resource);
+    if (!queue) {
+        wl_resource_post_error(resource, WP_FIFO_V1_ERROR_SURFACE_DESTROYED,
+            "The surface was destroyed");
+        return;
+    }
+    queue->pending.wait_barrier = true;
+}
+
+static void handle_resource_destroy(struct wl_client *client, struct wl_resource *resource) {
+    wl_resource_destroy(resource);
+}
+
+static const struct wp_fifo_v1_interface fifo_impl = {
+    .set_barrier = fifo_handle_set_barrier,
+    .wait_barrier = fifo_handle_wait_barrier,
+    .destroy = handle_resource_destroy,
+};
+
+static void fifo_resource_destroy(struct wl_resource *resource) {
+    struct planar_commit_queue *queue = commit_queue_from_fifo(resource);
+    if (!queue) {
+        return;
+    }
+    /* Nothing may wait on a barrier that nobody can clear any more. */
+    queue->fifo = NULL;
+    queue->barrier = false;
+    queue->pending.set_barrier = queue->pending.wait_barrier = false;
+    struct planar_commit_entry *entry;
+    wl_list_for_each(entry, &queue->entries, link) {
+        entry->wait_barrier = entry->set_barrier = false;
+    }
+    commit_queue_flush(queue, stats_now_ns());
+    commit_queue_maybe_destroy(queue);
+}
+
+static void fifo_manager_handle_get_fifo(struct wl_client *client,
+        struct wl_resource *manager_resource, uint32_t id,
+        struct wl_resource *surface_resource) {
+    struct planar_server *server = wl_resource_get_user_data(manager_resource);
+    struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+    struct planar_commit_queue *queue = commit_queue_get(server, surface);
+    if (!queue) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    if (queue->fifo) {
+        wl_resource_post_error(manager_resource, WP_FIFO_MANAGER_V1_ERROR_ALREADY_EXISTS,
+            "The surface already has a fifo object");
+        return;
+    }
+
+    struct wl_resource *resource = wl_resource_create(client, &wp_fifo_v1_interface,
+        wl_resource_get_version(manager_resource), id);
+    if (!resource) {
+        commit_queue_maybe_destroy(queue);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &fifo_impl, queue, fifo_resource_destroy);
+    queue->fifo = resource;
+}
+
+static const struct wp_fifo_manager_v1_interface fifo_manager_impl = {
+    .destroy = handle_resource_destroy,
+    .get_fifo = fifo_manager_handle_get_fifo,
+};
+
+static void fifo_manager_bind(struct wl_client *client, void *data, uint32_t version,
+        uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(client,
+        &wp_fifo_manager_v1_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &fifo_manager_impl, data, NULL);
+}
+
+static void timer_handle_set_timestamp(struct wl_client *client, struct wl_resource *resource,
+        uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec) {
+    struct planar_commit_queue *queue = wl_resource_get_user_data(resource);
+    if (!queue) {
+        wl_resource_post_error(resource, WP_COMMIT_TIMER_V1_ERROR_SURFACE_DESTROYED,
+            "The surface was destroyed");
+        return;
+    }
+    if (tv_nsec >= 1000000000) {
+        wl_resource_post_error(resource, WP_COMMIT_TIMER_V1_ERROR_INVALID_TIMESTAMP,
+            "tv_nsec out of range");
+        return;
+    }
+    if (queue->pending.target_ns) {
+        wl_resource_post_error(resource, WP_COMMIT_TIMER_V1_ERROR_TIMESTAMP_EXISTS,
+            "A timestamp was already set for this commit");
+        return;
+    }
+    uint64_t sec = ((uint64_t)tv_sec_hi << 32) | tv_sec_lo;
+    uint64_t target_ns = sec * 1000000000ull + tv_nsec;
+    /* 0 means no target, the epoch itself is long gone anyway. */
+    queue->pending.target_ns = target_ns ? target_ns : 1;
+}
+
+static const struct wp_commit_timer_v1_interface timer_impl = {
+    .set_timestamp = timer_handle_set_timestamp,
+    .destroy = handle_resource_destroy,
+};
+
+static void timer_resource_destroy(struct wl_resource *resource) {
+    struct planar_commit_queue *queue = wl_resource_get_user_data(resource);
+    if (!queue) {
+        return;
+    }
+    /* Commits already queued keep their targets. */
+    queue->timer = NULL;
+    queue->pending.target_ns = 0;
+    commit_queue_maybe_destroy(queue);
+}
+
+static void timing_manager_handle_get_timer(struct wl_client *client,
+        struct wl_resource *manager_resource, uint32_t id,
+        struct wl_resource *surface_resource) {
+    struct planar_server *server = wl_resource_get_user_data(manager_resource);
+    struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+    struct planar_commit_queue *queue = commit_queue_get(server, surface);
+    if (!queue) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    if (queue->timer) {
+        wl_resource_post_error(manager_resource,
+            WP_COMMIT_TIMING_MANAGER_V1_ERROR_COMMIT_TIMER_EXISTS,
+            "The surface already has a commit timer");
+        return;
+    }
+
+    struct wl_resource *resource = wl_resource_create(client, &wp_commit_timer_v1_interface,
+        wl_resource_get_version(manager_resource), id);
+    if (!resource) {
+        commit_queue_maybe_destroy(queue);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &timer_impl, queue, timer_resource_destroy);
+    queue->timer = resource;
+}
+
+static const struct wp_commit_timing_manager_v1_interface timing_manager_impl = {
+    .destroy = handle_resource_destroy,
+    .get_timer = timing_manager_handle_get_timer,
+};
+
+static void timing_manager_bind(struct wl_client *client, void *data, uint32_t version,
+        uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(client,
+        &wp_commit_timing_manager_v1_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &timing_manager_impl, data, NULL);
+}
+
+void commit_queue_init(struct planar_server *server) {
+    struct planar_commit_queues *queues = &server->commit_queues;
+    wl_list_init(&queues->queues);
+    queues->fifo_manager = wl_global_create(server->wl_display,
+        &wp_fifo_manager_v1_interface, COMMIT_QUEUE_FIFO_VERSION, server,
+        fifo_manager_bind);
+    queues->timing_manager = wl_global_create(server->wl_display,
+        &wp_commit_timing_manager_v1_interface, COMMIT_QUEUE_TIMING_VERSION, server,
+        timing_manager_bind);
+    if (!queues->fifo_manager || !queues->timing_manager) {
+        wlr_log(WLR_ERROR, "Unable to create the fifo and commit timing globals");
+    }
+}
@@ -3,45 +3,20 @@
 #include "toplevel.h"
 #include "output.h"
 #include "layers.h"
+#include "replay.h"
 #include <wlr/types/wlr_seat.h>
 #include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/util/edges.h>
+#include <wlr/util/log.h>
 #include <string.h>
 #include <linux/input-event-codes.h>
 
-static struct planar_toplevel *desktop_toplevel_at(
-		struct planar_server *server, double lx, double ly,
-		struct wlr_surface **surface, double *sx, double *sy) {
-	/* This returns the topmost node in the scene at the given layout coords.
-	 * We only care about surface nodes as we are specifically looking for a
-	 * surface in the surface tree of a planar_toplevel. */
-	struct wlr_scene_node *node = wlr_scene_node_at(
-		&server->scene->tree.node, lx, ly, sx, sy);
-	if (node == NULL || node->type != WLR_SCENE_NODE_BUFFER) {
-		return NULL;
-	}
-	struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
-	struct wlr_scene_surface *scene_surface =
-		wlr_scene_surface_try_from_buffer(scene_buffer);
-	if (!scene_surface) {
-		return NULL;
-	}
-
-	*surface = scene_surface->surface;
-	/* Find the node corresponding to the planar_toplevel at the root of this
-	 * surface tree, it is the only one for which we set the data field. */
-	struct wlr_scene_tree *tree = node->parent;
-	while (tree != NULL && tree->node.data == NULL) {
-		tree = tree->node.parent;
-	}
-	return tree->node.data;
-}
-
 void cursor_init(struct planar_server *server) {
     server->cursor = wlr_cursor_create();
     wlr_cursor_attach_output_layout(server->cursor, server->output_layout);
 
     server->cursor_mgr = wlr_xcursor_manager_create(NULL, 24);
+    cursor_load_theme(server, 1);
 
     server->cursor_mode = PLANAR_CURSOR_PASSTHROUGH;
 
@@ -67,6 +42,24 @@ void cursor_destroy(struct planar_server *server) {
     wlr_cursor_destroy(server->cursor);
 }
 
+void cursor_load_theme(struct planar_server *server, float scale) {
+    /* wlroots would otherwise load the theme lazily, on the first motion
+     * over an output of a scale it hasn't seen. */
+    if (!wlr_xcursor_manager_load(server->cursor_mgr, scale)) {
+        wlr_log(WLR_ERROR, "Unable to load cursor theme at scale %.2f", scale);
+    }
+}
+
+void cursor_set_image(struct planar_server *server, const char *name) {
+    /* Setting an xcursor rebuilds the cursor buffer on every output, skip
+     * it unless the image actually changes. */
+    if (server->cursor_image && strcmp(server->cursor_image, name) == 0) {
+        return;
+    }
+    server->cursor_image = name;
+    wlr_cursor_set_xcursor(server->cursor, server->cursor_mgr, name);
+}
+
 void process_cursor_motion(struct planar_server *server, double cx, double cy, uint32_t time) {
     /* If the mode is non-passthrough, delegate to those functions. */
     if (server->cursor_mode == PLANAR_CURSOR_MOVE) {
@@ -77,39 +70,55 @@ void process_cursor_motion(struct planar_server *server, double cx, double cy, u
         return;
     }
 
-    /* First, check for layer surfaces using global coordinates */
     double sx, sy;
     struct wlr_seat *seat = server->seat;
-    struct wlr_surface *surface = NULL;
-    struct planar_layer_surface *layer_surface = layer_surface_at(server,
-            cx, cy, &surface, &sx, &sy);
-
-    if (layer_surface && strcmp(surface->role->name, "zwlr_layer_surface_v1") == 0) {
-        if (surface) {
-            wlr_seat_pointer_notify_enter(seat, surface, sx, sy);
-            wlr_seat_pointer_notify_motion(seat, time, sx, sy);
-        }
-        return;
-    }
+    struct wlr_surface *prev_focus = seat->pointer_state.focused_surface;
+    struct wlr_surface *surface = input_surface_at(server, cx, cy, &sx, &sy, NULL, NULL);
 
-    /* If no layer surface was found, apply the offset and check for regular windows */
-    convert_global_coords_to_scene(server, &cx, &cy);
-
-    struct planar_toplevel *toplevel = desktop_toplevel_at(server,
-            cx, cy, &surface, &sx, &sy);
-
-    if (toplevel && toplevel->server) {
-        if (surface) {
-            wlr_seat_pointer_notify_enter(seat, surface, sx, sy);
-            wlr_seat_pointer_notify_motion(seat, time, sx, sy);
-        }
+    if (surface) {
+        wlr_seat_pointer_notify_enter(seat, surface, sx, sy);
+        wlr_seat_pointer_notify_motion(seat, time, sx, sy);
     } else {
         /* If there's no toplevel under the cursor, set the cursor image to a
          * default. This is what makes the cursor image appear when you move it
          * around the screen, not over any toplevels. */
-        wlr_cursor_set_xcursor(server->cursor, server->cursor_mgr, "default");
+        cursor_set_image(server, "default");
         wlr_seat_pointer_clear_focus(seat);
     }
+    if (seat->pointer_state.focused_surface != prev_focus) {
+        pointer_constraints_update(server);
+    }
+}
+
+struct wlr_surface *input_surface_at(struct planar_server *server, double lx, double ly,
+        double *sx, double *sy, struct planar_toplevel **toplevel,
+        struct planar_layer_surface **layer_surface) {
+    /* First, check for layer surfaces using global coordinates */
+    struct wlr_surface *surface = NULL;
+    struct planar_layer_surface *layer = layer_surface_at(server, lx, ly, &surface, sx, sy);
+    if (toplevel) {
+        *toplevel = NULL;
+    }
+    if (layer_surface) {
+        *layer_surface = layer;
+    }
+    if (layer && surface && strcmp(surface->role->name, "zwlr_layer_surface_v1") == 0) {
+        return surface;
+    }
+    if (layer_surface) {
+        *layer_surface = NULL;
+    }
+
+    /* If no layer surface was found, check for regular windows */
+    surface = NULL;
+    struct planar_toplevel *found = desktop_toplevel_at(server, lx, ly, &surface, sx, sy);
+    if (!found || !found->server) {
+        return NULL;
+    }
+    if (toplevel) {
+        *toplevel = found;
+    }
+    return surface;
 }
 
 void process_cursor_move(struct planar_server *server, uint32_t time) {
@@ -126,9 +135,8 @@ void process_cursor_resize(struct planar_server *server, uint32_t time) {
 	 * toplevel on one or two axes, but can also move the toplevel if you resize
 	 * from the top or left edges (or top-left corner).
 	 *
-	 * Note that some shortcuts are taken here. In a more fleshed-out
-	 * compositor, you'd wait for the client to prepare a buffer at the new
-	 * size, then commit any movement that was prepared.
+	 * The move is part of a transaction with the new size, see
+	 * toplevel_configure.
 	 */
 	struct planar_toplevel *toplevel = server->grabbed_toplevel;
 	double border_x = server->cursor->x - server->grab_x;
@@ -161,21 +169,31 @@ void process_cursor_resize(struct planar_server *server, uint32_t time) {
 		}
 	}
 
+	/* Motion can come in at 1000 Hz. The client only sees the latest
+	 * geometry once it has caught up with the previous one, and the node
+	 * only moves together with the buffer at the new size. */
 	struct wlr_box *geo_box = &toplevel->xdg_toplevel->base->geometry;
-	wlr_scene_node_set_position(&toplevel->scene_tree->node,
-		new_left - geo_box->x, new_top - geo_box->y);
-
-	int new_width = new_right - new_left;
-	int new_height = new_bottom - new_top;
-	wlr_xdg_toplevel_set_size(toplevel->xdg_toplevel, new_width, new_height);
+	toplevel_configure(toplevel, new_left - geo_box->x, new_top - geo_box->y,
+		new_right - new_left, new_bottom - new_top);
 }
 
 static void server_cursor_motion(struct wl_listener *listener, void *data) {
+	TRACE_SCOPE("cursor_motion");
 	/* This event is forwarded by the cursor when a pointer emits a _relative_
 	 * pointer motion event (i.e. a delta) */
 	struct planar_server *server =
 		wl_container_of(listener, server, cursor_motion);
 	struct wlr_pointer_motion_event *event = data;
+	recorder_record(server, &(struct planar_record){
+		.type = PLANAR_RECORD_MOTION,
+		.time_msec = event->time_msec,
+		.x = event->delta_x,
+		.y = event->delta_y,
+	});
+	/* Locked and confined pointers never need a hit-test. */
+	if (pointer_constraints_motion(server, event)) {
+		return;
+	}
 	/* The cursor doesn't move unless we tell it to. The cursor automatically
 	 * handles constraining the motion to the output layout, as well as any
 	 * special configuration applied for the specific input device which
@@ -183,6 +201,11 @@ static void server_cursor_motion(struct wl_listener *listener, void *data) {
 	 * the cursor around without any input. */
 	wlr_cursor_move(server->cursor, &event->pointer->base,
 			event->delta_x, event->delta_y);
+	/* Panning redraws every output, plain motion only the one the cursor
+	 * moved onto. */
+	stats_input_stamp(server, server->cursor_mode == PLANAR_CURSOR_PANNING ? NULL :
+		wlr_output_layout_output_at(server->output_layout,
+			server->cursor->x, server->cursor->y), event->time_msec);
 	if (server->cursor_mode == PLANAR_CURSOR_PANNING) {
         // Update global offset based on cursor movement
         server->global_offset.x += event->delta_x;
@@ -207,6 +230,7 @@ static void server_cursor_motion(struct wl_listener *listener, void *data) {
 
 static void server_cursor_motion_absolute(
 		struct wl_listener *listener, void *data) {
+	TRACE_SCOPE("cursor_motion_absolute");
 	/* This event is forwarded by the cursor when a pointer emits an _absolute_
 	 * motion event, from 0..1 on each axis. This happens, for example, when
 	 * wlroots is running under a Wayland window rather than KMS+DRM, and you
@@ -216,6 +240,12 @@ static void server_cursor_motion_absolute(
 	struct planar_server *server =
 		wl_container_of(listener, server, cursor_motion_absolute);
 	struct wlr_pointer_motion_absolute_event *event = data;
+	recorder_record(server, &(struct planar_record){
+		.type = PLANAR_RECORD_MOTION_ABSOLUTE,
+		.time_msec = event->time_msec,
+		.x = event->x,
+		.y = event->y,
+	});
 	wlr_cursor_warp_absolute(server->cursor, &event->pointer->base, event->x,
 		event->y);
 	double cx = server->cursor->x;
@@ -224,9 +254,17 @@ static void server_cursor_motion_absolute(
 }
 
 static void server_cursor_button(struct wl_listener *listener, void *data) {
+    TRACE_SCOPE("cursor_button");
     struct planar_server *server =
         wl_container_of(listener, server, cursor_button);
     struct wlr_pointer_button_event *event = data;
+    stats_input_stamp(server, NULL, event->time_msec);
+    recorder_record(server, &(struct planar_record){
+        .type = PLANAR_RECORD_BUTTON,
+        .time_msec = event->time_msec,
+        .code = event->button,
+        .state = event->state,
+    });
 
     wlr_seat_pointer_notify_button(server->seat,
             event->time_msec, event->button, event->state);
@@ -260,11 +298,21 @@ static void server_cursor_button(struct wl_listener *listener, void *data) {
 }
 
 static void server_cursor_axis(struct wl_listener *listener, void *data) {
+	TRACE_SCOPE("cursor_axis");
 	/* This event is forwarded by the cursor when a pointer emits an axis event,
 	 * for example when you move the scroll wheel. */
 	struct planar_server *server =
 		wl_container_of(listener, server, cursor_axis);
 	struct wlr_pointer_axis_event *event = data;
+	recorder_record(server, &(struct planar_record){
+		.type = PLANAR_RECORD_AXIS,
+		.time_msec = event->time_msec,
+		.state = event->orientation,
+		.aux = event->relative_direction,
+		.code = event->source,
+		.discrete = event->delta_discrete,
+		.x = event->delta,
+	});
 	/* Notify the client with pointer focus of the axis event. */
 	wlr_seat_pointer_notify_axis(server->seat,
 			event->time_msec, event->orientation, event->delta,
@@ -272,12 +320,14 @@ static void server_cursor_axis(struct wl_listener *listener, void *data) {
 }
 
 static void server_cursor_frame(struct wl_listener *listener, void *data) {
+	TRACE_SCOPE("cursor_frame");
 	/* This event is forwarded by the cursor when a pointer emits an frame
 	 * event. Frame events are sent after regular pointer events to group
 	 * multiple events together. For instance, two axis events may happen at the
 	 * same time, in which case a frame event won't be sent in between. */
 	struct planar_server *server =
 		wl_container_of(listener, server, cursor_frame);
+	recorder_record(server, &(struct planar_record){ .type = PLANAR_RECORD_FRAME });
 	/* Notify the client with pointer focus of the frame event. */
 	wlr_seat_pointer_notify_frame(server->seat);
 }
@@ -0,0 +1,159 @@
+#include "gestures.h"
+#include "server.h"
+#include "output.h"
+
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_seat.h>
+
+static void gesture_swipe_begin(struct wl_listener *listener, void *data) {
+    struct planar_server *server = wl_container_of(listener, server, gestures.swipe_begin);
+    struct planar_gestures *gestures = &server->gestures;
+    struct wlr_pointer_swipe_begin_event *event = data;
+
+    gestures->panning = event->fingers == PLANAR_GESTURE_PAN_FINGERS;
+    if (!gestures->panning) {
+        wlr_pointer_gestures_v1_send_swipe_begin(gestures->pointer_gestures,
+            server->seat, event->time_msec, event->fingers);
+    }
+}
+
+static void gesture_swipe_update(struct wl_listener *listener, void *data) {
+    TRACE_SCOPE("gesture_swipe_update");
+    struct planar_server *server = wl_container_of(listener, server, gestures.swipe_update);
+    struct planar_gestures *gestures = &server->gestures;
+    struct wlr_pointer_swipe_update_event *event = data;
+
+    if (!gestures->panning) {
+        wlr_pointer_gestures_v1_send_swipe_update(gestures->pointer_gestures,
+            server->seat, event->time_msec, event->dx, event->dy);
+        return;
+    }
+    /* The canvas follows the fingers, like a middle button drag. */
+    gestures->pending_dx += event->dx;
+    gestures->pending_dy += event->dy;
+    output_schedule_frames(server);
+}
+
+static void gesture_swipe_end(struct wl_listener *listener, void *data) {
+    struct planar_server *server = wl_container_of(listener, server, gestures.swipe_end);
+    struct planar_gestures *gestures = &server->gestures;
+    struct wlr_pointer_swipe_end_event *event = data;
+
+    if (!gestures->panning) {
+        wlr_pointer_gestures_v1_send_swipe_end(gestures->pointer_gestures,
+            server->seat, event->time_msec, event->cancelled);
+    }
+    gestures->panning = false;
+}
+
+static void gesture_pinch_begin(struct wl_listener *listener, void *data) {
+    struct planar_server *server = wl_container_of(listener, server, gestures.pinch_begin);
+    struct planar_gestures *gestures = &server->gestures;
+    struct wlr_pointer_pinch_begin_event *event = data;
+
+    /* Pinching over a window is the window's business, the canvas zooms
+     * when pinched over empty space. */
+    gestures->zooming = server->seat->pointer_state.focused_surface == NULL;
+    if (!gestures->zooming) {
+        wlr_pointer_gestures_v1_send_pinch_begin(gestures->pointer_gestures,
+            server->seat, event->time_msec, event->fingers);
+        return;
+    }
+    gestures->pending_scale = gestures->applied_scale = 1.0;
+}
+
+static void gesture_pinch_update(struct wl_listener *listener, void *data) {
+    TRACE_SCOPE("gesture_pinch_update");
+    struct planar_server *server = wl_container_of(listener, server, gestures.pinch_update);
+    struct planar_gestures *gestures = &server->gestures;
+    struct wlr_pointer_pinch_update_event *event = data;
+
+    if (!gestures->zooming) {
+        wlr_pointer_gestures_v1_send_pinch_update(gestures->pointer_gestures,
+            server->seat, event->time_msec, event->dx, event->dy,
+            event->scale, event->rotation);
+        return;
+    }
+    gestures->pending_dx += event->dx;
+    gestures->pending_dy += event->dy;
+    if (event->scale > 0) {
+        gestures->pending_scale = event->scale;
+    }
+    output_schedule_frames(server);
+}
+
+static void gesture_pinch_end(struct wl_listener *listener, void *data) {
+    struct planar_server *server = wl_container_of(listener, server, gestures.pinch_end);
+    struct planar_gestures *gestures = &server->gestures;
+    struct wlr_pointer_pinch_end_event *event = data;
+
+    if (!gestures->zooming) {
+        wlr_pointer_gestures_v1_send_pinch_end(gestures->pointer_gestures,
+            server->seat, event->time_msec, event->cancelled);
+    }
+    gestures->zooming = false;
+}
+
+static void gesture_hold_begin(struct wl_listener *listener, void *data) {
+    struct planar_server *server = wl_container_of(listener, server, gestures.hold_begin);
+    struct wlr_pointer_hold_begin_event *event = data;
+    wlr_pointer_gestures_v1_send_hold_begin(server->gestures.pointer_gestures,
+        server->seat, event->time_msec, event->fingers);
+}
+
+static void gesture_hold_end(struct wl_listener *listener, void *data) {
+    struct planar_server *server = wl_container_of(listener, server, gestures.hold_end);
+    struct wlr_pointer_hold_end_event *event = data;
+    wlr_pointer_gestures_v1_send_hold_end(server->gestures.pointer_gestures,
+        server->seat, event->time_msec, event->cancelled);
+}
+
+void gestures_frame(struct planar_server *server) {
+    /* Called at the start of every output frame. Whichever output renders
+     * first applies everything accumulated since, the rest see no change. */
+    struct planar_gestures *gestures = &server->gestures;
+    if (gestures->pending_dx != 0 || gestures->pending_dy != 0) {
+        server->global_offset.x += gestures->pending_dx;
+        server->global_offset.y += gestures->pending_dy;
+        gestures->pending_dx = gestures->pending_dy = 0;
+    }
+    if (gestures->zooming && gestures->pending_scale != gestures->applied_scale) {
+        output_zoom(server, gestures->pending_scale / gestures->applied_scale);
+        gestures->applied_scale = gestures->pending_scale;
+    }
+}
+
+void gestures_init(struct planar_server *server) {
+    struct planar_gestures *gestures = &server->gestures;
+    struct wlr_cursor *cursor = server->cursor;
+    gestures->pointer_gestures = wlr_pointer_gestures_v1_create(server->wl_display);
+
+    gestures->swipe_begin.notify = gesture_swipe_begin;
+    wl_signal_add(&cursor->events.swipe_begin, &gestures->swipe_begin);
+    gestures->swipe_update.notify = gesture_swipe_update;
+    wl_signal_add(&cursor->events.swipe_update, &gestures->swipe_update);
+    gestures->swipe_end.notify = gesture_swipe_end;
+    wl_signal_add(&cursor->events.swipe_end, &gestures->swipe_end);
+    gestures->pinch_begin.notify = gesture_pinch_begin;
+    wl_signal_add(&cursor->events.pinch_begin, &gestures->pinch_begin);
+    gestures->pinch_update.notify = gesture_pinch_update;
+    wl_signal_add(&cursor->events.pinch_update, &gestures->pinch_update);
+    gestures->pinch_end.notify = gesture_pinch_end;
+    wl_signal_add(&cursor->events.pinch_end, &gestures->pinch_end);
+    gestures->hold_begin.notify = gesture_hold_begin;
+    wl_signal_add(&cursor->events.hold_begin, &gestures->hold_begin);
+    gestures->hold_end.notify = gesture_hold_end;
+    wl_signal_add(&cursor->events.hold_end, &gestures->hold_end);
+}
+
+void gestures_finish(struct planar_server *server) {
+    struct planar_gestures *gestures = &server->gestures;
+    wl_list_remove(&gestures->swipe_begin.link);
+    wl_list_remove(&gestures->swipe_update.link);
+    wl_list_remove(&gestures->swipe_end.link);
+    wl_list_remove(&gestures->pinch_begin.link);
+    wl_list_remove(&gestures->pinch_update.link);
+    wl_list_remove(&gestures->pinch_end.link);
+    wl_list_remove(&gestures->hold_begin.link);
+    wl_list_remove(&gestures->hold_end.link);
+}
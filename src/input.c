@@ -1,45 +1,22 @@
 #include "input.h"
 #include "cursor.h"
 #include "output.h"
+#include "replay.h"
+#include "keybindings.h"
+#include "seat.h"
+#include "tablet.h"
+#include "touch.h"
+#include "toplevel.h"
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_keyboard_group.h>
 #include <wlr/types/wlr_input_device.h>
+#include <wlr/util/log.h>
 #include <xkbcommon/xkbcommon.h>
 
-#define KEY_REPEAT_DELAY 400
-#define KEY_REPEAT_RATE 40
-
-int keyboard_repeat_func(void *data) {
-    struct planar_server *server = data;
-    float move_step = 10.0f;
-
-    if (server->key_state.left_pressed) {
-        server->global_offset.x += move_step;
-    }
-    if (server->key_state.right_pressed) {
-        server->global_offset.x -= move_step;
-    }
-    if (server->key_state.up_pressed) {
-        server->global_offset.y += move_step;
-    }
-    if (server->key_state.down_pressed) {
-        server->global_offset.y -= move_step;
-    }
-
-    if (server->key_state.left_pressed || server->key_state.right_pressed ||
-        server->key_state.up_pressed || server->key_state.down_pressed) {
-        wl_event_source_timer_update(server->keyboard_repeat_source, KEY_REPEAT_RATE);
-        // Trigger a redraw
-        struct planar_output *output;
-        wl_list_for_each(output, &server->outputs, link) {
-            wlr_output_schedule_frame(output->wlr_output);
-        }
-    } else {
-        wl_event_source_timer_update(server->keyboard_repeat_source, 0);
-    }
-
-    return 0;
-}
+#define KEYBOARD_REPEAT_RATE 25
+#define KEYBOARD_REPEAT_DELAY 600
 
 static void keyboard_handle_modifiers(
 		struct wl_listener *listener, void *data) {
@@ -53,54 +30,34 @@ static void keyboard_handle_modifiers(
 	 * same seat. You can swap out the underlying wlr_keyboard like this and
 	 * wlr_seat handles this transparently.
 	 */
-	wlr_seat_set_keyboard(keyboard->server->seat, keyboard->wlr_keyboard);
+	if (wlr_seat_get_keyboard(keyboard->server->seat) != keyboard->wlr_keyboard) {
+		wlr_seat_set_keyboard(keyboard->server->seat, keyboard->wlr_keyboard);
+	}
 	/* Send modifiers to the client. */
 	wlr_seat_keyboard_notify_modifiers(keyboard->server->seat,
 		&keyboard->wlr_keyboard->modifiers);
-}
-
-static bool handle_keybinding(struct planar_server *server, xkb_keysym_t sym) {
-	/*
-	 * Here we handle compositor keybindings. This is when the compositor is
-	 * processing keys, rather than passing them on to the client for its own
-	 * processing.
-	 *
-	 * This function assumes Alt is held down.
-	 */
-	float move_step = 10.0f;
-	switch (sym) {
-	case XKB_KEY_Escape:
-		wl_display_terminate(server->wl_display);
-		break;
-	case XKB_KEY_F1:
-		/* Cycle to the next toplevel */
-		if (wl_list_length(&server->toplevels) < 2) {
-			break;
-		}
-        case XKB_KEY_Left:
-            server->key_state.left_pressed = true;
-            break;
-        case XKB_KEY_Right:
-            server->key_state.right_pressed = true;
-            break;
-        case XKB_KEY_Up:
-            server->key_state.up_pressed = true;
-            break;
-        case XKB_KEY_Down:
-            server->key_state.down_pressed = true;
-            break;
-            // Add more cases for additional navigation keys if needed
-        }
+	/* Letting go of Alt settles an Alt+F1 cycle. */
+	if (keyboard->wlr_keyboard->modifiers.depressed == 0) {
+		focus_cycle_end(keyboard->server);
 	}
+}
 
 static void keyboard_handle_key(
 		struct wl_listener *listener, void *data) {
+	TRACE_SCOPE("keyboard_key");
 	/* This event is raised when a key is pressed or released. */
 	struct planar_keyboard *keyboard =
 		wl_container_of(listener, keyboard, key);
 	struct planar_server *server = keyboard->server;
 	struct wlr_keyboard_key_event *event = data;
 	struct wlr_seat *seat = server->seat;
+	stats_input_stamp(server, NULL, event->time_msec);
+	recorder_record(server, &(struct planar_record){
+		.type = PLANAR_RECORD_KEY,
+		.time_msec = event->time_msec,
+		.code = event->keycode,
+		.state = event->state,
+	});
 
 	/* Translate libinput keycode -> xkbcommon */
 	uint32_t keycode = event->keycode + 8;
@@ -109,43 +66,16 @@ static void keyboard_handle_key(
 	int nsyms = xkb_state_key_get_syms(
 			keyboard->wlr_keyboard->xkb_state, keycode, &syms);
 
-	bool handled = false;
+	/* Compositor keybindings take the key if one matches. */
 	uint32_t modifiers = wlr_keyboard_get_modifiers(keyboard->wlr_keyboard);
-	if ((modifiers & WLR_MODIFIER_ALT) &&
-			event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
-		/* If alt is held down and this button was _pressed_, we attempt to
-		 * process it as a compositor keybinding. */
-		for (int i = 0; i < nsyms; i++) {
-			handled = handle_keybinding(server, syms[i]);
-		}
-	}
-	else if (event->state == WL_KEYBOARD_KEY_STATE_RELEASED) {
-        for (int i = 0; i < nsyms; i++) {
-            switch (syms[i]) {
-                case XKB_KEY_Left:
-                    server->key_state.left_pressed = false;
-                    break;
-                case XKB_KEY_Right:
-                    server->key_state.right_pressed = false;
-                    break;
-                case XKB_KEY_Up:
-                    server->key_state.up_pressed = false;
-                    break;
-                case XKB_KEY_Down:
-                    server->key_state.down_pressed = false;
-                    break;
-            }
-        }
-	}
-	if (handled) {
-        wl_event_source_timer_update(server->keyboard_repeat_source, KEY_REPEAT_DELAY);
-        keyboard_repeat_func(server);
-    }
-
+	bool handled = keybindings_handle_key(server, modifiers, syms, nsyms,
+		event->state == WL_KEYBOARD_KEY_STATE_PRESSED);
 
 	if (!handled) {
 		/* Otherwise, we pass it along to the client. */
-		wlr_seat_set_keyboard(seat, keyboard->wlr_keyboard);
+		if (wlr_seat_get_keyboard(seat) != keyboard->wlr_keyboard) {
+			wlr_seat_set_keyboard(seat, keyboard->wlr_keyboard);
+		}
 		wlr_seat_keyboard_notify_key(seat, event->time_msec,
 			event->keycode, event->state);
 	}
@@ -153,39 +83,161 @@ static void keyboard_handle_key(
 
 void keyboard_handle_destroy(struct wl_listener *listener, void *data) {
     struct planar_keyboard *keyboard = wl_container_of(listener, keyboard, destroy);
-    wl_list_remove(&keyboard->modifiers.link);
-    wl_list_remove(&keyboard->key.link);
+    /* The group drops destroyed devices on its own. */
+    if (!keyboard->grouped) {
+        wl_list_remove(&keyboard->modifiers.link);
+        wl_list_remove(&keyboard->key.link);
+    }
     wl_list_remove(&keyboard->destroy.link);
     wl_list_remove(&keyboard->link);
-    free(keyboard);
+    slab_free(&keyboard->server->stats.objects.keyboards, keyboard);
 }
 
 void server_new_keyboard(struct planar_server *server, struct wlr_input_device *device) {
     struct wlr_keyboard *wlr_keyboard = wlr_keyboard_from_input_device(device);
 
-    struct planar_keyboard *keyboard = calloc(1, sizeof(*keyboard));
+    struct planar_keyboard *keyboard = slab_alloc(&server->stats.objects.keyboards);
     keyboard->server = server;
     keyboard->wlr_keyboard = wlr_keyboard;
 
-    struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-    struct xkb_keymap *keymap = xkb_keymap_new_from_names(context, NULL,
+    struct xkb_keymap *keymap = keymap_get(server, NULL);
+    if (keymap) {
+        wlr_keyboard_set_keymap(wlr_keyboard, keymap);
+    }
+    wlr_keyboard_set_repeat_info(wlr_keyboard, KEYBOARD_REPEAT_RATE, KEYBOARD_REPEAT_DELAY);
+
+    /* Keyboards sharing the group's keymap share its state too, so the seat
+     * keeps one keyboard no matter which device a key came from. Anything
+     * else stands on its own. */
+    keyboard->grouped = server->keyboard_group &&
+        wlr_keyboard_group_add_keyboard(server->keyboard_group, wlr_keyboard);
+    if (!keyboard->grouped) {
+        keyboard->modifiers.notify = keyboard_handle_modifiers;
+        wl_signal_add(&wlr_keyboard->events.modifiers, &keyboard->modifiers);
+        keyboard->key.notify = keyboard_handle_key;
+        wl_signal_add(&wlr_keyboard->events.key, &keyboard->key);
+        wlr_seat_set_keyboard(server->seat, keyboard->wlr_keyboard);
+    } else if (wlr_seat_get_keyboard(server->seat) == NULL) {
+        wlr_seat_set_keyboard(server->seat, &server->keyboard_group->keyboard);
+    }
+    keyboard->destroy.notify = keyboard_handle_destroy;
+    wl_signal_add(&device->events.destroy, &keyboard->destroy);
+
+    wl_list_insert(&server->keyboards, &keyboard->link);
+}
+
+static char *keymap_name_dup(const char *name, const char *env) {
+    /* Unset names fall back to the XKB_DEFAULT_* variables like xkbcommon
+     * itself does, so that the cache key is the keymap actually built. */
+    if (!name || !*name) {
+        name = getenv(env);
+    }
+    return strdup(name ? name : "");
+}
+
+struct xkb_keymap *keymap_get(struct planar_server *server,
+        const struct xkb_rule_names *names) {
+    static const struct xkb_rule_names defaults = {0};
+    if (!names) {
+        names = &defaults;
+    }
+    struct planar_keymap key = {
+        .rules = keymap_name_dup(names->rules, "XKB_DEFAULT_RULES"),
+        .model = keymap_name_dup(names->model, "XKB_DEFAULT_MODEL"),
+        .layout = keymap_name_dup(names->layout, "XKB_DEFAULT_LAYOUT"),
+        .variant = keymap_name_dup(names->variant, "XKB_DEFAULT_VARIANT"),
+        .options = keymap_name_dup(names->options, "XKB_DEFAULT_OPTIONS"),
+    };
+
+    struct planar_keymap *cached;
+    wl_list_for_each(cached, &server->keymaps, link) {
+        if (strcmp(cached->rules, key.rules) == 0 &&
+                strcmp(cached->model, key.model) == 0 &&
+                strcmp(cached->layout, key.layout) == 0 &&
+                strcmp(cached->variant, key.variant) == 0 &&
+                strcmp(cached->options, key.options) == 0) {
+            free(key.rules);
+            free(key.model);
+            free(key.layout);
+            free(key.variant);
+            free(key.options);
+            return cached->keymap;
+        }
+    }
+
+    struct xkb_rule_names resolved = {
+        .rules = key.rules,
+        .model = key.model,
+        .layout = key.layout,
+        .variant = key.variant,
+        .options = key.options,
+    };
+    cached = calloc(1, sizeof(*cached));
+    *cached = key;
+    cached->keymap = xkb_keymap_new_from_names(server->xkb_context, &resolved,
         XKB_KEYMAP_COMPILE_NO_FLAGS);
+    if (!cached->keymap) {
+        wlr_log(WLR_ERROR, "Unable to compile keymap for layout \"%s\"", key.layout);
+    }
+    /* Failures are cached as well, there's no point retrying them. */
+    wl_list_insert(&server->keymaps, &cached->link);
+    return cached->keymap;
+}
+
+void input_init(struct planar_server *server) {
+    wl_list_init(&server->keyboards);
+    wl_list_init(&server->keymaps);
+    server->xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
 
+    struct xkb_keymap *keymap = keymap_get(server, NULL);
+    if (!keymap) {
+        /* Without a keymap to share, every keyboard stands on its own. */
+        return;
+    }
+    server->keyboard_group = wlr_keyboard_group_create();
+    if (!server->keyboard_group) {
+        return;
+    }
+    struct wlr_keyboard *wlr_keyboard = &server->keyboard_group->keyboard;
     wlr_keyboard_set_keymap(wlr_keyboard, keymap);
-    xkb_keymap_unref(keymap);
-    xkb_context_unref(context);
-    wlr_keyboard_set_repeat_info(wlr_keyboard, 25, 600);
+    wlr_keyboard_set_repeat_info(wlr_keyboard, KEYBOARD_REPEAT_RATE, KEYBOARD_REPEAT_DELAY);
 
+    struct planar_keyboard *keyboard = slab_alloc(&server->stats.objects.keyboards);
+    keyboard->server = server;
+    keyboard->wlr_keyboard = wlr_keyboard;
+    wl_list_init(&keyboard->link);
     keyboard->modifiers.notify = keyboard_handle_modifiers;
     wl_signal_add(&wlr_keyboard->events.modifiers, &keyboard->modifiers);
     keyboard->key.notify = keyboard_handle_key;
     wl_signal_add(&wlr_keyboard->events.key, &keyboard->key);
-    keyboard->destroy.notify = keyboard_handle_destroy;
-    wl_signal_add(&device->events.destroy, &keyboard->destroy);
+    server->group_keyboard = keyboard;
+}
 
-    wlr_seat_set_keyboard(server->seat, keyboard->wlr_keyboard);
+void input_finish(struct planar_server *server) {
+    if (server->group_keyboard) {
+        wl_list_remove(&server->group_keyboard->modifiers.link);
+        wl_list_remove(&server->group_keyboard->key.link);
+        slab_free(&server->stats.objects.keyboards, server->group_keyboard);
+        server->group_keyboard = NULL;
+    }
+    if (server->keyboard_group) {
+        wlr_keyboard_group_destroy(server->keyboard_group);
+        server->keyboard_group = NULL;
+    }
 
-    wl_list_insert(&server->keyboards, &keyboard->link);
+    struct planar_keymap *keymap, *tmp;
+    wl_list_for_each_safe(keymap, tmp, &server->keymaps, link) {
+        wl_list_remove(&keymap->link);
+        xkb_keymap_unref(keymap->keymap);
+        free(keymap->rules);
+        free(keymap->model);
+        free(keymap->layout);
+        free(keymap->variant);
+        free(keymap->options);
+        free(keymap);
+    }
+    xkb_context_unref(server->xkb_context);
+    server->xkb_context = NULL;
 }
 
 void server_new_pointer(struct planar_server *server, struct wlr_input_device *device) {
@@ -202,13 +254,18 @@ void server_new_input(struct wl_listener *listener, void *data) {
     case WLR_INPUT_DEVICE_POINTER:
         server_new_pointer(server, device);
         break;
+    case WLR_INPUT_DEVICE_TOUCH:
+        server_new_touch(server, device);
+        break;
+    case WLR_INPUT_DEVICE_TABLET:
+        server_new_tablet(server, device);
+        break;
+    case WLR_INPUT_DEVICE_TABLET_PAD:
+        server_new_tablet_pad(server, device);
+        break;
     default:
         break;
     }
 
-    uint32_t caps = WL_SEAT_CAPABILITY_POINTER;
-    if (!wl_list_empty(&server->keyboards)) {
-        caps |= WL_SEAT_CAPABILITY_KEYBOARD;
-    }
-    wlr_seat_set_capabilities(server->seat, caps);
+    seat_update_capabilities(server);
 }
\ No newline at end of file
@@ -0,0 +1,439 @@
+#define _GNU_SOURCE
+#include "ipc.h"
+#include "server.h"
+#include "output.h"
+#include "toplevel.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+void ipc_buf_append(struct planar_ipc_buf *buf, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int needed = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (needed < 0) {
+        return;
+    }
+
+    if (buf->len + needed + 1 > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 1024;
+        while (cap < buf->len + needed + 1) {
+            cap *= 2;
+        }
+        char *data = realloc(buf->data, cap);
+        if (!data) {
+            return;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+
+    va_start(args, fmt);
+    vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, args);
+    va_end(args);
+    buf->len += needed;
+}
+
+void ipc_buf_append_string(struct planar_ipc_buf *buf, const char *str) {
+    ipc_buf_append(buf, "\"");
+    for (const char *c = str ? str : ""; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            ipc_buf_append(buf, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20) {
+            ipc_buf_append(buf, "\\u%04x", *c);
+        } else {
+            ipc_buf_append(buf, "%c", *c);
+        }
+    }
+    ipc_buf_append(buf, "\"");
+}
+
+void ipc_buf_finish(struct planar_ipc_buf *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+}
+
+static void stats_latency_json(const struct planar_latency_stats *latency,
+        struct planar_ipc_buf *buf) {
+    static const char *stage_names[PLANAR_LATENCY_STAGES] = {
+        [PLANAR_LATENCY_DISPATCH] = "dispatch",
+        [PLANAR_LATENCY_RENDER] = "render",
+        [PLANAR_LATENCY_DISPLAY] = "display",
+        [PLANAR_LATENCY_TOTAL] = "total",
+    };
+    ipc_buf_append(buf, "\"latency_ns\":{\"samples\":%" PRIu64 ",\"expired\":%" PRIu64,
+        latency->samples, latency->expired);
+    for (int stage = 0; stage < PLANAR_LATENCY_STAGES; stage++) {
+        ipc_buf_append(buf, ",\"%s\":{\"p50\":%" PRIu64 ",\"p90\":%" PRIu64 ","
+            "\"p99\":%" PRIu64 "}", stage_names[stage],
+            stats_latency_percentile(latency, stage, 0.50),
+            stats_latency_percentile(latency, stage, 0.90),
+            stats_latency_percentile(latency, stage, 0.99));
+    }
+    ipc_buf_append(buf, "}");
+}
+
+static void stats_outputs_json(struct planar_server *server, struct planar_ipc_buf *buf) {
+    ipc_buf_append(buf, "\"outputs\":[");
+    struct planar_output *output;
+    bool first = true;
+    wl_list_for_each(output, &server->outputs, link) {
+        const struct planar_frame_stats *stats = &output->stats;
+        uint64_t avg = stats->frames ? stats->total_duration_ns / stats->frames : 0;
+
+        ipc_buf_append(buf, "%s{\"name\":", first ? "" : ",");
+        ipc_buf_append_string(buf, output->wlr_output->name);
+        ipc_buf_append(buf, ",\"refresh_mhz\":%d,\"frames\":%" PRIu64 ","
+            "\"presented\":%" PRIu64 ",\"dropped\":%" PRIu64 ",\"frame_ns\":{"
+            "\"last\":%" PRIu64 ",\"avg\":%" PRIu64 ",\"p50\":%" PRIu64 ","
+            "\"p99\":%" PRIu64 ",\"max\":%" PRIu64 "},",
+            output->wlr_output->refresh, stats->frames, stats->presented,
+            stats->dropped, stats->last_duration_ns, avg,
+            stats_frame_percentile(stats, 0.50), stats_frame_percentile(stats, 0.99),
+            stats->max_duration_ns);
+        if (output->render) {
+            const struct planar_frame_stats *render = &output->render_stats;
+            ipc_buf_append(buf, "\"render_ns\":{\"last\":%" PRIu64 ",\"p50\":%" PRIu64 ","
+                "\"p99\":%" PRIu64 ",\"max\":%" PRIu64 "},",
+                render->last_duration_ns, stats_frame_percentile(render, 0.50),
+                stats_frame_percentile(render, 0.99), render->max_duration_ns);
+        }
+        stats_latency_json(&output->latency, buf);
+        ipc_buf_append(buf, "}");
+        first = false;
+    }
+    ipc_buf_append(buf, "]");
+}
+
+static void stats_clients_json(struct planar_server *server, struct planar_ipc_buf *buf) {
+    ipc_buf_append(buf, "\"commit_budget\":%u,\"clients\":[", server->stats.commit_budget);
+    struct planar_client_stats *client;
+    bool first = true;
+    wl_list_for_each(client, &server->stats.clients, link) {
+        ipc_buf_append(buf, "%s{\"pid\":%d,\"commits\":%" PRIu64 ",\"commit_rate\":%.1f,"
+            "\"bytes_uploaded\":%" PRIu64 ",\"upload_rate\":%.0f,\"throttled\":%s,"
+            "\"frames_deferred\":%" PRIu64 ",\"buffer_bytes\":%" PRIu64 ","
+            "\"texture_bytes\":%" PRIu64 "}",
+            first ? "" : ",", (int)client->pid, client->commits, client->commit_rate,
+            client->bytes_uploaded, client->upload_rate, client->throttled ? "true" : "false",
+            client->frames_deferred, client->buffer_bytes, client->texture_bytes);
+        first = false;
+    }
+    ipc_buf_append(buf, "]");
+}
+
+static void stats_slab_json(const char *name, const struct planar_slab *slab,
+        struct planar_ipc_buf *buf) {
+    ipc_buf_append(buf, "\"%s\":{\"live\":%u,\"peak\":%u,\"allocs\":%" PRIu64 ","
+        "\"pages\":%zu,\"bytes\":%zu}", name, slab->live, slab->peak, slab->allocs,
+        slab->n_pages, slab->n_pages * slab->per_page * slab->object_size);
+}
+
+static void stats_textures_json(struct planar_server *server, struct planar_ipc_buf *buf) {
+    const struct planar_budget *budget = &server->budget;
+    ipc_buf_append(buf, "\"textures\":{\"limit\":%" PRIu64 ",\"buffer_bytes\":%" PRIu64 ","
+        "\"texture_bytes\":%" PRIu64 ",\"suspended\":%u,\"toplevels\":[",
+        budget->limit, budget->buffer_bytes, budget->texture_bytes, budget->suspended);
+    struct planar_toplevel *toplevel;
+    bool first = true;
+    wl_list_for_each(toplevel, &server->toplevels, link) {
+        const char *app_id = toplevel->xdg_toplevel->app_id;
+        ipc_buf_append(buf, "%s{\"app_id\":", first ? "" : ",");
+        ipc_buf_append_string(buf, app_id ? app_id : "");
+        ipc_buf_append(buf, ",\"pid\":%d,\"buffer_bytes\":%" PRIu64 ","
+            "\"texture_bytes\":%" PRIu64 ",\"suspended\":%s}",
+            toplevel->client_stats ? (int)toplevel->client_stats->pid : 0,
+            toplevel->buffer_bytes, toplevel->texture_bytes,
+            toplevel->suspended ? "true" : "false");
+        first = false;
+    }
+    ipc_buf_append(buf, "]}");
+}
+
+static void stats_uploads_json(struct planar_server *server, struct planar_ipc_buf *buf) {
+    const struct planar_upload_pool *pool = server->uploads;
+    if (!pool) {
+        ipc_buf_append(buf, "\"uploads\":null");
+        return;
+    }
+    ipc_buf_append(buf, "\"uploads\":{\"workers\":%d,\"async\":%" PRIu64 ","
+        "\"sync\":%" PRIu64 ",\"skipped\":%" PRIu64 ",\"bytes\":%" PRIu64 "}",
+        pool->n_threads, pool->async_uploads, pool->sync_uploads, pool->skipped, pool->bytes);
+}
+
+static void stats_memory_json(struct planar_server *server, struct planar_ipc_buf *buf) {
+    const struct planar_object_stats *objects = &server->stats.objects;
+    struct mallinfo2 heap = mallinfo2();
+    ipc_buf_append(buf, "\"memory\":{\"toplevels\":%u,\"popups\":%u,"
+        "\"layer_surfaces\":%u,\"keyboards\":%u,\"outputs\":%u,"
+        "\"heap_in_use\":%zu,\"heap_mapped\":%zu,\"slabs\":{",
+        objects->toplevels.live, objects->popups.live, objects->layer_surfaces.live,
+        objects->keyboards.live, objects->outputs.live, heap.uordblks, heap.hblkhd);
+    stats_slab_json("toplevels", &objects->toplevels, buf);
+    ipc_buf_append(buf, ",");
+    stats_slab_json("popups", &objects->popups, buf);
+    ipc_buf_append(buf, ",");
+    stats_slab_json("layer_surfaces", &objects->layer_surfaces, buf);
+    ipc_buf_append(buf, ",");
+    stats_slab_json("keyboards", &objects->keyboards, buf);
+    ipc_buf_append(buf, ",");
+    stats_slab_json("outputs", &objects->outputs, buf);
+    ipc_buf_append(buf, "}}");
+}
+
+void ipc_stats_json(struct planar_server *server, struct planar_ipc_buf *buf) {
+    struct wlr_box layout_box;
+    wlr_output_layout_get_box(server->output_layout, NULL, &layout_box);
+
+    ipc_buf_append(buf, "{\"time_ns\":%" PRIu64 ",\"toplevels\":%d,", stats_now_ns(),
+        wl_list_length(&server->toplevels));
+    ipc_buf_append(buf, "\"viewport\":{\"x\":%.1f,\"y\":%.1f,\"width\":%d,\"height\":%d},",
+        -server->global_offset.x, -server->global_offset.y,
+        layout_box.width, layout_box.height);
+    stats_outputs_json(server, buf);
+    ipc_buf_append(buf, ",");
+    stats_clients_json(server, buf);
+    ipc_buf_append(buf, ",");
+    stats_memory_json(server, buf);
+    ipc_buf_append(buf, ",");
+    stats_textures_json(server, buf);
+    ipc_buf_append(buf, ",");
+    stats_uploads_json(server, buf);
+    ipc_buf_append(buf, "}\n");
+}
+
+static void ipc_client_destroy(struct planar_ipc_client *client) {
+    wl_event_source_remove(client->source);
+    close(client->fd);
+    wl_list_remove(&client->link);
+    ipc_buf_finish(&client->write_buf);
+    free(client);
+}
+
+static bool ipc_client_flush(struct planar_ipc_client *client) {
+    struct planar_ipc_buf *buf = &client->write_buf;
+    while (buf->len > 0) {
+        /* A subscriber gone before its hangup is dispatched gets EPIPE,
+         * not a SIGPIPE that takes the compositor down. */
+        ssize_t written = send(client->fd, buf->data, buf->len, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                break;
+            }
+            return false;
+        }
+        memmove(buf->data, buf->data + written, buf->len - written);
+        buf->len -= written;
+    }
+
+    uint32_t mask = WL_EVENT_READABLE;
+    if (buf->len > 0) {
+        mask |= WL_EVENT_WRITABLE;
+    }
+    wl_event_source_fd_update(client->source, mask);
+    return true;
+}
+
+static bool ipc_client_send(struct planar_ipc_client *client, const char *data, size_t len) {
+    if (client->write_buf.len + len > PLANAR_IPC_MAX_PENDING) {
+        /* The consumer is not keeping up, drop it rather than grow forever. */
+        wlr_log(WLR_ERROR, "IPC client %d is too slow, disconnecting", client->fd);
+        return false;
+    }
+    ipc_buf_append(&client->write_buf, "%.*s", (int)len, data);
+    return ipc_client_flush(client);
+}
+
+static bool ipc_client_handle_command(struct planar_ipc_client *client, const char *cmd) {
+    struct planar_server *server = client->server;
+    struct planar_ipc_buf reply = {0};
+
+    if (strcmp(cmd, "stats") == 0) {
+        ipc_stats_json(server, &reply);
+    } else if (strcmp(cmd, "subscribe") == 0) {
+        client->subscribed = true;
+        ipc_stats_json(server, &reply);
+    } else if (strcmp(cmd, "unsubscribe") == 0) {
+        client->subscribed = false;
+        ipc_buf_append(&reply, "{\"success\":true}\n");
+    } else if (strcmp(cmd, "trace") == 0) {
+        /* Traces are far larger than a reply may be, hand out a file. */
+        char path[256];
+        trace_default_path(path, sizeof(path));
+        ipc_buf_append(&reply, "{\"success\":%s,\"path\":",
+            trace_dump(path) ? "true" : "false");
+        ipc_buf_append_string(&reply, path);
+        ipc_buf_append(&reply, "}\n");
+    } else {
+        ipc_buf_append(&reply, "{\"error\":\"unknown command\",\"command\":");
+        ipc_buf_append_string(&reply, cmd);
+        ipc_buf_append(&reply, "}\n");
+    }
+
+    bool ok = ipc_client_send(client, reply.data, reply.len);
+    ipc_buf_finish(&reply);
+    return ok;
+}
+
+static bool ipc_client_read(struct planar_ipc_client *client) {
+    ssize_t n = read(client->fd, client->read_buf + client->read_len,
+        sizeof(client->read_buf) - client->read_len - 1);
+    if (n <= 0) {
+        return n < 0 && (errno == EAGAIN || errno == EINTR);
+    }
+    client->read_len += n;
+    client->read_buf[client->read_len] = '\0';
+
+    char *line = client->read_buf;
+    char *newline;
+    while ((newline = strchr(line, '\n')) != NULL) {
+        *newline = '\0';
+        if (newline > line && newline[-1] == '\r') {
+            newline[-1] = '\0';
+        }
+        if (*line != '\0' && !ipc_client_handle_command(client, line)) {
+            return false;
+        }
+        line = newline + 1;
+    }
+
+    size_t remaining = client->read_len - (line - client->read_buf);
+    if (remaining == sizeof(client->read_buf) - 1) {
+        /* A command that doesn't fit in the buffer is never valid. */
+        return false;
+    }
+    memmove(client->read_buf, line, remaining);
+    client->read_len = remaining;
+    return true;
+}
+
+static int ipc_client_handle_event(int fd, uint32_t mask, void *data) {
+    struct planar_ipc_client *client = data;
+
+    if (mask & (WL_EVENT_ERROR | WL_EVENT_HANGUP)) {
+        ipc_client_destroy(client);
+        return 0;
+    }
+    if ((mask & WL_EVENT_READABLE) && !ipc_client_read(client)) {
+        ipc_client_destroy(client);
+        return 0;
+    }
+    if ((mask & WL_EVENT_WRITABLE) && !ipc_client_flush(client)) {
+        ipc_client_destroy(client);
+        return 0;
+    }
+    return 0;
+}
+
+static int ipc_handle_connection(int fd, uint32_t mask, void *data) {
+    struct planar_server *server = data;
+
+    int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) {
+        wlr_log_errno(WLR_ERROR, "Unable to accept IPC connection");
+        return 0;
+    }
+
+    struct planar_ipc_client *client = calloc(1, sizeof(*client));
+    if (!client) {
+        close(client_fd);
+        return 0;
+    }
+    client->server = server;
+    client->fd = client_fd;
+    client->source = wl_event_loop_add_fd(wl_display_get_event_loop(server->wl_display),
+        client_fd, WL_EVENT_READABLE, ipc_client_handle_event, client);
+    if (!client->source) {
+        close(client_fd);
+        free(client);
+        return 0;
+    }
+
+    wl_list_insert(&server->ipc.clients, &client->link);
+    return 0;
+}
+
+void ipc_broadcast_stats(struct planar_server *server) {
+    struct planar_ipc_buf snapshot = {0};
+    struct planar_ipc_client *client, *tmp;
+    wl_list_for_each_safe(client, tmp, &server->ipc.clients, link) {
+        if (!client->subscribed) {
+            continue;
+        }
+        if (snapshot.len == 0) {
+            ipc_stats_json(server, &snapshot);
+        }
+        if (!ipc_client_send(client, snapshot.data, snapshot.len)) {
+            ipc_client_destroy(client);
+        }
+    }
+    ipc_buf_finish(&snapshot);
+}
+
+bool ipc_init(struct planar_server *server) {
+    wl_list_init(&server->ipc.clients);
+    server->ipc.fd = -1;
+
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (!runtime_dir) {
+        wlr_log(WLR_ERROR, "XDG_RUNTIME_DIR is not set, IPC disabled");
+        return false;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int len = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/planar-ipc.%s.sock",
+        runtime_dir, server->socket);
+    if (len < 0 || (size_t)len >= sizeof(addr.sun_path)) {
+        wlr_log(WLR_ERROR, "IPC socket path too long, IPC disabled");
+        return false;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        wlr_log_errno(WLR_ERROR, "Unable to create IPC socket");
+        return false;
+    }
+
+    unlink(addr.sun_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        wlr_log_errno(WLR_ERROR, "Unable to bind IPC socket %s", addr.sun_path);
+        close(fd);
+        return false;
+    }
+
+    server->ipc.fd = fd;
+    memcpy(server->ipc.path, addr.sun_path, sizeof(server->ipc.path));
+    server->ipc.source = wl_event_loop_add_fd(wl_display_get_event_loop(server->wl_display),
+        fd, WL_EVENT_READABLE, ipc_handle_connection, server);
+
+    wlr_log(WLR_INFO, "IPC listening on %s", server->ipc.path);
+    return true;
+}
+
+void ipc_finish(struct planar_server *server) {
+    struct planar_ipc_client *client, *tmp;
+    wl_list_for_each_safe(client, tmp, &server->ipc.clients, link) {
+        ipc_client_destroy(client);
+    }
+
+    if (server->ipc.fd < 0) {
+        return;
+    }
+    wl_event_source_remove(server->ipc.source);
+    close(server->ipc.fd);
+    unlink(server->ipc.path);
+    server->ipc.fd = -1;
+}
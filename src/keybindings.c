@@ -0,0 +1,411 @@
+#define _GNU_SOURCE
+#include "keybindings.h"
+#include "server.h"
+#include "output.h"
+#include "toplevel.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/util/log.h>
+
+#define KEY_REPEAT_DELAY 400
+#define KEY_REPEAT_RATE 40
+
+#define ZOOM_STEP 1.25
+
+/* Lock modifiers never take part in matching. */
+#define KEYBINDING_IGNORED_MODIFIERS (WLR_MODIFIER_CAPS | WLR_MODIFIER_MOD2)
+
+static const struct planar_keybinding default_bindings[] = {
+    { WLR_MODIFIER_ALT, XKB_KEY_Escape, false, false, { PLANAR_ACTION_QUIT } },
+    { WLR_MODIFIER_ALT, XKB_KEY_F1, false, false, { PLANAR_ACTION_FOCUS_NEXT } },
+    { WLR_MODIFIER_ALT, XKB_KEY_Left, false, true, { PLANAR_ACTION_PAN, 10, 0 } },
+    { WLR_MODIFIER_ALT, XKB_KEY_Right, false, true, { PLANAR_ACTION_PAN, -10, 0 } },
+    { WLR_MODIFIER_ALT, XKB_KEY_Up, false, true, { PLANAR_ACTION_PAN, 0, 10 } },
+    { WLR_MODIFIER_ALT, XKB_KEY_Down, false, true, { PLANAR_ACTION_PAN, 0, -10 } },
+};
+
+static const struct {
+    const char *name;
+    uint32_t mask;
+} modifier_names[] = {
+    { "Shift", WLR_MODIFIER_SHIFT },
+    { "Ctrl", WLR_MODIFIER_CTRL },
+    { "Control", WLR_MODIFIER_CTRL },
+    { "Alt", WLR_MODIFIER_ALT },
+    { "Mod1", WLR_MODIFIER_ALT },
+    { "Mod3", WLR_MODIFIER_MOD3 },
+    { "Logo", WLR_MODIFIER_LOGO },
+    { "Super", WLR_MODIFIER_LOGO },
+    { "Mod4", WLR_MODIFIER_LOGO },
+    { "Mod5", WLR_MODIFIER_MOD5 },
+};
+
+static uint64_t keybinding_key(uint32_t modifiers, xkb_keysym_t sym, bool release) {
+    return (uint64_t)modifiers << 33 | (uint64_t)release << 32 | sym;
+}
+
+static size_t keybinding_slot(const struct planar_keybindings *keybindings, uint64_t key) {
+    /* Fibonacci hashing, the table size is a power of two. */
+    return (key * 0x9e3779b97f4a7c15ull >> 32) & keybindings->table_mask;
+}
+
+static void keybindings_build_table(struct planar_keybindings *keybindings) {
+    size_t size = 16;
+    while (size < keybindings->n_bindings * 2) {
+        size *= 2;
+    }
+    free(keybindings->table);
+    keybindings->table = malloc(size * sizeof(*keybindings->table));
+    keybindings->table_mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        keybindings->table[i] = -1;
+    }
+
+    for (size_t i = 0; i < keybindings->n_bindings; i++) {
+        const struct planar_keybinding *binding = &keybindings->bindings[i];
+        uint64_t key = keybinding_key(binding->modifiers, binding->sym, binding->release);
+        size_t slot = keybinding_slot(keybindings, key);
+        while (keybindings->table[slot] >= 0) {
+            const struct planar_keybinding *other = &keybindings->bindings[keybindings->table[slot]];
+            if (keybinding_key(other->modifiers, other->sym, other->release) == key) {
+                /* Later bindings override earlier ones. */
+                break;
+            }
+            slot = (slot + 1) & keybindings->table_mask;
+        }
+        keybindings->table[slot] = i;
+    }
+}
+
+static const struct planar_keybinding *keybindings_find(
+        const struct planar_keybindings *keybindings, uint32_t modifiers,
+        xkb_keysym_t sym, bool release) {
+    uint64_t key = keybinding_key(modifiers, sym, release);
+    size_t slot = keybinding_slot(keybindings, key);
+    while (keybindings->table[slot] >= 0) {
+        const struct planar_keybinding *binding = &keybindings->bindings[keybindings->table[slot]];
+        if (keybinding_key(binding->modifiers, binding->sym, binding->release) == key) {
+            return binding;
+        }
+        slot = (slot + 1) & keybindings->table_mask;
+    }
+    return NULL;
+}
+
+static const struct planar_keybinding *keybindings_lookup(
+        const struct planar_keybindings *keybindings, uint32_t modifiers,
+        xkb_keysym_t sym, bool release) {
+    /* Bindings are parsed to the lowercase keysym while Shift gives the
+     * uppercase one, so Shift+a has to match on the unshifted sym. */
+    const struct planar_keybinding *binding =
+        keybindings_find(keybindings, modifiers, sym, release);
+    xkb_keysym_t lower = xkb_keysym_to_lower(sym);
+    if (!binding && lower != sym) {
+        binding = keybindings_find(keybindings, modifiers, lower, release);
+    }
+    return binding;
+}
+
+static void action_jump_focused(struct planar_server *server) {
+    /* Center the viewport on the most recently focused toplevel. */
+    if (wl_list_empty(&server->focus_stack)) {
+        return;
+    }
+    struct planar_toplevel *toplevel =
+        wl_container_of(server->focus_stack.next, toplevel, focus_link);
+    toplevel_center_offset(toplevel, &server->global_offset.x, &server->global_offset.y);
+}
+
+static void keybinding_run(struct planar_server *server, const struct planar_action *action) {
+    switch (action->type) {
+    case PLANAR_ACTION_QUIT:
+        wl_display_terminate(server->wl_display);
+        return;
+    case PLANAR_ACTION_PAN:
+        server->global_offset.x += action->x;
+        server->global_offset.y += action->y;
+        break;
+    case PLANAR_ACTION_FOCUS_NEXT:
+    case PLANAR_ACTION_FOCUS_PREV:
+        focus_cycle(server, action->type == PLANAR_ACTION_FOCUS_NEXT);
+        break;
+    case PLANAR_ACTION_ZOOM:
+        output_zoom(server, action->x);
+        break;
+    case PLANAR_ACTION_ZOOM_RESET:
+        output_zoom_reset(server);
+        break;
+    case PLANAR_ACTION_JUMP:
+        /* Put the canvas position at the top left corner of the layout. */
+        server->global_offset.x = -action->x;
+        server->global_offset.y = -action->y;
+        break;
+    case PLANAR_ACTION_JUMP_FOCUSED:
+        action_jump_focused(server);
+        break;
+    }
+    output_schedule_frames(server);
+}
+
+static int keybindings_repeat(void *data) {
+    struct planar_server *server = data;
+    struct planar_keybindings *keybindings = &server->keybindings;
+    for (size_t i = 0; i < keybindings->n_held; i++) {
+        keybinding_run(server, &keybindings->held[i]->action);
+    }
+    wl_event_source_timer_update(keybindings->repeat_source,
+        keybindings->n_held ? KEY_REPEAT_RATE : 0);
+    return 0;
+}
+
+static void keybindings_hold(struct planar_keybindings *keybindings,
+        const struct planar_keybinding *binding) {
+    for (size_t i = 0; i < keybindings->n_held; i++) {
+        if (keybindings->held[i] == binding) {
+            return;
+        }
+    }
+    if (keybindings->n_held == PLANAR_KEYBINDINGS_MAX_HELD) {
+        return;
+    }
+    keybindings->held[keybindings->n_held++] = binding;
+    if (keybindings->n_held == 1) {
+        wl_event_source_timer_update(keybindings->repeat_source, KEY_REPEAT_DELAY);
+    }
+}
+
+static void keybindings_release(struct planar_keybindings *keybindings, xkb_keysym_t sym) {
+    /* Held bindings stop on the key's release whatever the modifiers are by
+     * then, so letting go of Alt first doesn't leave a pan running. */
+    xkb_keysym_t lower = xkb_keysym_to_lower(sym);
+    size_t n = 0;
+    for (size_t i = 0; i < keybindings->n_held; i++) {
+        if (keybindings->held[i]->sym != sym && keybindings->held[i]->sym != lower) {
+            keybindings->held[n++] = keybindings->held[i];
+        }
+    }
+    keybindings->n_held = n;
+}
+
+bool keybindings_handle_key(struct planar_server *server, uint32_t modifiers,
+        const xkb_keysym_t *syms, int nsyms, bool pressed) {
+    struct planar_keybindings *keybindings = &server->keybindings;
+    modifiers &= ~KEYBINDING_IGNORED_MODIFIERS;
+
+    bool handled = false;
+    for (int i = 0; i < nsyms; i++) {
+        if (!pressed) {
+            keybindings_release(keybindings, syms[i]);
+        }
+        const struct planar_keybinding *binding =
+            keybindings_lookup(keybindings, modifiers, syms[i], !pressed);
+        if (!binding) {
+            /* A release binding takes the press too, or the client would
+             * see the key go down and never come back up. */
+            if (pressed && keybindings_lookup(keybindings, modifiers, syms[i], true)) {
+                handled = true;
+            }
+            continue;
+        }
+        keybinding_run(server, &binding->action);
+        if (binding->repeat && pressed) {
+            keybindings_hold(keybindings, binding);
+        }
+        handled = true;
+    }
+    return handled;
+}
+
+static bool parse_keys(char *keys, struct planar_keybinding *binding) {
+    /* Mod+Mod+Keysym, the keysym always comes last. */
+    char *saveptr = NULL;
+    char *name = strtok_r(keys, "+", &saveptr);
+    while (name) {
+        char *next = strtok_r(NULL, "+", &saveptr);
+        if (!next) {
+            binding->sym = xkb_keysym_from_name(name, XKB_KEYSYM_CASE_INSENSITIVE);
+            return binding->sym != XKB_KEY_NoSymbol;
+        }
+        size_t i = 0;
+        size_t n_names = sizeof(modifier_names) / sizeof(modifier_names[0]);
+        while (i < n_names && strcasecmp(name, modifier_names[i].name) != 0) {
+            i++;
+        }
+        if (i == n_names) {
+            return false;
+        }
+        binding->modifiers |= modifier_names[i].mask;
+        name = next;
+    }
+    return false;
+}
+
+static bool parse_action(char *args[], int n_args, struct planar_action *action) {
+    if (n_args < 1) {
+        return false;
+    }
+    const char *name = args[0];
+    if (strcmp(name, "quit") == 0 && n_args == 1) {
+        action->type = PLANAR_ACTION_QUIT;
+    } else if (strcmp(name, "pan") == 0 && n_args == 3) {
+        action->type = PLANAR_ACTION_PAN;
+        action->x = atof(args[1]);
+        action->y = atof(args[2]);
+    } else if (strcmp(name, "focus") == 0 && n_args == 2 && strcmp(args[1], "next") == 0) {
+        action->type = PLANAR_ACTION_FOCUS_NEXT;
+    } else if (strcmp(name, "focus") == 0 && n_args == 2 && strcmp(args[1], "prev") == 0) {
+        action->type = PLANAR_ACTION_FOCUS_PREV;
+    } else if (strcmp(name, "zoom") == 0 && n_args == 2) {
+        if (strcmp(args[1], "in") == 0) {
+            action->type = PLANAR_ACTION_ZOOM;
+            action->x = ZOOM_STEP;
+        } else if (strcmp(args[1], "out") == 0) {
+            action->type = PLANAR_ACTION_ZOOM;
+            action->x = 1 / ZOOM_STEP;
+        } else if (strcmp(args[1], "reset") == 0) {
+            action->type = PLANAR_ACTION_ZOOM_RESET;
+        } else {
+            return false;
+        }
+    } else if (strcmp(name, "jump") == 0 && n_args == 2 && strcmp(args[1], "focused") == 0) {
+        action->type = PLANAR_ACTION_JUMP_FOCUSED;
+    } else if (strcmp(name, "jump") == 0 && n_args == 3) {
+        action->type = PLANAR_ACTION_JUMP;
+        action->x = atof(args[1]);
+        action->y = atof(args[2]);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_binding(char *line, struct planar_keybinding *binding) {
+    /* bind [--release] [--repeat] Mod+Keysym action [args...] */
+    char *args[8];
+    int n_args = 0;
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(line, " \t", &saveptr); tok && n_args < 8;
+            tok = strtok_r(NULL, " \t", &saveptr)) {
+        args[n_args++] = tok;
+    }
+
+    int i = 1;
+    if (n_args < 3 || strcmp(args[0], "bind") != 0) {
+        return false;
+    }
+    for (; i < n_args && strncmp(args[i], "--", 2) == 0; i++) {
+        if (strcmp(args[i], "--release") == 0) {
+            binding->release = true;
+        } else if (strcmp(args[i], "--repeat") == 0) {
+            binding->repeat = true;
+        } else {
+            return false;
+        }
+    }
+    if (i >= n_args || !parse_keys(args[i], binding)) {
+        return false;
+    }
+    return parse_action(&args[i + 1], n_args - i - 1, &binding->action);
+}
+
+bool keybindings_load(struct planar_server *server, const char *path) {
+    char default_path[4096];
+    bool optional = !path;
+    if (!path) {
+        const char *config = getenv("XDG_CONFIG_HOME");
+        const char *home = getenv("HOME");
+        if (config) {
+            snprintf(default_path, sizeof(default_path), "%s/planar/keybindings", config);
+        } else if (home) {
+            snprintf(default_path, sizeof(default_path), "%s/.config/planar/keybindings", home);
+        } else {
+            return true;
+        }
+        path = default_path;
+    }
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        if (optional && errno == ENOENT) {
+            return true;
+        }
+        wlr_log_errno(WLR_ERROR, "Unable to open keybindings %s", path);
+        return false;
+    }
+
+    struct planar_keybinding *bindings = NULL;
+    size_t n_bindings = 0, cap = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_no = 0;
+    while (getline(&line, &line_size, file) >= 0) {
+        line_no++;
+        char *start = line;
+        while (isspace((unsigned char)*start)) {
+            start++;
+        }
+        start[strcspn(start, "#\n")] = '\0';
+        if (*start == '\0') {
+            continue;
+        }
+
+        struct planar_keybinding binding = {0};
+        if (!parse_binding(start, &binding)) {
+            wlr_log(WLR_ERROR, "%s:%d: invalid keybinding, ignoring it", path, line_no);
+            continue;
+        }
+        if (n_bindings == cap) {
+            size_t new_cap = cap ? cap * 2 : 16;
+            struct planar_keybinding *new_bindings =
+                realloc(bindings, new_cap * sizeof(*bindings));
+            if (!new_bindings) {
+                wlr_log(WLR_ERROR, "Unable to allocate keybindings for %s", path);
+                free(bindings);
+                free(line);
+                fclose(file);
+                return false;
+            }
+            bindings = new_bindings;
+            cap = new_cap;
+        }
+        bindings[n_bindings++] = binding;
+    }
+    free(line);
+    fclose(file);
+
+    struct planar_keybindings *keybindings = &server->keybindings;
+    free(keybindings->bindings);
+    keybindings->bindings = bindings;
+    keybindings->n_bindings = n_bindings;
+    keybindings->n_held = 0;
+    keybindings_build_table(keybindings);
+    wlr_log(WLR_INFO, "Loaded %zu keybindings from %s", n_bindings, path);
+    return true;
+}
+
+void keybindings_init(struct planar_server *server) {
+    struct planar_keybindings *keybindings = &server->keybindings;
+    keybindings->n_bindings = sizeof(default_bindings) / sizeof(default_bindings[0]);
+    keybindings->bindings = malloc(sizeof(default_bindings));
+    memcpy(keybindings->bindings, default_bindings, sizeof(default_bindings));
+    keybindings_build_table(keybindings);
+
+    keybindings->repeat_source = wl_event_loop_add_timer(
+        wl_display_get_event_loop(server->wl_display), keybindings_repeat, server);
+}
+
+void keybindings_finish(struct planar_server *server) {
+    struct planar_keybindings *keybindings = &server->keybindings;
+    if (keybindings->repeat_source) {
+        wl_event_source_remove(keybindings->repeat_source);
+    }
+    free(keybindings->bindings);
+    free(keybindings->table);
+    *keybindings = (struct planar_keybindings){0};
+}
@@ -11,6 +11,7 @@
 #include "popup.h"
 
 void arrange_layers(struct planar_output *output) {
+    TRACE_SCOPE("arrange_layers");
     struct wlr_box usable_area;
     wlr_output_effective_resolution(output->wlr_output, &usable_area.width, &usable_area.height);
     usable_area.x = usable_area.y = 0;
@@ -89,7 +90,7 @@ void server_layer_shell_surface(struct wl_listener *listener, void *data) {
     }
 
     // Create and initialize your planar_layer_surface
-    struct planar_layer_surface *planar_layer_surface = calloc(1, sizeof(struct planar_layer_surface));
+    struct planar_layer_surface *planar_layer_surface = slab_alloc(&server->stats.objects.layer_surfaces);
     if (!planar_layer_surface) {
         free(layer_surface);
         return;
@@ -99,6 +100,8 @@ void server_layer_shell_surface(struct wl_listener *listener, void *data) {
     planar_layer_surface->scene_layer_surface = scene_layer_surface;
     planar_layer_surface->layer_surface = layer_surface;
     planar_layer_surface->output = output;
+    planar_layer_surface->client_stats = stats_client_get(server,
+        wl_resource_get_client(layer_surface->resource));
 
     scene_layer_surface->tree->node.data = planar_layer_surface;
 
@@ -144,12 +147,15 @@ void server_layer_shell_surface_destroy(struct wl_listener *listener, void *data
     wl_list_remove(&layer_surface->surface_destroy.link);
     wl_list_remove(&layer_surface->surface_commit.link);
 
-    free(layer_surface);
+    slab_free(&layer_surface->server->stats.objects.layer_surfaces, layer_surface);
 }
 
 void server_layer_shell_surface_commit(struct wl_listener *listener, void *data) {
+    TRACE_SCOPE("layer_surface_commit");
     struct planar_layer_surface *planar_layer_surface = wl_container_of(listener, planar_layer_surface, surface_commit);
     struct planar_server *server = planar_layer_surface->server;
+    stats_client_commit(planar_layer_surface->client_stats,
+        planar_layer_surface->layer_surface->surface);
 
     struct wlr_layer_surface_v1 *layer_surface = planar_layer_surface->layer_surface;
 	if (!layer_surface->initialized) {
@@ -181,6 +187,7 @@ void server_layer_shell_surface_commit(struct wl_listener *listener, void *data)
 
 struct planar_layer_surface *layer_surface_at(struct planar_server *server, double lx, double ly,
                                             struct wlr_surface **surface, double *sx, double *sy) {
+    TRACE_SCOPE("layer_surface_at");
     struct wlr_scene_node *node = wlr_scene_node_at(&server->scene->tree.node, lx, ly, sx, sy);
     if (node == NULL || node->type != WLR_SCENE_NODE_BUFFER) {
         return NULL;
@@ -210,6 +217,7 @@ void focus_layer_surface(struct planar_layer_surface *layer_surface, struct wlr_
         wlr_seat_keyboard_notify_enter(seat, surface, keyboard->keycodes,
                                        keyboard->num_keycodes, &keyboard->modifiers);
     }
+    pointer_constraints_update(layer_surface->server);
 }
 
 static struct wlr_scene_tree *planar_layer_get_scene(struct planar_output *output,
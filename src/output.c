@@ -1,6 +1,10 @@
 #include "output.h"
+#include "cursor.h"
 #include "layers.h"
+#include "render.h"
 #include "toplevel.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <wlr/types/wlr_layer_shell_v1.h>
 #include <math.h>
@@ -8,40 +12,184 @@
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_scene.h>
 
+#define OUTPUT_ZOOM_MIN 0.25
+#define OUTPUT_ZOOM_MAX 4.0
+#define OUTPUT_PAN_ANIMATION_MS 200
+
+static void output_pan_step(struct planar_server *server) {
+    if (!server->pan_animation.active) {
+        return;
+    }
+    double t = (stats_now_ns() - server->pan_animation.start_ns) /
+        (OUTPUT_PAN_ANIMATION_MS * 1e6);
+    if (t >= 1.0) {
+        t = 1.0;
+        server->pan_animation.active = false;
+    }
+    /* Ease out: quick start, gentle arrival. */
+    double progress = 1.0 - pow(1.0 - t, 3);
+    double step = progress - server->pan_animation.progress;
+    server->pan_animation.progress = progress;
+    server->global_offset.x += server->pan_animation.dx * step;
+    server->global_offset.y += server->pan_animation.dy * step;
+    if (server->pan_animation.active) {
+        output_schedule_frames(server);
+    }
+}
+
+struct output_frame_done {
+    struct planar_output *output;
+    struct wlr_scene_output *scene_output;
+    struct timespec when;
+    uint64_t now_ns;
+    bool deferred;
+};
+
+static void output_frame_done_iter(struct wlr_scene_buffer *buffer, int sx, int sy,
+        void *data) {
+    struct output_frame_done *done = data;
+    if (buffer->primary_output != done->scene_output) {
+        return;
+    }
+    struct wlr_scene_surface *scene_surface = wlr_scene_surface_try_from_buffer(buffer);
+    if (scene_surface && !stats_client_frame_allowed(done->output->server,
+            scene_surface->surface, done->now_ns)) {
+        done->deferred = true;
+        return;
+    }
+    wlr_scene_buffer_send_frame_done(buffer, &done->when);
+}
+
+static void output_send_frame_done(struct planar_output *output,
+        struct wlr_scene_output *scene_output, const struct timespec *now) {
+    if (output->server->stats.throttled_clients == 0) {
+        wlr_scene_output_send_frame_done(scene_output, now);
+        return;
+    }
+    /* Someone is over the commit budget, go surface by surface. */
+    struct output_frame_done done = {
+        .output = output,
+        .scene_output = scene_output,
+        .when = *now,
+        .now_ns = stats_timespec_to_ns(now),
+    };
+    wlr_scene_output_for_each_buffer(scene_output, output_frame_done_iter, &done);
+    if (done.deferred) {
+        /* Nothing else may damage the output, come back for them. */
+        wlr_output_schedule_frame(output->wlr_output);
+    }
+}
+
 void output_frame(struct wl_listener *listener, void *data) {
     /* This function is called every time an output is ready to display a frame,
      * generally at the output's refresh rate (e.g. 60Hz). */
+    TRACE_SCOPE("output_frame");
     struct planar_output *output = wl_container_of(listener, output, frame);
     struct planar_server *server = output->server;
+    uint64_t frame_start = stats_now_ns();
+    output_pan_step(server);
+    gestures_frame(server);
+    tablet_frame(server);
     struct wlr_scene *scene = server->scene;
     struct wlr_scene_output *scene_output = wlr_scene_get_scene_output(
         scene, output->wlr_output);
 
-    // Apply the global offset to the scene output
-    struct planar_toplevel *toplevel;
-    wl_list_for_each(toplevel, &server->toplevels, link) {
-        // Adjust the position by global_offset
-        wlr_scene_node_set_position(&toplevel->scene_tree->node,
-                                    toplevel->scene_tree->node.x + round(server->global_offset.x),
-                                    toplevel->scene_tree->node.y + round(server->global_offset.y));
-    }
+    /* Move the canvas to the current global offset. This is a no-op unless
+     * the view was panned since the last frame. */
+    wlr_scene_node_set_position(&server->canvas->node,
+        round(server->global_offset.x), round(server->global_offset.y));
 
     arrange_layers(output);
+    budget_frame(server);
 
-    /* Render the scene if needed and commit the output */
-    wlr_scene_output_commit(scene_output, NULL);
+    /* Render the scene if needed and commit the output. With a render
+     * thread the commit and everything after it happen once it's drawn. */
+    bool needs_frame = wlr_scene_output_needs_frame(scene_output);
+    if (!needs_frame || !output->render ||
+            !render_frame(output->render, scene_output, frame_start)) {
+        TRACE_BEGIN(commit, "scene_commit");
+        bool committed = wlr_scene_output_commit(scene_output, NULL);
+        TRACE_END(commit);
+        output_frame_committed(output, frame_start, needs_frame && committed);
+    }
+
+    stats_frame_record(&output->stats, stats_now_ns() - frame_start);
+}
+
+void output_frame_committed(struct planar_output *output, uint64_t frame_start_ns,
+        bool rendered) {
+    /* Only a frame that actually renders something can show the inputs
+     * waiting on it. */
+    if (rendered) {
+        stats_latency_commit(&output->latency, output->wlr_output->commit_seq);
+    }
 
     struct timespec now;
     clock_gettime(CLOCK_MONOTONIC, &now);
+    struct wlr_scene_output *scene_output = wlr_scene_get_scene_output(
+        output->server->scene, output->wlr_output);
+    output_send_frame_done(output, scene_output, &now);
+    /* After the frame callbacks, so released commits get theirs once
+     * they've actually been shown. */
+    commit_queue_frame(output->server, output->wlr_output, frame_start_ns);
+}
 
-        wl_list_for_each(toplevel, &server->toplevels, link) {
-    // Reset the position back to original
-    wlr_scene_node_set_position(&toplevel->scene_tree->node,
-                                toplevel->scene_tree->node.x - round(server->global_offset.x),
-                                toplevel->scene_tree->node.y - round(server->global_offset.y));
+void output_schedule_frames(struct planar_server *server) {
+    struct planar_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        wlr_output_schedule_frame(output->wlr_output);
+    }
 }
 
-    wlr_scene_output_send_frame_done(scene_output, &now);
+void output_pan_to(struct planar_server *server, double x, double y) {
+    /* Starting over from wherever a running animation got to. */
+    server->pan_animation.active = true;
+    server->pan_animation.dx = x - server->global_offset.x;
+    server->pan_animation.dy = y - server->global_offset.y;
+    server->pan_animation.progress = 0;
+    server->pan_animation.start_ns = stats_now_ns();
+    output_schedule_frames(server);
+}
+
+static void output_set_scale(struct planar_output *output, double scale) {
+    /* Zooming changes the output scale, so clients re-render at the new
+     * density instead of the compositor scaling their buffers. */
+    scale = scale < OUTPUT_ZOOM_MIN ? OUTPUT_ZOOM_MIN :
+        scale > OUTPUT_ZOOM_MAX ? OUTPUT_ZOOM_MAX : scale;
+    if (scale == output->wlr_output->scale) {
+        return;
+    }
+    struct wlr_output_state state;
+    wlr_output_state_init(&state);
+    wlr_output_state_set_scale(&state, scale);
+    wlr_output_commit_state(output->wlr_output, &state);
+    wlr_output_state_finish(&state);
+    arrange_layers(output);
+}
+
+void output_zoom(struct planar_server *server, double factor) {
+    struct planar_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        output_set_scale(output, output->wlr_output->scale * factor);
+    }
+}
+
+void output_zoom_reset(struct planar_server *server) {
+    struct planar_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        output_set_scale(output, 1.0);
+    }
+}
+
+void output_present(struct wl_listener *listener, void *data) {
+    struct planar_output *output = wl_container_of(listener, output, present);
+    const struct wlr_output_event_present *event = data;
+    if (event->presented) {
+        output->stats.presented++;
+    } else {
+        output->stats.dropped++;
+    }
+    stats_latency_present(&output->latency, event);
 }
 
 void output_request_state(struct wl_listener *listener, void *data) {
@@ -53,7 +201,9 @@ void output_request_state(struct wl_listener *listener, void *data) {
 void output_destroy(struct wl_listener *listener, void *data) {
     struct planar_output *output = wl_container_of(listener, output, destroy);
 
+    render_destroy(output->render);
     wl_list_remove(&output->frame.link);
+    wl_list_remove(&output->present.link);
     wl_list_remove(&output->request_state.link);
     wl_list_remove(&output->destroy.link);
     wl_list_remove(&output->link);
@@ -63,7 +213,7 @@ void output_destroy(struct wl_listener *listener, void *data) {
         layer_view->output = NULL;
         wlr_layer_surface_v1_destroy(layer_view->layer_surface);
     }
-    free(output);
+    slab_free(&output->server->stats.objects.outputs, output);
 }
 
 void output_create(struct wl_listener *listener, void *data) {
@@ -83,16 +233,21 @@ void output_create(struct wl_listener *listener, void *data) {
 
     wlr_output_commit_state(wlr_output, &state);
     wlr_output_state_finish(&state);
+    cursor_load_theme(server, wlr_output->scale);
 
-    struct planar_output *output = calloc(1, sizeof(*output));
+    struct planar_output *output = slab_alloc(&server->stats.objects.outputs);
     output->wlr_output = wlr_output;
     output->server = server;
+    wlr_output->data = output;
 
     wl_list_init(&output->layer_views);
 
     output->frame.notify = output_frame;
     wl_signal_add(&wlr_output->events.frame, &output->frame);
 
+    output->present.notify = output_present;
+    wl_signal_add(&wlr_output->events.present, &output->present);
+
     output->request_state.notify = output_request_state;
     wl_signal_add(&wlr_output->events.request_state, &output->request_state);
 
@@ -101,6 +256,10 @@ void output_create(struct wl_listener *listener, void *data) {
 
     wl_list_insert(&server->outputs, &output->link);
 
+    if (server->render_threads) {
+        output->render = render_create(output);
+    }
+
     struct wlr_output_layout_output *l_output = wlr_output_layout_add_auto(server->output_layout,
         wlr_output);
     struct wlr_scene_output *scene_output = wlr_scene_output_create(server->scene, wlr_output);
@@ -1,38 +1,161 @@
 #include "server.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/util/log.h>
 #include <unistd.h>
 
-int main(int argc, char *argv[]) {
-    wlr_log_init(WLR_DEBUG, NULL);
+#define PLANAR_USAGE "Usage: %s [-s startup command] [-r record input to file]\n" \
+	"       [-R replay input from file] [-S replay speed, 0 for unthrottled]\n" \
+	"       [-l log level: silent, error, info, debug] [-c keybindings file]\n" \
+	"       [-H WxH headless remote desktop output]\n" \
+	"       [-b commits per second per client, throttled beyond]\n" \
+	"       [-m texture budget in MiB, off-screen windows suspended beyond]\n" \
+	"       [-T render outputs on their own threads, pixman renderer only]\n" \
+	"       [-U upload shm damage on N worker threads for the render threads]\n"
 
+static bool parse_log_level(const char *name, enum wlr_log_importance *level) {
+	static const char *names[] = {
+		[WLR_SILENT] = "silent",
+		[WLR_ERROR] = "error",
+		[WLR_INFO] = "info",
+		[WLR_DEBUG] = "debug",
+	};
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strcmp(name, names[i]) == 0) {
+			*level = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char *argv[]) {
+    /* Debug logging is expensive enough to show up in frame times. */
+    enum wlr_log_importance log_level = WLR_INFO;
     char *startup_cmd = NULL;
+    char *keybindings_path = NULL;
+    char *record_path = NULL;
+    char *replay_path = NULL;
+    double replay_speed = 1.0;
+    int remote_width = 0, remote_height = 0;
+    int commit_budget = 0;
+    int texture_budget_mib = 0;
+    bool render_threads = false;
+    int upload_workers = 0;
 
 	int c;
-	while ((c = getopt(argc, argv, "s:h")) != -1) {
+	while ((c = getopt(argc, argv, "s:r:R:S:l:c:H:b:m:TU:h")) != -1) {
 		switch (c) {
 		case 's':
 			startup_cmd = optarg;
 			break;
+		case 'r':
+			record_path = optarg;
+			break;
+		case 'R':
+			replay_path = optarg;
+			break;
+		case 'S':
+			replay_speed = atof(optarg);
+			break;
+		case 'c':
+			keybindings_path = optarg;
+			break;
+		case 'H':
+			if (sscanf(optarg, "%dx%d", &remote_width, &remote_height) != 2 ||
+					remote_width <= 0 || remote_height <= 0) {
+				printf(PLANAR_USAGE, argv[0]);
+				return 1;
+			}
+			break;
+		case 'b':
+			commit_budget = atoi(optarg);
+			if (commit_budget < 0) {
+				printf(PLANAR_USAGE, argv[0]);
+				return 1;
+			}
+			break;
+		case 'm':
+			texture_budget_mib = atoi(optarg);
+			if (texture_budget_mib < 0) {
+				printf(PLANAR_USAGE, argv[0]);
+				return 1;
+			}
+			break;
+		case 'T':
+			render_threads = true;
+			break;
+		case 'U':
+			upload_workers = atoi(optarg);
+			if (upload_workers < 0) {
+				printf(PLANAR_USAGE, argv[0]);
+				return 1;
+			}
+			break;
+		case 'l':
+			if (!parse_log_level(optarg, &log_level)) {
+				printf(PLANAR_USAGE, argv[0]);
+				return 1;
+			}
+			break;
 		default:
-			printf("Usage: %s [-s startup command]\n", argv[0]);
+			printf(PLANAR_USAGE, argv[0]);
 			return 0;
 		}
 	}
 	if (optind < argc) {
-		printf("Usage: %s [-s startup command]\n", argv[0]);
+		printf(PLANAR_USAGE, argv[0]);
 		return 0;
 	}
 
+	wlr_log_init(log_level, NULL);
+
+	if (replay_path || remote_width) {
+		/* Replays run on a headless output of the recorded size, remote
+		 * sessions on one of the requested size. No default output next
+		 * to it, or the layout and where clients map would differ. */
+		setenv("WLR_BACKENDS", "headless", true);
+		setenv("WLR_HEADLESS_OUTPUTS", "0", true);
+		setenv("WLR_RENDERER", "pixman", true);
+	}
+
     struct planar_server server = {0};
     server_init(&server);
+    server.stats.commit_budget = commit_budget;
+    server.budget.limit = (uint64_t)texture_budget_mib << 20;
+    server.render_threads = render_threads;
+
+	if (!keybindings_load(&server, keybindings_path) && keybindings_path) {
+		return 1;
+	}
+	if (record_path && !recorder_init(&server, record_path)) {
+		return 1;
+	}
+	if (replay_path && !replay_init(&server, replay_path, replay_speed)) {
+		return 1;
+	}
+	if (remote_width && !remote_init(&server, remote_width, remote_height)) {
+		return 1;
+	}
+	if (upload_workers && !render_threads) {
+		wlr_log(WLR_INFO, "Upload workers only feed render threads, ignoring -U without -T");
+	} else if (upload_workers && !upload_init(&server, upload_workers)) {
+		return 1;
+	}
 
 	setenv("WAYLAND_DISPLAY", server.socket, true);
+	if (server.ipc.fd >= 0) {
+		setenv("PLANAR_IPC_SOCKET", server.ipc.path, true);
+	}
+	if (server.remote) {
+		setenv("PLANAR_REMOTE_RING", server.remote->path, true);
+	}
 
     wlr_log(WLR_INFO, "Running Wayland compositor on WAYLAND_DISPLAY=%s", server.socket);
     wlr_log(WLR_INFO, "WAYLAND_DISPLAY set to %s", getenv("WAYLAND_DISPLAY"));
 
-    if (fork() == 0) {
+    if (startup_cmd && fork() == 0) {
         execl("/bin/sh", "/bin/sh", "-c", startup_cmd, (void *)NULL);
     }
 
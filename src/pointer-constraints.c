@@ -0,0 +1,170 @@
+#include "pointer-constraints.h"
+#include "server.h"
+#include "stats.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/util/region.h>
+
+static void pointer_constraint_confine(struct planar_server *server,
+        struct wlr_pointer_constraint_v1 *constraint) {
+    /* Moves the cursor to the nearest point of the confinement region, in
+     * case the pointer was outside it when confined or the region changed
+     * from under it. */
+    struct wlr_seat *seat = server->seat;
+    double sx = seat->pointer_state.sx, sy = seat->pointer_state.sy;
+    if (constraint->type != WLR_POINTER_CONSTRAINT_V1_CONFINED ||
+            pixman_region32_contains_point(&constraint->region, floor(sx), floor(sy), NULL)) {
+        return;
+    }
+    int n_rects;
+    const pixman_box32_t *rects = pixman_region32_rectangles(&constraint->region, &n_rects);
+    double best_sx = sx, best_sy = sy, best = DBL_MAX;
+    for (int i = 0; i < n_rects; i++) {
+        double x = fmin(fmax(sx, rects[i].x1), rects[i].x2 - 1);
+        double y = fmin(fmax(sy, rects[i].y1), rects[i].y2 - 1);
+        double dist = (x - sx) * (x - sx) + (y - sy) * (y - sy);
+        if (dist < best) {
+            best = dist;
+            best_sx = x;
+            best_sy = y;
+        }
+    }
+    if (best == DBL_MAX) {
+        return;
+    }
+    wlr_cursor_warp(server->cursor, NULL, server->cursor->x - sx + best_sx,
+        server->cursor->y - sy + best_sy);
+    wlr_seat_pointer_notify_motion(seat, 0, best_sx, best_sy);
+}
+
+static void pointer_constraint_deactivate(struct planar_server *server) {
+    struct wlr_pointer_constraint_v1 *constraint = server->active_constraint;
+    if (!constraint) {
+        return;
+    }
+    if (constraint->type == WLR_POINTER_CONSTRAINT_V1_LOCKED &&
+            (constraint->current.committed & WLR_POINTER_CONSTRAINT_V1_STATE_CURSOR_HINT)) {
+        /* Leave the cursor where the client drew it while locked. The seat
+         * position is still relative to the locked surface. */
+        struct wlr_seat *seat = server->seat;
+        double lx = server->cursor->x - seat->pointer_state.sx + constraint->current.cursor_hint.x;
+        double ly = server->cursor->y - seat->pointer_state.sy + constraint->current.cursor_hint.y;
+        wlr_cursor_warp(server->cursor, NULL, lx, ly);
+        wlr_seat_pointer_notify_motion(seat, 0, constraint->current.cursor_hint.x,
+            constraint->current.cursor_hint.y);
+    }
+    wlr_pointer_constraint_v1_send_deactivated(constraint);
+    server->active_constraint = NULL;
+}
+
+void pointer_constraints_update(struct planar_server *server) {
+    struct wlr_seat *seat = server->seat;
+    struct wlr_surface *surface = seat->keyboard_state.focused_surface;
+    struct wlr_pointer_constraint_v1 *constraint = NULL;
+    if (surface && surface == seat->pointer_state.focused_surface) {
+        constraint = wlr_pointer_constraints_v1_constraint_for_surface(
+            server->pointer_constraints, surface, seat);
+    }
+    if (constraint == server->active_constraint) {
+        return;
+    }
+    pointer_constraint_deactivate(server);
+    if (constraint) {
+        server->active_constraint = constraint;
+        wlr_pointer_constraint_v1_send_activated(constraint);
+        pointer_constraint_confine(server, constraint);
+    }
+}
+
+bool pointer_constraints_motion(struct planar_server *server,
+        struct wlr_pointer_motion_event *event) {
+    wlr_relative_pointer_manager_v1_send_relative_motion(
+        server->relative_pointer_manager, server->seat,
+        (uint64_t)event->time_msec * 1000, event->delta_x, event->delta_y,
+        event->unaccel_dx, event->unaccel_dy);
+
+    struct wlr_pointer_constraint_v1 *constraint = server->active_constraint;
+    if (!constraint || server->cursor_mode != PLANAR_CURSOR_PASSTHROUGH) {
+        return false;
+    }
+    if (constraint->type == WLR_POINTER_CONSTRAINT_V1_LOCKED) {
+        /* Only the relative events matter, the cursor stays put. */
+        return true;
+    }
+
+    /* Confined: the pointer can't leave the surface, so it keeps focus and
+     * there is nothing to hit-test. */
+    struct wlr_seat *seat = server->seat;
+    double sx = seat->pointer_state.sx, sy = seat->pointer_state.sy;
+    double sx_confined, sy_confined;
+    if (!wlr_region_confine(&constraint->region, sx, sy,
+            sx + event->delta_x, sy + event->delta_y, &sx_confined, &sy_confined)) {
+        /* Outside the region, e.g. after the input region shrank. The
+         * motion still mustn't let the pointer escape. */
+        pointer_constraint_confine(server, constraint);
+        return true;
+    }
+    wlr_cursor_move(server->cursor, &event->pointer->base,
+        sx_confined - sx, sy_confined - sy);
+    stats_input_stamp(server, wlr_output_layout_output_at(server->output_layout,
+        server->cursor->x, server->cursor->y), event->time_msec);
+    wlr_seat_pointer_notify_motion(seat, event->time_msec, sx_confined, sy_confined);
+    return true;
+}
+
+static void pointer_constraint_destroy(struct wl_listener *listener, void *data) {
+    struct planar_pointer_constraint *constraint =
+        wl_container_of(listener, constraint, destroy);
+    struct planar_server *server = constraint->server;
+    if (server->active_constraint == constraint->constraint) {
+        /* The client is gone or done with it, don't send deactivated. */
+        server->active_constraint = NULL;
+    }
+    wl_list_remove(&constraint->set_region.link);
+    wl_list_remove(&constraint->destroy.link);
+    free(constraint);
+}
+
+static void pointer_constraint_set_region(struct wl_listener *listener, void *data) {
+    struct planar_pointer_constraint *constraint =
+        wl_container_of(listener, constraint, set_region);
+    struct planar_server *server = constraint->server;
+    if (server->active_constraint == constraint->constraint) {
+        pointer_constraint_confine(server, constraint->constraint);
+    }
+}
+
+static void server_new_pointer_constraint(struct wl_listener *listener, void *data) {
+    struct planar_server *server =
+        wl_container_of(listener, server, new_pointer_constraint);
+    struct wlr_pointer_constraint_v1 *wlr_constraint = data;
+
+    struct planar_pointer_constraint *constraint = calloc(1, sizeof(*constraint));
+    constraint->server = server;
+    constraint->constraint = wlr_constraint;
+    constraint->set_region.notify = pointer_constraint_set_region;
+    wl_signal_add(&wlr_constraint->events.set_region, &constraint->set_region);
+    constraint->destroy.notify = pointer_constraint_destroy;
+    wl_signal_add(&wlr_constraint->events.destroy, &constraint->destroy);
+
+    pointer_constraints_update(server);
+}
+
+void pointer_constraints_init(struct planar_server *server) {
+    server->relative_pointer_manager =
+        wlr_relative_pointer_manager_v1_create(server->wl_display);
+    server->pointer_constraints = wlr_pointer_constraints_v1_create(server->wl_display);
+    server->new_pointer_constraint.notify = server_new_pointer_constraint;
+    wl_signal_add(&server->pointer_constraints->events.new_constraint,
+        &server->new_pointer_constraint);
+}
+
+void pointer_constraints_finish(struct planar_server *server) {
+    wl_list_remove(&server->new_pointer_constraint.link);
+    server->active_constraint = NULL;
+}
@@ -5,7 +5,9 @@
 #include <wlr/types/wlr_scene.h>
 
 void xdg_popup_commit(struct wl_listener *listener, void *data) {
+    TRACE_SCOPE("xdg_popup_commit");
     struct planar_popup *popup = wl_container_of(listener, popup, commit);
+    stats_client_commit(popup->client_stats, popup->xdg_popup->base->surface);
 
     if (popup->xdg_popup->base->initial_commit) {
         // For the initial commit, we need to map the popup in the scene-graph
@@ -19,14 +21,18 @@ void xdg_popup_destroy(struct wl_listener *listener, void *data) {
     wl_list_remove(&popup->commit.link);
     wl_list_remove(&popup->destroy.link);
 
-    free(popup);
+    slab_free(&popup->server->stats.objects.popups, popup);
 }
 
 void server_new_xdg_popup(struct wl_listener *listener, void *data) {
+    struct planar_server *server = wl_container_of(listener, server, new_xdg_popup);
     struct wlr_xdg_popup *xdg_popup = data;
 
-	struct planar_popup *popup = calloc(1, sizeof(*popup));
+	struct planar_popup *popup = slab_alloc(&server->stats.objects.popups);
+	popup->server = server;
 	popup->xdg_popup = xdg_popup;
+	popup->client_stats = stats_client_get(server,
+		wl_resource_get_client(xdg_popup->resource));
 
     popup->commit.notify = xdg_popup_commit;
     wl_signal_add(&xdg_popup->base->surface->events.commit, &popup->commit);
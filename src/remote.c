@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+#include "remote.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <drm_fourcc.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/util/log.h>
+
+#define REMOTE_PAGE_SIZE 4096
+
+static void remote_ring_unmap(struct planar_remote *remote) {
+    if (!remote->ring) {
+        return;
+    }
+    /* Readers still holding the old file move on to the new one. */
+    atomic_store_explicit(&remote->ring->stale, 1, memory_order_release);
+    munmap(remote->ring, remote->size);
+    close(remote->fd);
+    remote->ring = NULL;
+    remote->fd = -1;
+}
+
+static bool remote_ring_create(struct planar_remote *remote, int width, int height) {
+    remote_ring_unmap(remote);
+
+    uint32_t stride = width * 4;
+    size_t header_size = (sizeof(struct planar_remote_ring) + REMOTE_PAGE_SIZE - 1) &
+        ~(size_t)(REMOTE_PAGE_SIZE - 1);
+    size_t frame_size = (size_t)stride * height;
+    size_t size = header_size + frame_size * PLANAR_REMOTE_SLOTS;
+
+    /* Built aside and renamed into place, so readers never see a
+     * half-initialized header. */
+    char tmp_path[sizeof(remote->path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.new", remote->path);
+    /* Never follow or reuse whatever is already there, only a file this
+     * process created gets mapped. */
+    unlink(tmp_path);
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        wlr_log_errno(WLR_ERROR, "Unable to create remote ring %s", tmp_path);
+        return false;
+    }
+    if (ftruncate(fd, size) < 0) {
+        wlr_log_errno(WLR_ERROR, "Unable to size remote ring to %zu bytes", size);
+        close(fd);
+        unlink(tmp_path);
+        return false;
+    }
+    struct planar_remote_ring *ring = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        wlr_log_errno(WLR_ERROR, "Unable to map remote ring");
+        close(fd);
+        unlink(tmp_path);
+        return false;
+    }
+
+    ring->magic = PLANAR_REMOTE_MAGIC;
+    ring->version = PLANAR_REMOTE_VERSION;
+    ring->format = DRM_FORMAT_XRGB8888;
+    ring->width = width;
+    ring->height = height;
+    ring->stride = stride;
+    ring->n_slots = PLANAR_REMOTE_SLOTS;
+    for (int i = 0; i < PLANAR_REMOTE_SLOTS; i++) {
+        ring->slots[i].offset = header_size + frame_size * i;
+        pixman_region32_fini(&remote->stale[i]);
+        pixman_region32_init_rect(&remote->stale[i], 0, 0, width, height);
+    }
+    if (rename(tmp_path, remote->path) < 0) {
+        wlr_log_errno(WLR_ERROR, "Unable to publish remote ring %s", remote->path);
+        munmap(ring, size);
+        close(fd);
+        unlink(tmp_path);
+        return false;
+    }
+
+    remote->ring = ring;
+    remote->fd = fd;
+    remote->size = size;
+    remote->seq = 0;
+    /* The first frame is all damage, whatever the output says. */
+    pixman_region32_fini(&remote->pending);
+    pixman_region32_init_rect(&remote->pending, 0, 0, width, height);
+    wlr_log(WLR_INFO, "Remote ring %s: %dx%d, %d slots", remote->path, width, height,
+        PLANAR_REMOTE_SLOTS);
+    return true;
+}
+
+static bool remote_copy(struct planar_remote *remote, struct wlr_buffer *buffer,
+        const pixman_region32_t *region, uint8_t *dst) {
+    struct planar_remote_ring *ring = remote->ring;
+    int n_boxes;
+    const pixman_box32_t *boxes = pixman_region32_rectangles(region, &n_boxes);
+
+    /* Pixman renders into shm buffers we can read directly. */
+    void *data;
+    uint32_t format;
+    size_t stride;
+    if (wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+            &data, &format, &stride)) {
+        bool ok = format == DRM_FORMAT_XRGB8888 || format == DRM_FORMAT_ARGB8888;
+        for (int i = 0; ok && i < n_boxes; i++) {
+            size_t row = (size_t)(boxes[i].x2 - boxes[i].x1) * 4;
+            for (int y = boxes[i].y1; y < boxes[i].y2; y++) {
+                memcpy(dst + (size_t)y * ring->stride + (size_t)boxes[i].x1 * 4,
+                    (const uint8_t *)data + y * stride + (size_t)boxes[i].x1 * 4, row);
+            }
+        }
+        wlr_buffer_end_data_ptr_access(buffer);
+        if (ok) {
+            return true;
+        }
+    }
+
+    /* GPU buffers, or an unexpected format: let the renderer convert. */
+    struct wlr_texture *texture = wlr_texture_from_buffer(remote->server->renderer, buffer);
+    if (!texture) {
+        return false;
+    }
+    bool ok = true;
+    for (int i = 0; ok && i < n_boxes; i++) {
+        ok = wlr_texture_read_pixels(texture, &(struct wlr_texture_read_pixels_options){
+            .data = dst,
+            .format = DRM_FORMAT_XRGB8888,
+            .stride = ring->stride,
+            .dst_x = boxes[i].x1,
+            .dst_y = boxes[i].y1,
+            .src_box = {
+                .x = boxes[i].x1,
+                .y = boxes[i].y1,
+                .width = boxes[i].x2 - boxes[i].x1,
+                .height = boxes[i].y2 - boxes[i].y1,
+            },
+        });
+    }
+    wlr_texture_destroy(texture);
+    return ok;
+}
+
+static void remote_publish(struct planar_remote *remote, struct wlr_buffer *buffer) {
+    struct planar_remote_ring *ring = remote->ring;
+    uint64_t seq = remote->seq + 1;
+    int index = seq % PLANAR_REMOTE_SLOTS;
+    struct planar_remote_slot *slot = &ring->slots[index];
+
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    /* The slot still holds frame seq - PLANAR_REMOTE_SLOTS, so it only
+     * needs what changed since then. */
+    if (!remote_copy(remote, buffer, &remote->stale[index], (uint8_t *)ring + slot->offset)) {
+        wlr_log(WLR_ERROR, "Unable to read back remote output frame");
+        return;
+    }
+    pixman_region32_clear(&remote->stale[index]);
+
+    int n_boxes;
+    const pixman_box32_t *boxes = pixman_region32_rectangles(&remote->pending, &n_boxes);
+    if (n_boxes > PLANAR_REMOTE_MAX_RECTS) {
+        boxes = pixman_region32_extents(&remote->pending);
+        n_boxes = 1;
+    }
+    for (int i = 0; i < n_boxes; i++) {
+        slot->rects[i] = (struct planar_remote_rect){
+            .x = boxes[i].x1,
+            .y = boxes[i].y1,
+            .width = boxes[i].x2 - boxes[i].x1,
+            .height = boxes[i].y2 - boxes[i].y1,
+        };
+    }
+    slot->n_rects = n_boxes;
+    slot->time_ns = stats_now_ns();
+    pixman_region32_clear(&remote->pending);
+
+    remote->seq = seq;
+    atomic_store_explicit(&slot->seq, seq, memory_order_release);
+    atomic_store_explicit(&ring->head, seq, memory_order_release);
+}
+
+static void remote_output_commit(struct wl_listener *listener, void *data) {
+    TRACE_SCOPE("remote_output_commit");
+    struct planar_remote *remote = wl_container_of(listener, remote, output_commit);
+    struct wlr_output_event_commit *event = data;
+    const struct wlr_output_state *state = event->state;
+    if (!(state->committed & WLR_OUTPUT_STATE_BUFFER) || !state->buffer) {
+        return;
+    }
+    struct wlr_buffer *buffer = state->buffer;
+    if (!remote->ring || remote->ring->width != (uint32_t)buffer->width ||
+            remote->ring->height != (uint32_t)buffer->height) {
+        if (!remote_ring_create(remote, buffer->width, buffer->height)) {
+            return;
+        }
+    }
+
+    pixman_region32_t damage;
+    pixman_region32_init_rect(&damage, 0, 0, buffer->width, buffer->height);
+    if (state->committed & WLR_OUTPUT_STATE_DAMAGE) {
+        pixman_region32_intersect(&damage, &damage, &state->damage);
+    }
+    if (pixman_region32_not_empty(&damage)) {
+        pixman_region32_union(&remote->pending, &remote->pending, &damage);
+        for (int i = 0; i < PLANAR_REMOTE_SLOTS; i++) {
+            pixman_region32_union(&remote->stale[i], &remote->stale[i], &damage);
+        }
+    }
+    pixman_region32_fini(&damage);
+
+    if (pixman_region32_not_empty(&remote->pending)) {
+        remote_publish(remote, buffer);
+    }
+}
+
+static void remote_output_destroy(struct wl_listener *listener, void *data) {
+    struct planar_remote *remote = wl_container_of(listener, remote, output_destroy);
+    wl_list_remove(&remote->output_commit.link);
+    wl_list_remove(&remote->output_destroy.link);
+    remote->output = NULL;
+}
+
+static void remote_start(void *data) {
+    /* Idle callback, headless outputs can only be added to a started
+     * backend. */
+    struct planar_remote *remote = data;
+    struct planar_server *server = remote->server;
+
+    struct wlr_backend *headless = server_headless_backend(server);
+    if (!headless) {
+        wlr_log(WLR_ERROR, "Remote output needs the headless backend");
+        wl_display_terminate(server->wl_display);
+        return;
+    }
+
+    remote->output = wlr_headless_add_output(headless, remote->width, remote->height);
+    remote->output_commit.notify = remote_output_commit;
+    wl_signal_add(&remote->output->events.commit, &remote->output_commit);
+    remote->output_destroy.notify = remote_output_destroy;
+    wl_signal_add(&remote->output->events.destroy, &remote->output_destroy);
+}
+
+bool remote_init(struct planar_server *server, int width, int height) {
+    /* Frames are readable by anyone who can open the ring, so it only goes
+     * in the private runtime dir. */
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (!dir) {
+        wlr_log(WLR_ERROR, "XDG_RUNTIME_DIR is not set, remote output disabled");
+        return false;
+    }
+
+    struct planar_remote *remote = calloc(1, sizeof(*remote));
+    if (!remote) {
+        return false;
+    }
+    remote->server = server;
+    remote->width = width;
+    remote->height = height;
+    remote->fd = -1;
+    pixman_region32_init(&remote->pending);
+    for (int i = 0; i < PLANAR_REMOTE_SLOTS; i++) {
+        pixman_region32_init(&remote->stale[i]);
+    }
+
+    snprintf(remote->path, sizeof(remote->path), "%s/planar-remote.%d", dir, getpid());
+
+    server->remote = remote;
+    wl_event_loop_add_idle(wl_display_get_event_loop(server->wl_display),
+        remote_start, remote);
+    return true;
+}
+
+void remote_finish(struct planar_server *server) {
+    struct planar_remote *remote = server->remote;
+    if (!remote) {
+        return;
+    }
+    if (remote->output) {
+        wl_list_remove(&remote->output_commit.link);
+        wl_list_remove(&remote->output_destroy.link);
+    }
+    if (remote->ring) {
+        remote_ring_unmap(remote);
+        unlink(remote->path);
+    }
+    pixman_region32_fini(&remote->pending);
+    for (int i = 0; i < PLANAR_REMOTE_SLOTS; i++) {
+        pixman_region32_fini(&remote->stale[i]);
+    }
+    free(remote);
+    server->remote = NULL;
+}
@@ -0,0 +1,505 @@
+#define _GNU_SOURCE
+#include "render.h"
+#include "output.h"
+#include "stats.h"
+#include "trace.h"
+#include "upload.h"
+
+#include <drm_fourcc.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <wlr/render/pass.h>
+#include <wlr/render/pixman.h>
+#include <wlr/render/swapchain.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_presentation_time.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+struct render_snapshot {
+    struct planar_render *render;
+    struct wlr_scene_output *scene_output;
+    /* The output in layout coordinates. */
+    struct wlr_box box;
+    float scale;
+    bool ok;
+};
+
+static pixman_format_code_t render_pixman_format(uint32_t format) {
+    switch (format) {
+    case DRM_FORMAT_ARGB8888:
+        return PIXMAN_a8r8g8b8;
+    case DRM_FORMAT_XRGB8888:
+        return PIXMAN_x8r8g8b8;
+    case DRM_FORMAT_ABGR8888:
+        return PIXMAN_a8b8g8r8;
+    case DRM_FORMAT_XBGR8888:
+        return PIXMAN_x8b8g8r8;
+    default:
+        return 0;
+    }
+}
+
+static bool render_buffer_data(struct wlr_buffer *buffer, void **data, uint32_t *format,
+        size_t *stride) {
+    /* Only one data pointer access may be open per buffer, and the
+     * renderer and screen capture take their own. The mapping itself
+     * stays valid for as long as the buffer is locked. */
+    if (wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+            data, format, stride)) {
+        wlr_buffer_end_data_ptr_access(buffer);
+        return true;
+    }
+    /* Surface buffers wrap what the client attached. With the pixman
+     * renderer the texture holds on to it, so it's still around. */
+    struct wlr_client_buffer *client_buffer = wlr_client_buffer_get(buffer);
+    if (client_buffer && client_buffer->source) {
+        return render_buffer_data(client_buffer->source, data, format, stride);
+    }
+    return false;
+}
+
+static struct planar_render_item *render_snapshot_add(struct render_snapshot *snapshot,
+        int lx, int ly, int width, int height) {
+    struct wlr_box box = {
+        .x = lx - snapshot->box.x,
+        .y = ly - snapshot->box.y,
+        .width = width,
+        .height = height,
+    };
+    if (box.x >= snapshot->box.width || box.y >= snapshot->box.height ||
+            box.x + box.width <= 0 || box.y + box.height <= 0) {
+        return NULL;
+    }
+
+    struct planar_render *render = snapshot->render;
+    if (render->n_items == render->cap_items) {
+        size_t cap = render->cap_items ? render->cap_items * 2 : 32;
+        struct planar_render_item *items = realloc(render->items, cap * sizeof(*items));
+        if (!items) {
+            snapshot->ok = false;
+            return NULL;
+        }
+        render->items = items;
+        render->cap_items = cap;
+    }
+    struct planar_render_item *item = &render->items[render->n_items++];
+    *item = (struct planar_render_item){ .opacity = 1.0f };
+
+    /* Same rounding as wlroots, so neighbours don't gap or overlap. */
+    int x2 = round((box.x + box.width) * snapshot->scale);
+    int y2 = round((box.y + box.height) * snapshot->scale);
+    item->dst.x = round(box.x * snapshot->scale);
+    item->dst.y = round(box.y * snapshot->scale);
+    item->dst.width = x2 - item->dst.x;
+    item->dst.height = y2 - item->dst.y;
+    return item;
+}
+
+static void render_surface_destroy(struct planar_render_surface *render_surface) {
+    wl_list_remove(&render_surface->link);
+    wl_list_remove(&render_surface->destroy.link);
+    free(render_surface);
+}
+
+static void render_surface_handle_destroy(struct wl_listener *listener, void *data) {
+    struct planar_render_surface *render_surface =
+        wl_container_of(listener, render_surface, destroy);
+    render_surface_destroy(render_surface);
+}
+
+static void render_snapshot_surface(struct render_snapshot *snapshot,
+        struct wlr_scene_buffer *scene_buffer) {
+    /* Same rule as the scene's output_sample: only the primary output
+     * reports presentation for a surface. */
+    struct wlr_scene_surface *scene_surface = wlr_scene_surface_try_from_buffer(scene_buffer);
+    if (!scene_surface || scene_buffer->primary_output != snapshot->scene_output) {
+        return;
+    }
+    struct planar_render_surface *render_surface = calloc(1, sizeof(*render_surface));
+    if (!render_surface) {
+        snapshot->ok = false;
+        return;
+    }
+    render_surface->surface = scene_surface->surface;
+    render_surface->destroy.notify = render_surface_handle_destroy;
+    wl_signal_add(&scene_surface->surface->events.destroy, &render_surface->destroy);
+    wl_list_insert(&snapshot->render->surfaces, &render_surface->link);
+}
+
+static bool render_item_set_data(struct render_snapshot *snapshot,
+        struct planar_render_item *item, struct wlr_scene_buffer *scene_buffer) {
+    struct wlr_buffer *buffer = scene_buffer->buffer;
+    /* Uploaded surfaces are drawn from the copy, which leaves the client
+     * buffer free to be released. */
+    struct wlr_scene_surface *scene_surface = wlr_scene_surface_try_from_buffer(scene_buffer);
+    struct planar_upload_image *image = scene_surface ?
+        upload_surface_image(snapshot->render->output->server, scene_surface->surface) : NULL;
+    if (image && image->width == buffer->width && image->height == buffer->height) {
+        item->image = upload_image_ref(image);
+        item->data = image->data;
+        item->format = image->format;
+        item->stride = image->stride;
+    } else if (render_buffer_data(buffer, &item->data, &item->format, &item->stride) &&
+            render_pixman_format(item->format)) {
+        item->buffer = wlr_buffer_lock(buffer);
+    } else {
+        return false;
+    }
+    item->width = buffer->width;
+    item->height = buffer->height;
+    return true;
+}
+
+static void render_snapshot_buffer(struct render_snapshot *snapshot,
+        struct wlr_scene_buffer *scene_buffer, int lx, int ly) {
+    struct wlr_buffer *buffer = scene_buffer->buffer;
+    if (!buffer || scene_buffer->opacity <= 0) {
+        return;
+    }
+    int width = scene_buffer->dst_width ? scene_buffer->dst_width : buffer->width;
+    int height = scene_buffer->dst_height ? scene_buffer->dst_height : buffer->height;
+    struct planar_render_item *item = render_snapshot_add(snapshot, lx, ly, width, height);
+    if (!item) {
+        return;
+    }
+    if (scene_buffer->transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+            !render_item_set_data(snapshot, item, scene_buffer)) {
+        /* Rotated or not in memory: the renderer has to do this one. */
+        snapshot->render->n_items--;
+        snapshot->ok = false;
+        return;
+    }
+    item->opacity = scene_buffer->opacity;
+    item->src = scene_buffer->src_box;
+    if (wlr_fbox_empty(&item->src)) {
+        item->src = (struct wlr_fbox){ 0, 0, buffer->width, buffer->height };
+    }
+    render_snapshot_surface(snapshot, scene_buffer);
+}
+
+static void render_snapshot_node(struct render_snapshot *snapshot, struct wlr_scene_node *node,
+        int lx, int ly) {
+    if (!node->enabled || !snapshot->ok) {
+        return;
+    }
+    lx += node->x;
+    ly += node->y;
+
+    switch (node->type) {
+    case WLR_SCENE_NODE_TREE: {
+        struct wlr_scene_tree *tree = wlr_scene_tree_from_node(node);
+        struct wlr_scene_node *child;
+        wl_list_for_each(child, &tree->children, link) {
+            render_snapshot_node(snapshot, child, lx, ly);
+        }
+        break;
+    }
+    case WLR_SCENE_NODE_RECT: {
+        struct wlr_scene_rect *rect = wlr_scene_rect_from_node(node);
+        struct planar_render_item *item = render_snapshot_add(snapshot, lx, ly,
+            rect->width, rect->height);
+        if (item) {
+            memcpy(item->color, rect->color, sizeof(item->color));
+        }
+        break;
+    }
+    case WLR_SCENE_NODE_BUFFER:
+        render_snapshot_buffer(snapshot, wlr_scene_buffer_from_node(node), lx, ly);
+        break;
+    }
+}
+
+static void render_release(struct planar_render *render) {
+    for (size_t i = 0; i < render->n_items; i++) {
+        if (render->items[i].image) {
+            upload_image_unref(render->items[i].image);
+        }
+        if (render->items[i].buffer) {
+            wlr_buffer_unlock(render->items[i].buffer);
+        }
+    }
+    render->n_items = 0;
+    struct planar_render_surface *render_surface, *tmp;
+    wl_list_for_each_safe(render_surface, tmp, &render->surfaces, link) {
+        render_surface_destroy(render_surface);
+    }
+    if (render->target) {
+        wlr_buffer_unlock(render->target);
+        render->target = NULL;
+    }
+    pixman_region32_clear(&render->damage);
+    render->busy = false;
+}
+
+static void render_draw_item(pixman_image_t *target, const struct planar_render_item *item) {
+    if (!item->data) {
+        float alpha = item->color[3] * item->opacity;
+        pixman_color_t color = {
+            .red = item->color[0] * alpha * 0xffff,
+            .green = item->color[1] * alpha * 0xffff,
+            .blue = item->color[2] * alpha * 0xffff,
+            .alpha = alpha * 0xffff,
+        };
+        pixman_rectangle16_t rect = {
+            item->dst.x, item->dst.y, item->dst.width, item->dst.height,
+        };
+        pixman_image_fill_rectangles(PIXMAN_OP_OVER, target, &color, 1, &rect);
+        return;
+    }
+
+    pixman_image_t *src = pixman_image_create_bits_no_clear(render_pixman_format(item->format),
+        item->width, item->height, item->data, item->stride);
+    if (!src) {
+        return;
+    }
+    /* Maps destination pixels back into the source box. */
+    double sx = item->src.width / item->dst.width;
+    double sy = item->src.height / item->dst.height;
+    struct pixman_f_transform ftransform;
+    pixman_f_transform_init_scale(&ftransform, sx, sy);
+    pixman_f_transform_translate(&ftransform, NULL, item->src.x, item->src.y);
+    struct pixman_transform transform;
+    pixman_transform_from_pixman_f_transform(&transform, &ftransform);
+    pixman_image_set_transform(src, &transform);
+    bool scaled = sx != 1.0 || sy != 1.0 ||
+        item->src.x != floor(item->src.x) || item->src.y != floor(item->src.y);
+    pixman_image_set_filter(src, scaled ? PIXMAN_FILTER_BILINEAR : PIXMAN_FILTER_NEAREST,
+        NULL, 0);
+
+    pixman_image_t *mask = NULL;
+    if (item->opacity < 1.0f) {
+        mask = pixman_image_create_solid_fill(&(pixman_color_t){
+            .alpha = item->opacity * 0xffff,
+        });
+    }
+    pixman_image_composite32(PIXMAN_OP_OVER, src, mask, target, 0, 0, 0, 0,
+        item->dst.x, item->dst.y, item->dst.width, item->dst.height);
+    if (mask) {
+        pixman_image_unref(mask);
+    }
+    pixman_image_unref(src);
+}
+
+static void render_draw(struct planar_render *render) {
+    /* No buffer age, so every frame is drawn in full. */
+    int width = render->target->width;
+    int height = render->target->height;
+    pixman_image_t *target = pixman_image_create_bits_no_clear(
+        render_pixman_format(render->target_format), width, height,
+        render->target_data, render->target_stride);
+    if (!target) {
+        return;
+    }
+    pixman_color_t black = { .alpha = 0xffff };
+    pixman_rectangle16_t whole = { 0, 0, width, height };
+    pixman_image_fill_rectangles(PIXMAN_OP_SRC, target, &black, 1, &whole);
+    for (size_t i = 0; i < render->n_items; i++) {
+        render_draw_item(target, &render->items[i]);
+    }
+    pixman_image_unref(target);
+}
+
+static void *render_thread_run(void *data) {
+    struct planar_render *render = data;
+    pthread_mutex_lock(&render->lock);
+    while (true) {
+        while (!render->queued && !render->stop) {
+            pthread_cond_wait(&render->cond, &render->lock);
+        }
+        if (render->stop) {
+            break;
+        }
+        render->queued = false;
+        pthread_mutex_unlock(&render->lock);
+
+        uint64_t start = stats_now_ns();
+        render_draw(render);
+        uint64_t end = stats_now_ns();
+
+        pthread_mutex_lock(&render->lock);
+        render->render_ns = end - start;
+        render->done = true;
+        uint64_t one = 1;
+        if (write(render->event_fd, &one, sizeof(one)) < 0) {
+            wlr_log_errno(WLR_ERROR, "Unable to wake the main loop");
+        }
+    }
+    pthread_mutex_unlock(&render->lock);
+    return NULL;
+}
+
+static void render_commit(struct planar_render *render) {
+    TRACE_SCOPE("render_commit");
+    struct planar_output *output = render->output;
+    struct wlr_output *wlr_output = output->wlr_output;
+
+    /* Software cursors go on top, drawn by wlroots as usual. */
+    struct wlr_render_pass *pass = wlr_renderer_begin_buffer_pass(output->server->renderer,
+        render->target, NULL);
+    if (pass) {
+        wlr_output_add_software_cursors_to_render_pass(wlr_output, pass, NULL);
+        wlr_render_pass_submit(pass);
+    }
+
+    struct planar_render_surface *render_surface;
+    wl_list_for_each(render_surface, &render->surfaces, link) {
+        wlr_presentation_surface_textured_on_output(render_surface->surface, wlr_output);
+    }
+
+    struct wlr_output_state state;
+    wlr_output_state_init(&state);
+    wlr_output_state_set_buffer(&state, render->target);
+    wlr_output_state_set_damage(&state, &render->damage);
+    bool committed = wlr_output_commit_state(wlr_output, &state);
+    wlr_output_state_finish(&state);
+
+    pthread_mutex_lock(&render->lock);
+    stats_frame_record(&output->render_stats, render->render_ns);
+    pthread_mutex_unlock(&render->lock);
+
+    uint64_t frame_start_ns = render->frame_start_ns;
+    render_release(render);
+    output_frame_committed(output, frame_start_ns, committed);
+    if (render->again) {
+        render->again = false;
+        wlr_output_schedule_frame(wlr_output);
+    }
+}
+
+static int render_handle_event(int fd, uint32_t mask, void *data) {
+    struct planar_render *render = data;
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&render->lock);
+    bool done = render->done;
+    render->done = false;
+    pthread_mutex_unlock(&render->lock);
+    if (done && render->busy) {
+        render_commit(render);
+    }
+    return 0;
+}
+
+bool render_frame(struct planar_render *render, struct wlr_scene_output *scene_output,
+        uint64_t frame_start_ns) {
+    TRACE_SCOPE("render_frame");
+    if (render->busy) {
+        render->again = true;
+        return true;
+    }
+    struct wlr_output *wlr_output = scene_output->output;
+    if (wlr_output->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+        return false;
+    }
+
+    struct render_snapshot snapshot = {
+        .render = render,
+        .scene_output = scene_output,
+        .box = { .x = scene_output->x, .y = scene_output->y },
+        .scale = wlr_output->scale,
+        .ok = true,
+    };
+    wlr_output_effective_resolution(wlr_output, &snapshot.box.width, &snapshot.box.height);
+    render_snapshot_node(&snapshot, &scene_output->scene->tree.node, 0, 0);
+    if (!snapshot.ok) {
+        render_release(render);
+        return false;
+    }
+
+    struct wlr_output_state state;
+    wlr_output_state_init(&state);
+    bool configured = wlr_output_configure_primary_swapchain(wlr_output, &state,
+        &wlr_output->swapchain);
+    wlr_output_state_finish(&state);
+    if (configured) {
+        render->target = wlr_swapchain_acquire(wlr_output->swapchain);
+    }
+    if (!render->target || !render_buffer_data(render->target, &render->target_data,
+            &render->target_format, &render->target_stride) ||
+            !render_pixman_format(render->target_format)) {
+        render_release(render);
+        return false;
+    }
+
+    pixman_region32_copy(&render->damage, &scene_output->pending_commit_damage);
+    render->frame_start_ns = frame_start_ns;
+    render->busy = true;
+    pthread_mutex_lock(&render->lock);
+    render->queued = true;
+    pthread_cond_signal(&render->cond);
+    pthread_mutex_unlock(&render->lock);
+    return true;
+}
+
+struct planar_render *render_create(struct planar_output *output) {
+    struct planar_server *server = output->server;
+    if (!wlr_renderer_is_pixman(server->renderer)) {
+        wlr_log(WLR_INFO, "Render threads need the pixman renderer, %s renders inline",
+            output->wlr_output->name);
+        return NULL;
+    }
+
+    struct planar_render *render = calloc(1, sizeof(*render));
+    if (!render) {
+        return NULL;
+    }
+    render->output = output;
+    render->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (render->event_fd < 0) {
+        wlr_log_errno(WLR_ERROR, "Unable to create render eventfd");
+        free(render);
+        return NULL;
+    }
+    pthread_mutex_init(&render->lock, NULL);
+    pthread_cond_init(&render->cond, NULL);
+    pixman_region32_init(&render->damage);
+    wl_list_init(&render->surfaces);
+
+    /* Signals stay with the main loop's signalfds. */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&render->thread, NULL, render_thread_run, render);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err) {
+        wlr_log(WLR_ERROR, "Unable to start render thread: %s", strerror(err));
+        pixman_region32_fini(&render->damage);
+        pthread_cond_destroy(&render->cond);
+        pthread_mutex_destroy(&render->lock);
+        close(render->event_fd);
+        free(render);
+        return NULL;
+    }
+
+    render->event_source = wl_event_loop_add_fd(wl_display_get_event_loop(server->wl_display),
+        render->event_fd, WL_EVENT_READABLE, render_handle_event, render);
+    return render;
+}
+
+void render_destroy(struct planar_render *render) {
+    if (!render) {
+        return;
+    }
+    pthread_mutex_lock(&render->lock);
+    render->stop = true;
+    pthread_cond_signal(&render->cond);
+    pthread_mutex_unlock(&render->lock);
+    pthread_join(render->thread, NULL);
+
+    render_release(render);
+    wl_event_source_remove(render->event_source);
+    close(render->event_fd);
+    pixman_region32_fini(&render->damage);
+    pthread_cond_destroy(&render->cond);
+    pthread_mutex_destroy(&render->lock);
+    free(render->items);
+    free(render);
+}
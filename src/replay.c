@@ -0,0 +1,296 @@
+#include "replay.h"
+#include "server.h"
+#include "output.h"
+#include "stats.h"
+#include "virtual-input.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/backend/headless.h>
+#include <wlr/util/log.h>
+
+#define REPLAY_DEFAULT_WIDTH 1920
+#define REPLAY_DEFAULT_HEIGHT 1080
+#define REPLAY_BATCH 512
+#define REPLAY_DRAIN_MS 500
+
+static void recorder_write_header(struct planar_server *server,
+        struct planar_recorder *recorder) {
+    struct wlr_box box;
+    wlr_output_layout_get_box(server->output_layout, NULL, &box);
+    struct planar_recording_header header = {
+        .magic = PLANAR_RECORDING_MAGIC,
+        .version = PLANAR_RECORDING_VERSION,
+        .record_size = sizeof(struct planar_record),
+        .layout_width = box.width,
+        .layout_height = box.height,
+    };
+    fwrite(&header, sizeof(header), 1, recorder->file);
+}
+
+bool recorder_init(struct planar_server *server, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        wlr_log_errno(WLR_ERROR, "Unable to open input recording %s", path);
+        return false;
+    }
+
+    struct planar_recorder *recorder = calloc(1, sizeof(*recorder));
+    if (!recorder) {
+        fclose(file);
+        return false;
+    }
+    /* Records are small and frequent, let stdio batch them. */
+    setvbuf(file, NULL, _IOFBF, 1 << 16);
+    recorder->file = file;
+    recorder->start_ns = stats_now_ns();
+
+    recorder_write_header(server, recorder);
+
+    server->recorder = recorder;
+    wlr_log(WLR_INFO, "Recording input to %s", path);
+    return true;
+}
+
+void recorder_finish(struct planar_server *server) {
+    struct planar_recorder *recorder = server->recorder;
+    if (!recorder) {
+        return;
+    }
+    /* Outputs only show up once the backend is running, so the layout size
+     * is filled in after the fact. */
+    rewind(recorder->file);
+    recorder_write_header(server, recorder);
+    fclose(recorder->file);
+    wlr_log(WLR_INFO, "Recorded %lu input events", (unsigned long)recorder->records);
+    free(recorder);
+    server->recorder = NULL;
+}
+
+void recorder_record(struct planar_server *server, const struct planar_record *record) {
+    struct planar_recorder *recorder = server->recorder;
+    if (!recorder) {
+        return;
+    }
+    struct planar_record stamped = *record;
+    stamped.time_ns = stats_now_ns() - recorder->start_ns;
+    fwrite(&stamped, sizeof(stamped), 1, recorder->file);
+    recorder->records++;
+}
+
+static void replay_emit(struct planar_replay *replay, const struct planar_record *record) {
+    struct planar_virtual_input *input = replay->input;
+    switch (record->type) {
+    case PLANAR_RECORD_MOTION:
+        virtual_input_motion(input, record->time_msec, record->x, record->y);
+        break;
+    case PLANAR_RECORD_MOTION_ABSOLUTE:
+        virtual_input_motion_absolute(input, record->time_msec, record->x, record->y);
+        break;
+    case PLANAR_RECORD_BUTTON:
+        virtual_input_button(input, record->time_msec, record->code,
+            record->state == WL_POINTER_BUTTON_STATE_PRESSED);
+        break;
+    case PLANAR_RECORD_AXIS:
+        virtual_input_axis(input, record->time_msec, record->state, record->x,
+            record->discrete);
+        break;
+    case PLANAR_RECORD_FRAME:
+        virtual_input_frame(input);
+        break;
+    case PLANAR_RECORD_KEY:
+        virtual_input_key(input, record->time_msec, record->code,
+            record->state == WL_KEYBOARD_KEY_STATE_PRESSED);
+        break;
+    default:
+        wlr_log(WLR_ERROR, "Skipping unknown input record type %d", record->type);
+        break;
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double frame_percentile_us(const uint64_t *sorted, size_t n, double p) {
+    return n ? sorted[(size_t)(p * (n - 1) + 0.5)] / 1000.0 : 0;
+}
+
+static void replay_report(struct planar_replay *replay) {
+    struct planar_output *output = replay->output->data;
+    uint64_t elapsed = stats_now_ns() - replay->start_ns;
+
+    qsort(replay->frame_ns, replay->n_frames, sizeof(uint64_t), compare_u64);
+    printf("replay: %zu events in %.3fs (speed %.2f), %zu frames, dropped %lu\n",
+        replay->n_records, elapsed / 1e9, replay->speed, replay->n_frames,
+        output ? (unsigned long)output->stats.dropped : 0ul);
+    printf("replay: frame time us p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+        frame_percentile_us(replay->frame_ns, replay->n_frames, 0.50),
+        frame_percentile_us(replay->frame_ns, replay->n_frames, 0.90),
+        frame_percentile_us(replay->frame_ns, replay->n_frames, 0.99),
+        frame_percentile_us(replay->frame_ns, replay->n_frames, 1.0));
+
+    struct planar_ipc_buf snapshot = {0};
+    ipc_stats_json(replay->server, &snapshot);
+    fwrite(snapshot.data, 1, snapshot.len, stdout);
+    ipc_buf_finish(&snapshot);
+    fflush(stdout);
+}
+
+static int replay_tick(void *data) {
+    struct planar_replay *replay = data;
+
+    if (replay->next == replay->n_records) {
+        /* Drained: everything has been rendered by now. */
+        replay_report(replay);
+        wl_display_terminate(replay->server->wl_display);
+        return 0;
+    }
+
+    int delay_ms = 1;
+    if (replay->speed <= 0) {
+        /* As fast as possible, in batches so clients still get dispatched. */
+        size_t end = replay->next + REPLAY_BATCH;
+        while (replay->next < replay->n_records && replay->next < end) {
+            replay_emit(replay, &replay->records[replay->next++]);
+        }
+    } else {
+        uint64_t elapsed = (stats_now_ns() - replay->start_ns) * replay->speed;
+        while (replay->next < replay->n_records &&
+                replay->records[replay->next].time_ns <= elapsed) {
+            replay_emit(replay, &replay->records[replay->next++]);
+        }
+        if (replay->next < replay->n_records) {
+            uint64_t wait_ns = (replay->records[replay->next].time_ns - elapsed) /
+                replay->speed;
+            delay_ms = wait_ns / 1000000 > 0 ? wait_ns / 1000000 : 1;
+        }
+    }
+
+    if (replay->next == replay->n_records) {
+        delay_ms = REPLAY_DRAIN_MS;
+    }
+    wl_event_source_timer_update(replay->timer, delay_ms);
+    return 0;
+}
+
+static void replay_output_frame(struct wl_listener *listener, void *data) {
+    /* Runs after output_frame, so the output's stats hold this frame. */
+    struct planar_replay *replay = wl_container_of(listener, replay, output_frame);
+    struct planar_output *output = replay->output->data;
+    if (!output) {
+        return;
+    }
+    if (replay->n_frames == replay->frames_cap) {
+        size_t cap = replay->frames_cap ? replay->frames_cap * 2 : 1024;
+        uint64_t *frames = realloc(replay->frame_ns, cap * sizeof(*frames));
+        if (!frames) {
+            return;
+        }
+        replay->frame_ns = frames;
+        replay->frames_cap = cap;
+    }
+    replay->frame_ns[replay->n_frames++] = output->stats.last_duration_ns;
+}
+
+static void replay_start(void *data) {
+    /* Runs from the event loop, once the backend has been started. */
+    struct planar_replay *replay = data;
+    struct planar_server *server = replay->server;
+
+    struct wlr_backend *headless = server_headless_backend(server);
+    if (!headless) {
+        wlr_log(WLR_ERROR, "Replay needs the headless backend");
+        wl_display_terminate(server->wl_display);
+        return;
+    }
+
+    replay->output = wlr_headless_add_output(headless,
+        replay->layout_width > 0 ? replay->layout_width : REPLAY_DEFAULT_WIDTH,
+        replay->layout_height > 0 ? replay->layout_height : REPLAY_DEFAULT_HEIGHT);
+    replay->output_frame.notify = replay_output_frame;
+    wl_signal_add(&replay->output->events.frame, &replay->output_frame);
+
+    replay->input = virtual_input_create(server);
+    replay->start_ns = stats_now_ns();
+    replay->timer = wl_event_loop_add_timer(wl_display_get_event_loop(server->wl_display),
+        replay_tick, replay);
+    wl_event_source_timer_update(replay->timer, 1);
+}
+
+static bool replay_load(struct planar_replay *replay, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        wlr_log_errno(WLR_ERROR, "Unable to open input recording %s", path);
+        return false;
+    }
+
+    struct planar_recording_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+            memcmp(header.magic, PLANAR_RECORDING_MAGIC, sizeof(PLANAR_RECORDING_MAGIC)) != 0 ||
+            header.version != PLANAR_RECORDING_VERSION ||
+            header.record_size != sizeof(struct planar_record)) {
+        wlr_log(WLR_ERROR, "%s is not a planar input recording", path);
+        fclose(file);
+        return false;
+    }
+    replay->layout_width = header.layout_width;
+    replay->layout_height = header.layout_height;
+
+    size_t cap = 0;
+    struct planar_record record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (replay->n_records == cap) {
+            cap = cap ? cap * 2 : 4096;
+            struct planar_record *records = realloc(replay->records, cap * sizeof(*records));
+            if (!records) {
+                fclose(file);
+                return false;
+            }
+            replay->records = records;
+        }
+        replay->records[replay->n_records++] = record;
+    }
+    fclose(file);
+    return true;
+}
+
+bool replay_init(struct planar_server *server, const char *path, double speed) {
+    struct planar_replay *replay = calloc(1, sizeof(*replay));
+    if (!replay) {
+        return false;
+    }
+    replay->server = server;
+    replay->speed = speed;
+    if (!replay_load(replay, path)) {
+        free(replay->records);
+        free(replay);
+        return false;
+    }
+
+    server->replay = replay;
+    wl_event_loop_add_idle(wl_display_get_event_loop(server->wl_display),
+        replay_start, replay);
+    wlr_log(WLR_INFO, "Replaying %zu input events from %s", replay->n_records, path);
+    return true;
+}
+
+void replay_finish(struct planar_server *server) {
+    struct planar_replay *replay = server->replay;
+    if (!replay) {
+        return;
+    }
+    if (replay->timer) {
+        wl_event_source_remove(replay->timer);
+    }
+    if (replay->output) {
+        wl_list_remove(&replay->output_frame.link);
+    }
+    virtual_input_destroy(replay->input);
+    free(replay->records);
+    free(replay->frame_ns);
+    free(replay);
+    server->replay = NULL;
+}
@@ -1,5 +1,7 @@
 #include "seat.h"
+#include "cursor.h"
 #include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_cursor_shape_v1.h>
 #include <wlr/types/wlr_seat.h>
 
 static void seat_request_cursor(struct wl_listener *listener, void *data) {
@@ -12,6 +14,26 @@ static void seat_request_cursor(struct wl_listener *listener, void *data) {
     if (focused_client == event->seat_client) {
         wlr_cursor_set_surface(server->cursor, event->surface,
                 event->hotspot_x, event->hotspot_y);
+        server->cursor_image = NULL;
+    }
+}
+
+static void seat_request_set_cursor_shape(struct wl_listener *listener, void *data) {
+    /* Named shapes come from our own theme cache, the client uploads
+     * nothing. The same focus rule as for cursor surfaces applies. */
+    struct planar_server *server = wl_container_of(
+            listener, server, request_set_cursor_shape);
+    struct wlr_cursor_shape_manager_v1_request_set_shape_event *event = data;
+    struct wlr_seat_client *focused_client = NULL;
+
+    if (event->device_type == WLR_CURSOR_SHAPE_MANAGER_V1_DEVICE_TYPE_POINTER) {
+        focused_client = server->seat->pointer_state.focused_client;
+    } else if (event->tablet_tool->focused_surface) {
+        focused_client = wlr_seat_client_for_wl_client(server->seat,
+                wl_resource_get_client(event->tablet_tool->focused_surface->resource));
+    }
+    if (focused_client == event->seat_client) {
+        cursor_set_image(server, wlr_cursor_shape_v1_name(event->shape));
     }
 }
 
@@ -22,6 +44,18 @@ static void seat_request_set_selection(struct wl_listener *listener, void *data)
     wlr_seat_set_selection(server->seat, event->source, event->serial);
 }
 
+void seat_update_capabilities(struct planar_server *server) {
+    /* There is always a cursor, even without a pointer device attached. */
+    uint32_t caps = WL_SEAT_CAPABILITY_POINTER;
+    if (!wl_list_empty(&server->keyboards)) {
+        caps |= WL_SEAT_CAPABILITY_KEYBOARD;
+    }
+    if (server->touch.n_devices > 0) {
+        caps |= WL_SEAT_CAPABILITY_TOUCH;
+    }
+    wlr_seat_set_capabilities(server->seat, caps);
+}
+
 void seat_init(struct planar_server *server) {
     server->seat = wlr_seat_create(server->wl_display, "seat0");
 
@@ -29,6 +63,11 @@ void seat_init(struct planar_server *server) {
     wl_signal_add(&server->seat->events.request_set_cursor,
             &server->request_cursor);
 
+    server->cursor_shape_manager = wlr_cursor_shape_manager_v1_create(server->wl_display, 1);
+    server->request_set_cursor_shape.notify = seat_request_set_cursor_shape;
+    wl_signal_add(&server->cursor_shape_manager->events.request_set_shape,
+            &server->request_set_cursor_shape);
+
     server->request_set_selection.notify = seat_request_set_selection;
     wl_signal_add(&server->seat->events.request_set_selection,
             &server->request_set_selection);
@@ -36,6 +75,7 @@ void seat_init(struct planar_server *server) {
 
 void seat_finish(struct planar_server *server) {
     wl_list_remove(&server->request_cursor.link);
+    wl_list_remove(&server->request_set_cursor_shape.link);
     wl_list_remove(&server->request_set_selection.link);
     // The wlr_seat is destroyed when the display is destroyed
 }
@@ -6,15 +6,26 @@
 #include "cursor.h"
 #include "seat.h"
 #include "layers.h"
+#include "tablet.h"
+#include "touch.h"
+#include "ipc.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <unistd.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <wlr/backend/headless.h>
+#include <wlr/backend/multi.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/types/wlr_subcompositor.h>
 #include <wlr/types/wlr_layer_shell_v1.h>
+#include <wlr/types/wlr_fractional_scale_v1.h>
+#include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_presentation_time.h>
+#include <wlr/types/wlr_viewporter.h>
 #include <wlr/types/wlr_screencopy_v1.h>
 #include <wlr/types/wlr_xdg_output_v1.h>
 #include <wlr/util/log.h>
@@ -40,15 +51,20 @@ static void server_new_input(struct wl_listener *listener, void *data) {
     case WLR_INPUT_DEVICE_POINTER:
         server_new_pointer(server, device);
         break;
+    case WLR_INPUT_DEVICE_TOUCH:
+        server_new_touch(server, device);
+        break;
+    case WLR_INPUT_DEVICE_TABLET:
+        server_new_tablet(server, device);
+        break;
+    case WLR_INPUT_DEVICE_TABLET_PAD:
+        server_new_tablet_pad(server, device);
+        break;
     default:
         break;
     }
 
-    uint32_t caps = WL_SEAT_CAPABILITY_POINTER;
-    if (!wl_list_empty(&server->keyboards)) {
-        caps |= WL_SEAT_CAPABILITY_KEYBOARD;
-    }
-    wlr_seat_set_capabilities(server->seat, caps);
+    seat_update_capabilities(server);
 }
 
 static void server_new_output(struct wl_listener *listener, void *data) {
@@ -73,16 +89,19 @@ static void server_new_output(struct wl_listener *listener, void *data) {
 }
 
 void server_init(struct planar_server *server) {
+    stats_objects_init(server);
     server->wl_display = wl_display_create();
     server->backend = wlr_backend_autocreate(wl_display_get_event_loop(server->wl_display), NULL);
     server->renderer = wlr_renderer_autocreate(server->backend);
-    wlr_renderer_init_wl_display(server->renderer, server->wl_display);
+    /* wl_shm only, linux-dmabuf is created below once the scene exists. */
+    wlr_renderer_init_wl_shm(server->renderer, server->wl_display);
 
     server->allocator = wlr_allocator_autocreate(server->backend, server->renderer);
 
-    wlr_compositor_create(server->wl_display, 5, server->renderer);
+    server->compositor = wlr_compositor_create(server->wl_display, 5, server->renderer);
     wlr_subcompositor_create(server->wl_display);
     wlr_data_device_manager_create(server->wl_display);
+    /* Legacy full-output copies, for tools without ext-image-copy-capture. */
     wlr_screencopy_manager_v1_create(server->wl_display);
 
     wl_list_init(&server->outputs);
@@ -93,15 +112,37 @@ void server_init(struct planar_server *server) {
 
     server->scene = wlr_scene_create();
 
+    /* With the scene attached, surfaces get per-surface feedback whose
+     * first tranche is the primary plane formats of the output they are
+     * on, so clients that could be scanned out allocate suitable buffers.
+     * Renderers that can't import dmabufs (pixman) don't offer it. */
+    if (wlr_renderer_get_texture_formats(server->renderer, WLR_BUFFER_CAP_DMABUF) != NULL) {
+        server->linux_dmabuf = wlr_linux_dmabuf_v1_create_with_renderer(
+            server->wl_display, 4, server->renderer);
+        wlr_scene_set_linux_dmabuf_v1(server->scene, server->linux_dmabuf);
+    }
+
     wlr_xdg_output_manager_v1_create(server->wl_display, server->output_layout);
+    /* Tells clients the clock commit timestamps are in. */
+    wlr_presentation_create(server->wl_display, server->backend, 2);
 
     server->scene_layout = wlr_scene_attach_output_layout(server->scene, server->output_layout);
 
     for (int i = 0; i < 4; i++) {
         server->layers[i] = wlr_scene_tree_create(&server->scene->tree);
     }
-
-    server->xdg_shell = wlr_xdg_shell_create(server->wl_display, 3);
+    server->canvas = wlr_scene_tree_create(&server->scene->tree);
+    wlr_scene_node_place_above(&server->canvas->node, &server->layers[1]->node);
+
+    /* The scene sends each surface the preferred scale of the output it
+     * is mostly on, clients then render at exactly that density and crop
+     * or scale through the viewporter instead of rendering at 2x. */
+    server->viewporter = wlr_viewporter_create(server->wl_display);
+    server->fractional_scale_manager =
+        wlr_fractional_scale_manager_v1_create(server->wl_display, 1);
+
+    /* Version 6 for the suspended state, see budget.c. */
+    server->xdg_shell = wlr_xdg_shell_create(server->wl_display, 6);
     assert(server->xdg_shell);
 
     server->layer_shell = wlr_layer_shell_v1_create(server->wl_display, 4);
@@ -110,6 +151,7 @@ void server_init(struct planar_server *server) {
     wl_signal_add(&server->layer_shell->events.new_surface, &server->new_layer_shell_surface);
 
     wl_list_init(&server->toplevels);
+    wl_list_init(&server->focus_stack);
     server->new_xdg_toplevel.notify = server_new_xdg_toplevel;
     wl_signal_add(&server->xdg_shell->events.new_toplevel, &server->new_xdg_toplevel);
 
@@ -126,16 +168,18 @@ void server_init(struct planar_server *server) {
     server->cursor_mode = PLANAR_CURSOR_PASSTHROUGH;
 
     cursor_init(server);
+    gestures_init(server);
+    touch_init(server);
 
-    wl_list_init(&server->keyboards);
+    input_init(server);
     server->new_input.notify = server_new_input;
     wl_signal_add(&server->backend->events.new_input, &server->new_input);
 
-    server->keyboard_repeat_source = wl_event_loop_add_timer(
-        wl_display_get_event_loop(server->wl_display),
-        keyboard_repeat_func, server);
+    keybindings_init(server);
 
     seat_init(server);
+    pointer_constraints_init(server);
+    tablet_init(server);
 
     server->global_offset.x = 0;
     server->global_offset.y = 0;
@@ -147,6 +191,29 @@ void server_init(struct planar_server *server) {
     }
 
     server->socket = socket;
+
+    capture_init(server);
+    commit_queue_init(server);
+    stats_init(server);
+    ipc_init(server);
+    trace_init(server);
+}
+
+static void find_headless(struct wlr_backend *backend, void *data) {
+    struct wlr_backend **headless = data;
+    if (wlr_backend_is_headless(backend)) {
+        *headless = backend;
+    }
+}
+
+struct wlr_backend *server_headless_backend(struct planar_server *server) {
+    struct wlr_backend *headless = NULL;
+    if (wlr_backend_is_multi(server->backend)) {
+        wlr_multi_for_each_backend(server->backend, find_headless, &headless);
+    } else {
+        find_headless(server->backend, &headless);
+    }
+    return headless;
 }
 
 void server_run(struct planar_server *server) {
@@ -159,13 +226,28 @@ void server_run(struct planar_server *server) {
 }
 
 void server_finish(struct planar_server *server) {
+    replay_finish(server);
+    recorder_finish(server);
+    remote_finish(server);
     wl_display_destroy_clients(server->wl_display);
+    upload_finish(server);
+    pointer_constraints_finish(server);
+    tablet_finish(server);
+    keybindings_finish(server);
+    trace_finish(server);
+    ipc_finish(server);
+    stats_finish(server);
+    capture_finish(server);
     wlr_scene_node_destroy(&server->scene->tree.node);
+    touch_finish(server);
+    gestures_finish(server);
     wlr_xcursor_manager_destroy(server->cursor_mgr);
     wlr_cursor_destroy(server->cursor);
     wlr_allocator_destroy(server->allocator);
     wlr_renderer_destroy(server->renderer);
+    input_finish(server);
     wlr_backend_destroy(server->backend);
     wl_display_destroy(server->wl_display);
     seat_finish(server);
+    stats_objects_finish(server);
 }
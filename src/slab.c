@@ -0,0 +1,123 @@
+#include "slab.h"
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/util/log.h>
+
+#define SLAB_POISON 0x6b
+
+struct planar_slab_page {
+    struct planar_slab_page *next;
+    alignas(max_align_t) unsigned char data[];
+};
+
+/* A free object's first word links it into the free list, the rest is
+ * poisoned in debug builds. */
+struct planar_slab_free {
+    struct planar_slab_free *next;
+};
+
+#ifdef PLANAR_SLAB_DEBUG
+static bool slab_poisoned(const struct planar_slab *slab, const void *object) {
+    const unsigned char *bytes = object;
+    for (size_t i = sizeof(struct planar_slab_free); i < slab->object_size; i++) {
+        if (bytes[i] != SLAB_POISON) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+void slab_init(struct planar_slab *slab, const char *name, size_t object_size) {
+    size_t align = alignof(max_align_t);
+    if (object_size < sizeof(struct planar_slab_free)) {
+        object_size = sizeof(struct planar_slab_free);
+    }
+    *slab = (struct planar_slab){
+        .name = name,
+        .object_size = (object_size + align - 1) & ~(align - 1),
+    };
+    slab->per_page = PLANAR_SLAB_PAGE_SIZE / slab->object_size;
+    if (slab->per_page == 0) {
+        slab->per_page = 1;
+    }
+}
+
+void slab_finish(struct planar_slab *slab) {
+    if (slab->live > 0) {
+        wlr_log(WLR_ERROR, "%u %s objects leaked", slab->live, slab->name);
+    }
+    struct planar_slab_page *page = slab->pages;
+    while (page) {
+        struct planar_slab_page *next = page->next;
+        free(page);
+        page = next;
+    }
+    slab->pages = NULL;
+    slab->free_list = NULL;
+    slab->n_pages = 0;
+}
+
+static bool slab_grow(struct planar_slab *slab) {
+    struct planar_slab_page *page =
+        malloc(sizeof(*page) + slab->per_page * slab->object_size);
+    if (!page) {
+        return false;
+    }
+    page->next = slab->pages;
+    slab->pages = page;
+    slab->n_pages++;
+
+    /* Thread the new objects so the first one is handed out first. */
+    for (size_t i = slab->per_page; i-- > 0;) {
+        struct planar_slab_free *object =
+            (struct planar_slab_free *)(page->data + i * slab->object_size);
+#ifdef PLANAR_SLAB_DEBUG
+        memset(object, SLAB_POISON, slab->object_size);
+#endif
+        object->next = slab->free_list;
+        slab->free_list = object;
+    }
+    return true;
+}
+
+void *slab_alloc(struct planar_slab *slab) {
+    if (!slab->free_list && !slab_grow(slab)) {
+        return NULL;
+    }
+    struct planar_slab_free *object = slab->free_list;
+    slab->free_list = object->next;
+#ifdef PLANAR_SLAB_DEBUG
+    if (!slab_poisoned(slab, object)) {
+        wlr_log(WLR_ERROR, "%s object %p was written to after being freed",
+            slab->name, (void *)object);
+    }
+#endif
+    memset(object, 0, slab->object_size);
+
+    slab->allocs++;
+    if (++slab->live > slab->peak) {
+        slab->peak = slab->live;
+    }
+    return object;
+}
+
+void slab_free(struct planar_slab *slab, void *object) {
+    if (!object) {
+        return;
+    }
+#ifdef PLANAR_SLAB_DEBUG
+    if (slab->object_size > sizeof(struct planar_slab_free) && slab_poisoned(slab, object)) {
+        wlr_log(WLR_ERROR, "%s object %p freed twice", slab->name, object);
+        return;
+    }
+    memset(object, SLAB_POISON, slab->object_size);
+#endif
+    struct planar_slab_free *free_object = object;
+    free_object->next = slab->free_list;
+    slab->free_list = free_object;
+    slab->live--;
+}
@@ -0,0 +1,341 @@
+#include "stats.h"
+#include "server.h"
+#include "ipc.h"
+#include "input.h"
+#include "layers.h"
+#include "output.h"
+#include "popup.h"
+#include "toplevel.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/util/log.h>
+
+uint64_t stats_timespec_to_ns(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000000ull + (uint64_t)ts->tv_nsec;
+}
+
+uint64_t stats_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return stats_timespec_to_ns(&now);
+}
+
+void stats_frame_record(struct planar_frame_stats *stats, uint64_t duration_ns) {
+    stats->frames++;
+    stats->last_duration_ns = duration_ns;
+    stats->total_duration_ns += duration_ns;
+    if (duration_ns > stats->max_duration_ns) {
+        stats->max_duration_ns = duration_ns;
+    }
+
+    stats->durations_ns[stats->history_head] = duration_ns;
+    stats->history_head = (stats->history_head + 1) % PLANAR_FRAME_HISTORY;
+    if (stats->history_len < PLANAR_FRAME_HISTORY) {
+        stats->history_len++;
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t history_percentile(const uint64_t *history, size_t len, double p) {
+    if (len == 0) {
+        return 0;
+    }
+
+    uint64_t sorted[PLANAR_FRAME_HISTORY > PLANAR_LATENCY_HISTORY ?
+        PLANAR_FRAME_HISTORY : PLANAR_LATENCY_HISTORY];
+    memcpy(sorted, history, len * sizeof(sorted[0]));
+    qsort(sorted, len, sizeof(sorted[0]), compare_u64);
+
+    size_t index = (size_t)(p * (len - 1) + 0.5);
+    return sorted[index];
+}
+
+uint64_t stats_frame_percentile(const struct planar_frame_stats *stats, double p) {
+    return history_percentile(stats->durations_ns, stats->history_len, p);
+}
+
+static void latency_stamp(struct planar_latency_stats *stats, uint64_t event_ns,
+        uint64_t dispatch_ns) {
+    if (stats->pending_dispatch_ns != 0 &&
+            dispatch_ns - stats->pending_dispatch_ns > PLANAR_LATENCY_TIMEOUT_NS) {
+        /* Nothing was drawn for the old input, start over from this one. */
+        stats->pending_dispatch_ns = 0;
+        stats->expired++;
+    }
+    if (stats->pending_dispatch_ns == 0) {
+        stats->pending_event_ns = event_ns;
+        stats->pending_dispatch_ns = dispatch_ns;
+    }
+}
+
+void stats_input_stamp(struct planar_server *server, struct wlr_output *wlr_output,
+        uint32_t time_msec) {
+    uint64_t dispatch_ns = stats_now_ns();
+    /* Device timestamps are CLOCK_MONOTONIC milliseconds for real devices.
+     * Synthetic ones (replay, virtual devices) may be anything, those only
+     * get the compositor side measured. */
+    uint64_t event_ns = (uint64_t)time_msec * 1000000ull;
+    if (event_ns > dispatch_ns || dispatch_ns - event_ns > PLANAR_LATENCY_TIMEOUT_NS) {
+        event_ns = dispatch_ns;
+    }
+
+    struct planar_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (!wlr_output || output->wlr_output == wlr_output) {
+            latency_stamp(&output->latency, event_ns, dispatch_ns);
+        }
+    }
+}
+
+void stats_latency_commit(struct planar_latency_stats *stats, uint32_t commit_seq) {
+    if (stats->pending_dispatch_ns == 0 || stats->in_flight) {
+        /* Inputs arriving while a frame is in flight wait for the next. */
+        return;
+    }
+    uint64_t now = stats_now_ns();
+    if (now - stats->pending_dispatch_ns > PLANAR_LATENCY_TIMEOUT_NS) {
+        stats->pending_dispatch_ns = 0;
+        stats->expired++;
+        return;
+    }
+    stats->in_flight = true;
+    stats->in_flight_seq = commit_seq;
+    stats->in_flight_event_ns = stats->pending_event_ns;
+    stats->in_flight_dispatch_ns = stats->pending_dispatch_ns;
+    stats->in_flight_commit_ns = now;
+    stats->pending_dispatch_ns = 0;
+}
+
+void stats_latency_present(struct planar_latency_stats *stats,
+        const struct wlr_output_event_present *event) {
+    if (!stats->in_flight || event->commit_seq != stats->in_flight_seq) {
+        return;
+    }
+    stats->in_flight = false;
+    if (!event->presented) {
+        /* The input is still not on screen, the next frame carries it. */
+        latency_stamp(stats, stats->in_flight_event_ns, stats->in_flight_dispatch_ns);
+        return;
+    }
+
+    uint64_t present_ns = stats_timespec_to_ns(&event->when);
+    if (present_ns < stats->in_flight_commit_ns) {
+        /* Backends without presentation feedback report the commit time. */
+        present_ns = stats->in_flight_commit_ns;
+    }
+    size_t head = stats->history_head;
+    stats->history_ns[PLANAR_LATENCY_DISPATCH][head] =
+        stats->in_flight_dispatch_ns - stats->in_flight_event_ns;
+    stats->history_ns[PLANAR_LATENCY_RENDER][head] =
+        stats->in_flight_commit_ns - stats->in_flight_dispatch_ns;
+    stats->history_ns[PLANAR_LATENCY_DISPLAY][head] =
+        present_ns - stats->in_flight_commit_ns;
+    stats->history_ns[PLANAR_LATENCY_TOTAL][head] =
+        present_ns - stats->in_flight_event_ns;
+
+    stats->samples++;
+    stats->history_head = (head + 1) % PLANAR_LATENCY_HISTORY;
+    if (stats->history_len < PLANAR_LATENCY_HISTORY) {
+        stats->history_len++;
+    }
+}
+
+uint64_t stats_latency_percentile(const struct planar_latency_stats *stats,
+        enum planar_latency_stage stage, double p) {
+    return history_percentile(stats->history_ns[stage], stats->history_len, p);
+}
+
+static void client_stats_destroy(struct wl_listener *listener, void *data) {
+    struct planar_client_stats *client = wl_container_of(listener, client, destroy);
+    if (client->throttled) {
+        client->stats->throttled_clients--;
+    }
+    wl_list_remove(&client->destroy.link);
+    wl_list_remove(&client->link);
+    free(client);
+}
+
+static struct planar_client_stats *stats_client_find(struct wl_client *wl_client) {
+    /* The destroy listener doubles as the per-client lookup, a client only
+     * has a handful of them. */
+    struct wl_listener *listener =
+        wl_client_get_destroy_late_listener(wl_client, client_stats_destroy);
+    if (!listener) {
+        return NULL;
+    }
+    struct planar_client_stats *client = wl_container_of(listener, client, destroy);
+    return client;
+}
+
+struct planar_client_stats *stats_client_get(struct planar_server *server,
+        struct wl_client *wl_client) {
+    struct planar_client_stats *client = stats_client_find(wl_client);
+    if (client) {
+        return client;
+    }
+
+    client = calloc(1, sizeof(*client));
+    if (!client) {
+        return NULL;
+    }
+    client->stats = &server->stats;
+    client->client = wl_client;
+    wl_client_get_credentials(wl_client, &client->pid, NULL, NULL);
+
+    /* Late, so the client's surfaces are gone before its stats: their
+     * destroy handlers still settle their accounts with it. */
+    client->destroy.notify = client_stats_destroy;
+    wl_client_add_destroy_late_listener(wl_client, &client->destroy);
+
+    wl_list_insert(&server->stats.clients, &client->link);
+    return client;
+}
+
+static uint64_t surface_damage_bytes(struct wlr_surface *surface) {
+    if (!(surface->current.committed & WLR_SURFACE_STATE_BUFFER) || !surface->buffer) {
+        return 0;
+    }
+    int n_boxes;
+    const pixman_box32_t *boxes = pixman_region32_rectangles(&surface->buffer_damage, &n_boxes);
+    uint64_t pixels = 0;
+    for (int i = 0; i < n_boxes; i++) {
+        pixels += (uint64_t)(boxes[i].x2 - boxes[i].x1) * (boxes[i].y2 - boxes[i].y1);
+    }
+    return pixels * 4;
+}
+
+void stats_client_commit(struct planar_client_stats *client, struct wlr_surface *surface) {
+    if (!client) {
+        return;
+    }
+    client->commits++;
+    client->bytes_uploaded += surface_damage_bytes(surface);
+
+    uint32_t budget = client->stats->commit_budget;
+    if (budget == 0) {
+        return;
+    }
+    /* The bucket holds a tenth of a second of commits, and the debt is
+     * capped at the same, so a client recovers quickly once it behaves. */
+    double burst = budget / 10.0 > 1 ? budget / 10.0 : 1;
+    uint64_t now = stats_now_ns();
+    if (client->tokens_ns == 0) {
+        client->tokens = burst;
+    } else {
+        client->tokens += (now - client->tokens_ns) * (budget / 1e9);
+        if (client->tokens > burst) {
+            client->tokens = burst;
+        }
+    }
+    client->tokens_ns = now;
+    client->tokens -= 1;
+    if (client->tokens < -burst) {
+        client->tokens = -burst;
+    }
+
+    bool throttled = client->tokens < 0;
+    if (throttled != client->throttled) {
+        client->throttled = throttled;
+        if (throttled) {
+            client->stats->throttled_clients++;
+        } else {
+            client->stats->throttled_clients--;
+        }
+    }
+}
+
+bool stats_client_frame_allowed(struct planar_server *server, struct wlr_surface *surface,
+        uint64_t now_ns) {
+    struct planar_stats *stats = &server->stats;
+    if (stats->throttled_clients == 0 || stats->commit_budget == 0) {
+        return true;
+    }
+    /* Only clients that committed can be throttled, and those have stats
+     * already. */
+    struct planar_client_stats *client =
+        stats_client_find(wl_resource_get_client(surface->resource));
+    if (!client || !client->throttled) {
+        return true;
+    }
+    uint64_t interval_ns = 1000000000ull / stats->commit_budget;
+    if (client->last_frame_done_ns != now_ns &&
+            now_ns - client->last_frame_done_ns < interval_ns) {
+        client->frames_deferred++;
+        return false;
+    }
+    client->last_frame_done_ns = now_ns;
+    return true;
+}
+
+static int stats_sample(void *data) {
+    /* Turn the raw counters into per-second rates and push a snapshot to
+     * any IPC subscribers. */
+    struct planar_server *server = data;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t elapsed_ns = stats_timespec_to_ns(&now) -
+        stats_timespec_to_ns(&server->stats.last_sample);
+    server->stats.last_sample = now;
+
+    if (elapsed_ns > 0) {
+        double seconds = elapsed_ns / 1e9;
+        struct planar_client_stats *client;
+        wl_list_for_each(client, &server->stats.clients, link) {
+            client->commit_rate = (client->commits - client->commits_sampled) / seconds;
+            client->commits_sampled = client->commits;
+            client->upload_rate = (client->bytes_uploaded - client->bytes_sampled) / seconds;
+            client->bytes_sampled = client->bytes_uploaded;
+        }
+    }
+
+    ipc_broadcast_stats(server);
+
+    wl_event_source_timer_update(server->stats.sample_timer, PLANAR_STATS_INTERVAL_MS);
+    return 0;
+}
+
+void stats_objects_init(struct planar_server *server) {
+    struct planar_object_stats *objects = &server->stats.objects;
+    slab_init(&objects->toplevels, "toplevel", sizeof(struct planar_toplevel));
+    slab_init(&objects->popups, "popup", sizeof(struct planar_popup));
+    slab_init(&objects->layer_surfaces, "layer surface", sizeof(struct planar_layer_surface));
+    slab_init(&objects->keyboards, "keyboard", sizeof(struct planar_keyboard));
+    slab_init(&objects->outputs, "output", sizeof(struct planar_output));
+}
+
+void stats_objects_finish(struct planar_server *server) {
+    struct planar_object_stats *objects = &server->stats.objects;
+    slab_finish(&objects->toplevels);
+    slab_finish(&objects->popups);
+    slab_finish(&objects->layer_surfaces);
+    slab_finish(&objects->keyboards);
+    slab_finish(&objects->outputs);
+}
+
+void stats_init(struct planar_server *server) {
+    wl_list_init(&server->stats.clients);
+    clock_gettime(CLOCK_MONOTONIC, &server->stats.last_sample);
+
+    server->stats.sample_timer = wl_event_loop_add_timer(
+        wl_display_get_event_loop(server->wl_display), stats_sample, server);
+    wl_event_source_timer_update(server->stats.sample_timer, PLANAR_STATS_INTERVAL_MS);
+}
+
+void stats_finish(struct planar_server *server) {
+    wl_event_source_remove(server->stats.sample_timer);
+
+    struct planar_client_stats *client, *tmp;
+    wl_list_for_each_safe(client, tmp, &server->stats.clients, link) {
+        wl_list_remove(&client->destroy.link);
+        wl_list_remove(&client->link);
+        free(client);
+    }
+}
@@ -0,0 +1,339 @@
+#include "tablet.h"
+#include "server.h"
+#include "cursor.h"
+#include "output.h"
+#include "toplevel.h"
+#include "layers.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <linux/input-event-codes.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/types/wlr_tablet_pad.h>
+#include <wlr/types/wlr_tablet_tool.h>
+
+static void tablet_pad_set_focus(struct planar_tablet_pad *pad,
+        struct wlr_tablet_v2_tablet *tablet_v2, struct wlr_surface *surface) {
+    if (pad->focus) {
+        wlr_tablet_v2_tablet_pad_notify_leave(pad->pad_v2, pad->focus);
+        wl_list_remove(&pad->focus_destroy.link);
+    }
+    pad->focus = surface;
+    if (!surface) {
+        return;
+    }
+    wlr_tablet_v2_tablet_pad_notify_enter(pad->pad_v2, tablet_v2, surface);
+    wl_signal_add(&surface->events.destroy, &pad->focus_destroy);
+}
+
+static void tablet_focus_at(struct planar_server *server, double lx, double ly) {
+    double sx, sy;
+    struct planar_toplevel *toplevel;
+    struct planar_layer_surface *layer_surface;
+    struct wlr_surface *surface = input_surface_at(server, lx, ly, &sx, &sy,
+        &toplevel, &layer_surface);
+    if (toplevel) {
+        focus_toplevel(toplevel, surface);
+    } else if (layer_surface) {
+        focus_layer_surface(layer_surface, surface);
+    }
+}
+
+static void tablet_tool_flush(struct planar_tablet_tool *tool) {
+    uint32_t pending = tool->pending;
+    if (!pending) {
+        return;
+    }
+    tool->pending = 0;
+    struct planar_server *server = tool->server;
+    struct wlr_tablet_v2_tablet_tool *tool_v2 = tool->tool_v2;
+
+    double sx, sy;
+    struct wlr_surface *surface = input_surface_at(server, tool->lx, tool->ly,
+        &sx, &sy, NULL, NULL);
+    if (!surface || !wlr_surface_accepts_tablet_v2(surface, tool->tablet_v2)) {
+        /* Clients without tablet support see the tool as a pointer. */
+        if (tool_v2->focused_surface) {
+            wlr_tablet_v2_tablet_tool_notify_proximity_out(tool_v2);
+        }
+        process_cursor_motion(server, tool->lx, tool->ly, tool->time_msec);
+        wlr_seat_pointer_notify_frame(server->seat);
+        tool->wheel_delta = 0;
+        return;
+    }
+
+    if (tool_v2->focused_surface != surface) {
+        if (tool_v2->focused_surface) {
+            wlr_tablet_v2_tablet_tool_notify_proximity_out(tool_v2);
+        }
+        wlr_tablet_v2_tablet_tool_notify_proximity_in(tool_v2, tool->tablet_v2, surface);
+        struct planar_tablet_pad *pad;
+        wl_list_for_each(pad, &server->tablets.pads, link) {
+            if (pad->focus != surface) {
+                tablet_pad_set_focus(pad, tool->tablet_v2, surface);
+            }
+        }
+        pending |= WLR_TABLET_TOOL_AXIS_X | WLR_TABLET_TOOL_AXIS_Y;
+    }
+
+    if (pending & (WLR_TABLET_TOOL_AXIS_X | WLR_TABLET_TOOL_AXIS_Y)) {
+        wlr_tablet_v2_tablet_tool_notify_motion(tool_v2, sx, sy);
+    }
+    if (pending & WLR_TABLET_TOOL_AXIS_PRESSURE) {
+        wlr_tablet_v2_tablet_tool_notify_pressure(tool_v2, tool->pressure);
+    }
+    if (pending & WLR_TABLET_TOOL_AXIS_DISTANCE) {
+        wlr_tablet_v2_tablet_tool_notify_distance(tool_v2, tool->distance);
+    }
+    if (pending & (WLR_TABLET_TOOL_AXIS_TILT_X | WLR_TABLET_TOOL_AXIS_TILT_Y)) {
+        wlr_tablet_v2_tablet_tool_notify_tilt(tool_v2, tool->tilt_x, tool->tilt_y);
+    }
+    if (pending & WLR_TABLET_TOOL_AXIS_ROTATION) {
+        wlr_tablet_v2_tablet_tool_notify_rotation(tool_v2, tool->rotation);
+    }
+    if (pending & WLR_TABLET_TOOL_AXIS_SLIDER) {
+        wlr_tablet_v2_tablet_tool_notify_slider(tool_v2, tool->slider);
+    }
+    if (pending & WLR_TABLET_TOOL_AXIS_WHEEL) {
+        wlr_tablet_v2_tablet_tool_notify_wheel(tool_v2, tool->wheel_delta, 0);
+        tool->wheel_delta = 0;
+    }
+}
+
+void tablet_frame(struct planar_server *server) {
+    TRACE_SCOPE("tablet_frame");
+    struct planar_tablet_tool *tool;
+    wl_list_for_each(tool, &server->tablets.tools, link) {
+        tablet_tool_flush(tool);
+    }
+}
+
+static void tablet_tool_destroy(struct wl_listener *listener, void *data) {
+    struct planar_tablet_tool *tool = wl_container_of(listener, tool, destroy);
+    wl_list_remove(&tool->link);
+    wl_list_remove(&tool->destroy.link);
+    free(tool);
+}
+
+static struct planar_tablet_tool *tablet_tool_get(struct planar_server *server,
+        struct wlr_tablet_tool *wlr_tool, struct wlr_tablet *wlr_tablet) {
+    struct planar_tablet_tool *tool = wlr_tool->data;
+    if (!tool) {
+        /* Tools are only known once they come near a tablet. */
+        tool = calloc(1, sizeof(*tool));
+        tool->server = server;
+        tool->tool_v2 = wlr_tablet_tool_create(server->tablets.manager,
+            server->seat, wlr_tool);
+        tool->destroy.notify = tablet_tool_destroy;
+        wl_signal_add(&wlr_tool->events.destroy, &tool->destroy);
+        wl_list_insert(&server->tablets.tools, &tool->link);
+        wlr_tool->data = tool;
+    }
+    tool->tablet_v2 = wlr_tablet->base.data;
+    return tool;
+}
+
+static void tablet_tool_axis(struct wl_listener *listener, void *data) {
+    TRACE_SCOPE("tablet_tool_axis");
+    struct planar_server *server = wl_container_of(listener, server, tablets.axis);
+    struct wlr_tablet_tool_axis_event *event = data;
+    struct planar_tablet_tool *tool = tablet_tool_get(server, event->tool, event->tablet);
+    uint32_t updated = event->updated_axes;
+
+    /* The cursor follows the tool right away, everything that involves
+     * a hit-test or a client waits for the next frame. */
+    if (event->tool->type == WLR_TABLET_TOOL_TYPE_MOUSE ||
+            event->tool->type == WLR_TABLET_TOOL_TYPE_LENS) {
+        wlr_cursor_move(server->cursor, &event->tablet->base, event->dx, event->dy);
+    } else if (updated & (WLR_TABLET_TOOL_AXIS_X | WLR_TABLET_TOOL_AXIS_Y)) {
+        wlr_cursor_warp_absolute(server->cursor, &event->tablet->base,
+            (updated & WLR_TABLET_TOOL_AXIS_X) ? event->x : NAN,
+            (updated & WLR_TABLET_TOOL_AXIS_Y) ? event->y : NAN);
+    }
+    tool->lx = server->cursor->x;
+    tool->ly = server->cursor->y;
+
+    if (updated & WLR_TABLET_TOOL_AXIS_PRESSURE) {
+        tool->pressure = event->pressure;
+    }
+    if (updated & WLR_TABLET_TOOL_AXIS_DISTANCE) {
+        tool->distance = event->distance;
+    }
+    if (updated & WLR_TABLET_TOOL_AXIS_TILT_X) {
+        tool->tilt_x = event->tilt_x;
+    }
+    if (updated & WLR_TABLET_TOOL_AXIS_TILT_Y) {
+        tool->tilt_y = event->tilt_y;
+    }
+    if (updated & WLR_TABLET_TOOL_AXIS_ROTATION) {
+        tool->rotation = event->rotation;
+    }
+    if (updated & WLR_TABLET_TOOL_AXIS_SLIDER) {
+        tool->slider = event->slider;
+    }
+    if (updated & WLR_TABLET_TOOL_AXIS_WHEEL) {
+        tool->wheel_delta += event->wheel_delta;
+    }
+
+    if (!tool->pending) {
+        output_schedule_frames(server);
+    }
+    tool->pending |= updated;
+    tool->time_msec = event->time_msec;
+}
+
+static void tablet_tool_proximity(struct wl_listener *listener, void *data) {
+    struct planar_server *server = wl_container_of(listener, server, tablets.proximity);
+    struct wlr_tablet_tool_proximity_event *event = data;
+    struct planar_tablet_tool *tool = tablet_tool_get(server, event->tool, event->tablet);
+
+    wlr_cursor_warp_absolute(server->cursor, &event->tablet->base, event->x, event->y);
+    tool->lx = server->cursor->x;
+    tool->ly = server->cursor->y;
+    tool->time_msec = event->time_msec;
+    tool->pending |= WLR_TABLET_TOOL_AXIS_X | WLR_TABLET_TOOL_AXIS_Y;
+    tablet_tool_flush(tool);
+
+    if (event->state == WLR_TABLET_TOOL_PROXIMITY_OUT && tool->tool_v2->focused_surface) {
+        wlr_tablet_v2_tablet_tool_notify_proximity_out(tool->tool_v2);
+    }
+}
+
+static void tablet_tool_tip(struct wl_listener *listener, void *data) {
+    TRACE_SCOPE("tablet_tool_tip");
+    struct planar_server *server = wl_container_of(listener, server, tablets.tip);
+    struct wlr_tablet_tool_tip_event *event = data;
+    struct planar_tablet_tool *tool = tablet_tool_get(server, event->tool, event->tablet);
+    bool down = event->state == WLR_TABLET_TOOL_TIP_DOWN;
+
+    tablet_tool_flush(tool);
+    if (down) {
+        tablet_focus_at(server, tool->lx, tool->ly);
+    }
+    if (tool->tool_v2->focused_surface) {
+        if (down) {
+            wlr_tablet_v2_tablet_tool_notify_down(tool->tool_v2);
+        } else {
+            wlr_tablet_v2_tablet_tool_notify_up(tool->tool_v2);
+        }
+        return;
+    }
+    /* Emulated pointer: the tip is the left button. */
+    wlr_seat_pointer_notify_button(server->seat, event->time_msec, BTN_LEFT,
+        down ? WL_POINTER_BUTTON_STATE_PRESSED : WL_POINTER_BUTTON_STATE_RELEASED);
+    wlr_seat_pointer_notify_frame(server->seat);
+}
+
+static void tablet_tool_button(struct wl_listener *listener, void *data) {
+    struct planar_server *server = wl_container_of(listener, server, tablets.button);
+    struct wlr_tablet_tool_button_event *event = data;
+    struct planar_tablet_tool *tool = tablet_tool_get(server, event->tool, event->tablet);
+
+    tablet_tool_flush(tool);
+    if (tool->tool_v2->focused_surface) {
+        wlr_tablet_v2_tablet_tool_notify_button(tool->tool_v2, event->button,
+            event->state == WLR_BUTTON_PRESSED ? ZWP_TABLET_PAD_V2_BUTTON_STATE_PRESSED :
+            ZWP_TABLET_PAD_V2_BUTTON_STATE_RELEASED);
+    }
+}
+
+void server_new_tablet(struct planar_server *server, struct wlr_input_device *device) {
+    /* Tools find their tablet_v2 through the device. */
+    device->data = wlr_tablet_create(server->tablets.manager, server->seat, device);
+    wlr_cursor_attach_input_device(server->cursor, device);
+}
+
+static void tablet_pad_button(struct wl_listener *listener, void *data) {
+    struct planar_tablet_pad *pad = wl_container_of(listener, pad, button);
+    struct wlr_tablet_pad_button_event *event = data;
+    if (!pad->focus) {
+        return;
+    }
+    wlr_tablet_v2_tablet_pad_notify_mode(pad->pad_v2, event->group, event->mode,
+        event->time_msec);
+    wlr_tablet_v2_tablet_pad_notify_button(pad->pad_v2, event->button, event->time_msec,
+        event->state == WLR_BUTTON_PRESSED ? ZWP_TABLET_PAD_V2_BUTTON_STATE_PRESSED :
+        ZWP_TABLET_PAD_V2_BUTTON_STATE_RELEASED);
+}
+
+static void tablet_pad_ring(struct wl_listener *listener, void *data) {
+    struct planar_tablet_pad *pad = wl_container_of(listener, pad, ring);
+    struct wlr_tablet_pad_ring_event *event = data;
+    if (pad->focus) {
+        wlr_tablet_v2_tablet_pad_notify_ring(pad->pad_v2, event->ring, event->position,
+            event->source == WLR_TABLET_PAD_RING_SOURCE_FINGER, event->time_msec);
+    }
+}
+
+static void tablet_pad_strip(struct wl_listener *listener, void *data) {
+    struct planar_tablet_pad *pad = wl_container_of(listener, pad, strip);
+    struct wlr_tablet_pad_strip_event *event = data;
+    if (pad->focus) {
+        wlr_tablet_v2_tablet_pad_notify_strip(pad->pad_v2, event->strip, event->position,
+            event->source == WLR_TABLET_PAD_STRIP_SOURCE_FINGER, event->time_msec);
+    }
+}
+
+static void tablet_pad_focus_destroy(struct wl_listener *listener, void *data) {
+    struct planar_tablet_pad *pad = wl_container_of(listener, pad, focus_destroy);
+    wl_list_remove(&pad->focus_destroy.link);
+    pad->focus = NULL;
+}
+
+static void tablet_pad_destroy(struct wl_listener *listener, void *data) {
+    struct planar_tablet_pad *pad = wl_container_of(listener, pad, destroy);
+    if (pad->focus) {
+        wl_list_remove(&pad->focus_destroy.link);
+    }
+    wl_list_remove(&pad->button.link);
+    wl_list_remove(&pad->ring.link);
+    wl_list_remove(&pad->strip.link);
+    wl_list_remove(&pad->destroy.link);
+    wl_list_remove(&pad->link);
+    free(pad);
+}
+
+void server_new_tablet_pad(struct planar_server *server, struct wlr_input_device *device) {
+    struct wlr_tablet_pad *wlr_pad = wlr_tablet_pad_from_input_device(device);
+    struct planar_tablet_pad *pad = calloc(1, sizeof(*pad));
+    pad->server = server;
+    pad->pad_v2 = wlr_tablet_pad_create(server->tablets.manager, server->seat, device);
+
+    pad->button.notify = tablet_pad_button;
+    wl_signal_add(&wlr_pad->events.button, &pad->button);
+    pad->ring.notify = tablet_pad_ring;
+    wl_signal_add(&wlr_pad->events.ring, &pad->ring);
+    pad->strip.notify = tablet_pad_strip;
+    wl_signal_add(&wlr_pad->events.strip, &pad->strip);
+    pad->focus_destroy.notify = tablet_pad_focus_destroy;
+    pad->destroy.notify = tablet_pad_destroy;
+    wl_signal_add(&device->events.destroy, &pad->destroy);
+
+    wl_list_insert(&server->tablets.pads, &pad->link);
+}
+
+void tablet_init(struct planar_server *server) {
+    struct planar_tablets *tablets = &server->tablets;
+    struct wlr_cursor *cursor = server->cursor;
+    tablets->manager = wlr_tablet_v2_create(server->wl_display);
+    wl_list_init(&tablets->tools);
+    wl_list_init(&tablets->pads);
+
+    tablets->axis.notify = tablet_tool_axis;
+    wl_signal_add(&cursor->events.tablet_tool_axis, &tablets->axis);
+    tablets->proximity.notify = tablet_tool_proximity;
+    wl_signal_add(&cursor->events.tablet_tool_proximity, &tablets->proximity);
+    tablets->tip.notify = tablet_tool_tip;
+    wl_signal_add(&cursor->events.tablet_tool_tip, &tablets->tip);
+    tablets->button.notify = tablet_tool_button;
+    wl_signal_add(&cursor->events.tablet_tool_button, &tablets->button);
+}
+
+void tablet_finish(struct planar_server *server) {
+    struct planar_tablets *tablets = &server->tablets;
+    wl_list_remove(&tablets->axis.link);
+    wl_list_remove(&tablets->proximity.link);
+    wl_list_remove(&tablets->tip.link);
+    wl_list_remove(&tablets->button.link);
+}
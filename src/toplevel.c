@@ -1,6 +1,8 @@
 #include "toplevel.h"
 #include "server.h"
+#include "capture.h"
 #include "cursor.h"
+#include "output.h"
 #include <stdlib.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/types/wlr_xdg_shell.h>
@@ -45,6 +47,8 @@ static void begin_interactive(struct planar_toplevel *toplevel,
 static void xdg_toplevel_map(struct wl_listener *listener, void *data) {
     struct planar_toplevel *toplevel = wl_container_of(listener, toplevel, map);
     wl_list_insert(&toplevel->server->toplevels, &toplevel->link);
+    wl_list_insert(&toplevel->server->focus_stack, &toplevel->focus_link);
+    capture_toplevel_map(toplevel);
     focus_toplevel(toplevel, toplevel->xdg_toplevel->base->surface);
 }
 
@@ -82,18 +86,69 @@ static void xdg_toplevel_move(
 
 static void xdg_toplevel_unmap(struct wl_listener *listener, void *data) {
     struct planar_toplevel *toplevel = wl_container_of(listener, toplevel, unmap);
+    struct planar_server *server = toplevel->server;
     wl_list_remove(&toplevel->link);
+    wl_list_remove(&toplevel->focus_link);
+    capture_toplevel_unmap(toplevel);
+    if (server->focus_cycle == toplevel) {
+        server->focus_cycle = NULL;
+    }
+
+    /* Hand the keyboard to whatever was focused before. */
+    struct wlr_surface *surface = toplevel->xdg_toplevel->base->surface;
+    if (server->seat->keyboard_state.focused_surface == surface &&
+            !wl_list_empty(&server->focus_stack)) {
+        struct planar_toplevel *next =
+            wl_container_of(server->focus_stack.next, next, focus_link);
+        focus_toplevel(next, next->xdg_toplevel->base->surface);
+    }
+}
+
+static void xdg_toplevel_set_title(struct wl_listener *listener, void *data) {
+    struct planar_toplevel *toplevel = wl_container_of(listener, toplevel, set_title);
+    capture_toplevel_update(toplevel);
+}
+
+static void xdg_toplevel_set_app_id(struct wl_listener *listener, void *data) {
+    struct planar_toplevel *toplevel = wl_container_of(listener, toplevel, set_app_id);
+    capture_toplevel_update(toplevel);
 }
 
 static void xdg_toplevel_commit(struct wl_listener *listener, void *data) {
+    TRACE_SCOPE("xdg_toplevel_commit");
     struct planar_toplevel *toplevel = wl_container_of(listener, toplevel, commit);
-    if (toplevel->xdg_toplevel->base->initial_commit) {
+    stats_client_commit(toplevel->client_stats, toplevel->xdg_toplevel->base->surface);
+    budget_toplevel_commit(toplevel);
+    struct wlr_xdg_surface *base = toplevel->xdg_toplevel->base;
+    if (base->initial_commit) {
         wlr_xdg_toplevel_set_size(toplevel->xdg_toplevel, 0, 0);
     }
+    transaction_toplevel_commit(toplevel);
+}
+
+void toplevel_configure(struct planar_toplevel *toplevel, int x, int y,
+        int width, int height) {
+    if (toplevel->instruction) {
+        toplevel->pending_x = x;
+        toplevel->pending_y = y;
+        toplevel->pending_width = width;
+        toplevel->pending_height = height;
+        toplevel->resize_pending = true;
+        return;
+    }
+    struct planar_transaction *transaction = transaction_create(toplevel->server);
+    if (!transaction) {
+        return;
+    }
+    transaction_add(transaction, toplevel, x, y, width, height);
+    transaction_commit(transaction);
 }
 
 static void xdg_toplevel_destroy(struct wl_listener *listener, void *data) {
     struct planar_toplevel *toplevel = wl_container_of(listener, toplevel, destroy);
+    transaction_toplevel_destroy(toplevel);
+    capture_toplevel_destroy(toplevel);
+    budget_toplevel_destroy(toplevel);
     wl_list_remove(&toplevel->map.link);
     wl_list_remove(&toplevel->unmap.link);
     wl_list_remove(&toplevel->commit.link);
@@ -102,17 +157,21 @@ static void xdg_toplevel_destroy(struct wl_listener *listener, void *data) {
     wl_list_remove(&toplevel->request_resize.link);
     wl_list_remove(&toplevel->request_maximize.link);
     wl_list_remove(&toplevel->request_fullscreen.link);
-    free(toplevel);
+    wl_list_remove(&toplevel->set_title.link);
+    wl_list_remove(&toplevel->set_app_id.link);
+    slab_free(&toplevel->server->stats.objects.toplevels, toplevel);
 }
 
 void server_new_xdg_toplevel(struct wl_listener *listener, void *data) {
     struct planar_server *server = wl_container_of(listener, server, new_xdg_toplevel);
     struct wlr_xdg_toplevel *xdg_toplevel = data;
-    struct wlr_scene_tree *layer_tree = server->layers[1];
-    struct planar_toplevel *toplevel = calloc(1, sizeof(*toplevel));
+    struct wlr_scene_tree *layer_tree = server->canvas;
+    struct planar_toplevel *toplevel = slab_alloc(&server->stats.objects.toplevels);
 
     toplevel->server = server;
     toplevel->xdg_toplevel = xdg_toplevel;
+    toplevel->client_stats = stats_client_get(server,
+        wl_resource_get_client(xdg_toplevel->resource));
     toplevel->scene_tree = wlr_scene_xdg_surface_create(layer_tree, xdg_toplevel->base);
     toplevel->scene_tree->node.data = toplevel;
     xdg_toplevel->base->data = toplevel->scene_tree;
@@ -135,6 +194,10 @@ void server_new_xdg_toplevel(struct wl_listener *listener, void *data) {
     wl_signal_add(&xdg_toplevel->events.request_maximize, &toplevel->request_maximize);
     toplevel->request_fullscreen.notify = xdg_toplevel_fullscreen;
     wl_signal_add(&xdg_toplevel->events.request_fullscreen, &toplevel->request_fullscreen);
+    toplevel->set_title.notify = xdg_toplevel_set_title;
+    wl_signal_add(&xdg_toplevel->events.set_title, &toplevel->set_title);
+    toplevel->set_app_id.notify = xdg_toplevel_set_app_id;
+    wl_signal_add(&xdg_toplevel->events.set_app_id, &toplevel->set_app_id);
 }
 
 void focus_toplevel(struct planar_toplevel *toplevel, struct wlr_surface *surface) {
@@ -156,8 +219,12 @@ void focus_toplevel(struct planar_toplevel *toplevel, struct wlr_surface *surfac
     struct wlr_keyboard *keyboard = wlr_seat_get_keyboard(seat);
 
     wlr_scene_node_raise_to_top(&toplevel->scene_tree->node);
-    wl_list_remove(&toplevel->link);
-    wl_list_insert(&server->toplevels, &toplevel->link);
+    if (server->focus_cycle != toplevel) {
+        /* Focus from anywhere but the cycle ends it. */
+        server->focus_cycle = NULL;
+        wl_list_remove(&toplevel->focus_link);
+        wl_list_insert(&server->focus_stack, &toplevel->focus_link);
+    }
 
     wlr_xdg_toplevel_set_activated(toplevel->xdg_toplevel, true);
 
@@ -165,11 +232,75 @@ void focus_toplevel(struct planar_toplevel *toplevel, struct wlr_surface *surfac
         wlr_seat_keyboard_notify_enter(seat, toplevel->xdg_toplevel->base->surface,
                                        keyboard->keycodes, keyboard->num_keycodes, &keyboard->modifiers);
     }
+    pointer_constraints_update(server);
+}
+
+void toplevel_center_offset(struct planar_toplevel *toplevel, double *x, double *y) {
+    struct planar_server *server = toplevel->server;
+    struct wlr_box *geo_box = &toplevel->xdg_toplevel->base->geometry;
+    struct wlr_box layout_box;
+    wlr_output_layout_get_box(server->output_layout, NULL, &layout_box);
+
+    *x = layout_box.x + layout_box.width / 2.0 -
+        (toplevel->scene_tree->node.x + geo_box->x + geo_box->width / 2.0);
+    *y = layout_box.y + layout_box.height / 2.0 -
+        (toplevel->scene_tree->node.y + geo_box->y + geo_box->height / 2.0);
+}
+
+static bool toplevel_in_view(struct planar_toplevel *toplevel) {
+    struct planar_server *server = toplevel->server;
+    struct wlr_box *geo_box = &toplevel->xdg_toplevel->base->geometry;
+    struct wlr_box layout_box;
+    wlr_output_layout_get_box(server->output_layout, NULL, &layout_box);
+
+    double x = toplevel->scene_tree->node.x + geo_box->x;
+    double y = toplevel->scene_tree->node.y + geo_box->y;
+    convert_scene_coords_to_global(server, &x, &y);
+    return x >= layout_box.x && y >= layout_box.y &&
+        x + geo_box->width <= layout_box.x + layout_box.width &&
+        y + geo_box->height <= layout_box.y + layout_box.height;
+}
+
+void focus_cycle(struct planar_server *server, bool next) {
+    struct wl_list *stack = &server->focus_stack;
+    if (stack->next == stack->prev) {
+        /* Fewer than two toplevels, nothing to cycle to. */
+        return;
+    }
+    struct wl_list *link = server->focus_cycle ?
+        &server->focus_cycle->focus_link : stack->next;
+    link = next ? link->next : link->prev;
+    if (link == stack) {
+        link = next ? link->next : link->prev;
+    }
+
+    struct planar_toplevel *toplevel = wl_container_of(link, toplevel, focus_link);
+    server->focus_cycle = toplevel;
+    focus_toplevel(toplevel, toplevel->xdg_toplevel->base->surface);
+    if (!toplevel_in_view(toplevel)) {
+        double x, y;
+        toplevel_center_offset(toplevel, &x, &y);
+        output_pan_to(server, x, y);
+    }
+}
+
+void focus_cycle_end(struct planar_server *server) {
+    struct planar_toplevel *toplevel = server->focus_cycle;
+    if (!toplevel) {
+        return;
+    }
+    server->focus_cycle = NULL;
+    wl_list_remove(&toplevel->focus_link);
+    wl_list_insert(&server->focus_stack, &toplevel->focus_link);
 }
 
 struct planar_toplevel *desktop_toplevel_at(struct planar_server *server, double lx, double ly,
-                                            struct wlr_surface **surface, double *sx, double *sy) { 
-    struct wlr_scene_node *node = wlr_scene_node_at(&server->scene->tree.node, lx, ly, sx, sy);
+                                            struct wlr_surface **surface, double *sx, double *sy) {
+    /* This returns the topmost node on the canvas at the given layout coords.
+     * We only care about surface nodes as we are specifically looking for a
+     * surface in the surface tree of a planar_toplevel. */
+    TRACE_SCOPE("desktop_toplevel_at");
+    struct wlr_scene_node *node = wlr_scene_node_at(&server->canvas->node, lx, ly, sx, sy);
     if (node == NULL || node->type != WLR_SCENE_NODE_BUFFER) {
         return NULL;
     }
@@ -180,7 +311,8 @@ struct planar_toplevel *desktop_toplevel_at(struct planar_server *server, double
     }
 
     *surface = scene_surface->surface;
-
+    /* Find the node corresponding to the planar_toplevel at the root of this
+     * surface tree, it is the only one for which we set the data field. */
     struct wlr_scene_tree *tree = node->parent;
     while (tree != NULL && tree->node.data == NULL) {
         tree = tree->node.parent;
@@ -0,0 +1,189 @@
+#include "touch.h"
+#include "server.h"
+#include "cursor.h"
+#include "output.h"
+#include "toplevel.h"
+#include "layers.h"
+#include "seat.h"
+
+#include <stdlib.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/types/wlr_touch.h>
+
+struct planar_touch_device {
+    struct planar_server *server;
+    struct wl_listener destroy;
+};
+
+static struct planar_touch_point *touch_point_get(struct planar_touch *touch, int32_t id) {
+    for (int i = 0; i < PLANAR_TOUCH_POINTS; i++) {
+        if (touch->points[i].active && touch->points[i].id == id) {
+            return &touch->points[i];
+        }
+    }
+    return NULL;
+}
+
+static void touch_point_release(struct planar_touch *touch, struct planar_touch_point *point) {
+    if (point->canvas) {
+        touch->n_canvas_points--;
+    }
+    point->active = false;
+}
+
+static void touch_down(struct wl_listener *listener, void *data) {
+    TRACE_SCOPE("touch_down");
+    struct planar_server *server = wl_container_of(listener, server, touch.down);
+    struct planar_touch *touch = &server->touch;
+    struct wlr_touch_down_event *event = data;
+
+    struct planar_touch_point *point = NULL;
+    for (int i = 0; i < PLANAR_TOUCH_POINTS; i++) {
+        if (!touch->points[i].active) {
+            point = &touch->points[i];
+            break;
+        }
+    }
+    if (!point) {
+        return;
+    }
+
+    double lx, ly, sx, sy;
+    wlr_cursor_absolute_to_layout_coords(server->cursor, &event->touch->base,
+        event->x, event->y, &lx, &ly);
+    struct planar_toplevel *toplevel;
+    struct planar_layer_surface *layer_surface;
+    struct wlr_surface *surface = input_surface_at(server, lx, ly, &sx, &sy,
+        &toplevel, &layer_surface);
+
+    *point = (struct planar_touch_point){ .id = event->touch_id, .active = true };
+    if (!surface) {
+        point->canvas = true;
+        point->x = lx;
+        point->y = ly;
+        touch->n_canvas_points++;
+        return;
+    }
+    point->x = lx - sx;
+    point->y = ly - sy;
+    if (toplevel) {
+        focus_toplevel(toplevel, surface);
+    } else if (layer_surface) {
+        focus_layer_surface(layer_surface, surface);
+    }
+    wlr_seat_touch_notify_down(server->seat, surface, event->time_msec,
+        event->touch_id, sx, sy);
+}
+
+static void touch_up(struct wl_listener *listener, void *data) {
+    struct planar_server *server = wl_container_of(listener, server, touch.up);
+    struct planar_touch *touch = &server->touch;
+    struct wlr_touch_up_event *event = data;
+
+    struct planar_touch_point *point = touch_point_get(touch, event->touch_id);
+    if (!point) {
+        return;
+    }
+    if (!point->canvas) {
+        wlr_seat_touch_notify_up(server->seat, event->time_msec, event->touch_id);
+    }
+    touch_point_release(touch, point);
+}
+
+static void touch_motion(struct wl_listener *listener, void *data) {
+    TRACE_SCOPE("touch_motion");
+    struct planar_server *server = wl_container_of(listener, server, touch.motion);
+    struct planar_touch *touch = &server->touch;
+    struct wlr_touch_motion_event *event = data;
+
+    struct planar_touch_point *point = touch_point_get(touch, event->touch_id);
+    if (!point) {
+        return;
+    }
+    double lx, ly;
+    wlr_cursor_absolute_to_layout_coords(server->cursor, &event->touch->base,
+        event->x, event->y, &lx, &ly);
+    if (!point->canvas) {
+        /* Touch points stay with the surface they went down on. */
+        wlr_seat_touch_notify_motion(server->seat, event->time_msec,
+            event->touch_id, lx - point->x, ly - point->y);
+        return;
+    }
+
+    /* Several fingers on the canvas drag it by their average motion. */
+    server->gestures.pending_dx += (lx - point->x) / touch->n_canvas_points;
+    server->gestures.pending_dy += (ly - point->y) / touch->n_canvas_points;
+    point->x = lx;
+    point->y = ly;
+    output_schedule_frames(server);
+}
+
+static void touch_cancel(struct wl_listener *listener, void *data) {
+    struct planar_server *server = wl_container_of(listener, server, touch.cancel);
+    struct planar_touch *touch = &server->touch;
+    struct wlr_touch_cancel_event *event = data;
+
+    struct planar_touch_point *point = touch_point_get(touch, event->touch_id);
+    if (!point) {
+        return;
+    }
+    if (!point->canvas) {
+        struct wlr_touch_point *seat_point =
+            wlr_seat_touch_get_point(server->seat, event->touch_id);
+        if (seat_point && seat_point->client) {
+            wlr_seat_touch_notify_cancel(server->seat, seat_point->client);
+        }
+    }
+    touch_point_release(touch, point);
+}
+
+static void touch_frame(struct wl_listener *listener, void *data) {
+    struct planar_server *server = wl_container_of(listener, server, touch.frame);
+    wlr_seat_touch_notify_frame(server->seat);
+}
+
+static void touch_device_destroy(struct wl_listener *listener, void *data) {
+    struct planar_touch_device *device = wl_container_of(listener, device, destroy);
+    struct planar_server *server = device->server;
+    server->touch.n_devices--;
+    seat_update_capabilities(server);
+    wl_list_remove(&device->destroy.link);
+    free(device);
+}
+
+void server_new_touch(struct planar_server *server, struct wlr_input_device *device) {
+    struct planar_touch_device *touch_device = calloc(1, sizeof(*touch_device));
+    touch_device->server = server;
+    touch_device->destroy.notify = touch_device_destroy;
+    wl_signal_add(&device->events.destroy, &touch_device->destroy);
+
+    /* The cursor maps the device to its output and forwards its events. */
+    wlr_cursor_attach_input_device(server->cursor, device);
+    server->touch.n_devices++;
+}
+
+void touch_init(struct planar_server *server) {
+    struct planar_touch *touch = &server->touch;
+    struct wlr_cursor *cursor = server->cursor;
+
+    touch->down.notify = touch_down;
+    wl_signal_add(&cursor->events.touch_down, &touch->down);
+    touch->up.notify = touch_up;
+    wl_signal_add(&cursor->events.touch_up, &touch->up);
+    touch->motion.notify = touch_motion;
+    wl_signal_add(&cursor->events.touch_motion, &touch->motion);
+    touch->cancel.notify = touch_cancel;
+    wl_signal_add(&cursor->events.touch_cancel, &touch->cancel);
+    touch->frame.notify = touch_frame;
+    wl_signal_add(&cursor->events.touch_frame, &touch->frame);
+}
+
+void touch_finish(struct planar_server *server) {
+    struct planar_touch *touch = &server->touch;
+    wl_list_remove(&touch->down.link);
+    wl_list_remove(&touch->up.link);
+    wl_list_remove(&touch->motion.link);
+    wl_list_remove(&touch->cancel.link);
+    wl_list_remove(&touch->frame.link);
+}
@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include "server.h"
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+#ifdef PLANAR_TRACE
+/* A slot's sequence number is index + 1 once its event is complete, and 0
+ * while a writer is filling it in, so readers can skip torn slots. */
+struct planar_trace_event {
+    _Atomic uint64_t seq;
+    const char *name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    pid_t tid;
+};
+
+static struct planar_trace_event trace_ring[PLANAR_TRACE_EVENTS];
+static _Atomic uint64_t trace_head;
+
+static pid_t trace_tid(void) {
+    static _Thread_local pid_t tid;
+    if (!tid) {
+        tid = gettid();
+    }
+    return tid;
+}
+#endif
+
+void trace_span_end(struct planar_trace_span *span) {
+#ifdef PLANAR_TRACE
+    uint64_t end_ns = stats_now_ns();
+    uint64_t index = atomic_fetch_add_explicit(&trace_head, 1, memory_order_relaxed);
+    struct planar_trace_event *event = &trace_ring[index & (PLANAR_TRACE_EVENTS - 1)];
+
+    atomic_store_explicit(&event->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    event->name = span->name;
+    event->start_ns = span->start_ns;
+    event->duration_ns = end_ns - span->start_ns;
+    event->tid = trace_tid();
+    atomic_store_explicit(&event->seq, index + 1, memory_order_release);
+#else
+    (void)span;
+#endif
+}
+
+bool trace_dump(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        wlr_log_errno(WLR_ERROR, "Unable to write trace to %s", path);
+        return false;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+        "\"args\":{\"name\":\"planar\"}}", getpid());
+    size_t written = 0;
+#ifdef PLANAR_TRACE
+    uint64_t head = atomic_load_explicit(&trace_head, memory_order_acquire);
+    uint64_t first = head > PLANAR_TRACE_EVENTS ? head - PLANAR_TRACE_EVENTS : 0;
+    for (uint64_t i = first; i < head; i++) {
+        struct planar_trace_event *slot = &trace_ring[i & (PLANAR_TRACE_EVENTS - 1)];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != i + 1) {
+            continue;
+        }
+        struct planar_trace_event event = {
+            .name = slot->name,
+            .start_ns = slot->start_ns,
+            .duration_ns = slot->duration_ns,
+            .tid = slot->tid,
+        };
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != i + 1) {
+            /* Overwritten while we were copying it. */
+            continue;
+        }
+        fprintf(file, ",{\"name\":\"%s\",\"cat\":\"planar\",\"ph\":\"X\","
+            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+            event.name, event.start_ns / 1e3, event.duration_ns / 1e3,
+            getpid(), event.tid);
+        written++;
+    }
+#endif
+    fprintf(file, "]}\n");
+
+    bool ok = fclose(file) == 0;
+    wlr_log(WLR_INFO, "Wrote %zu trace events to %s", written, path);
+    return ok;
+}
+
+void trace_default_path(char *path, size_t size) {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    snprintf(path, size, "%s/planar-trace.%d.json", dir ? dir : "/tmp", getpid());
+}
+
+static int trace_handle_signal(int signal, void *data) {
+    char path[256];
+    trace_default_path(path, sizeof(path));
+    trace_dump(path);
+    return 0;
+}
+
+void trace_init(struct planar_server *server) {
+#ifndef PLANAR_TRACE
+    wlr_log(WLR_DEBUG, "Tracing is compiled out, dumps will be empty");
+#endif
+    server->trace_signal = wl_event_loop_add_signal(
+        wl_display_get_event_loop(server->wl_display), SIGUSR1,
+        trace_handle_signal, server);
+}
+
+void trace_finish(struct planar_server *server) {
+    if (server->trace_signal) {
+        wl_event_source_remove(server->trace_signal);
+        server->trace_signal = NULL;
+    }
+}
@@ -0,0 +1,126 @@
+#include "transaction.h"
+#include "server.h"
+#include "toplevel.h"
+
+#include <stdlib.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/log.h>
+
+static void transaction_apply(struct planar_transaction *transaction) {
+    TRACE_SCOPE("transaction_apply");
+    if (transaction->timer) {
+        wl_event_source_remove(transaction->timer);
+    }
+    struct planar_transaction_instruction *instruction, *tmp;
+    wl_list_for_each_safe(instruction, tmp, &transaction->instructions, link) {
+        struct planar_toplevel *toplevel = instruction->toplevel;
+        wlr_scene_node_set_position(&toplevel->scene_tree->node,
+            instruction->x, instruction->y);
+        toplevel->instruction = NULL;
+        wl_list_remove(&instruction->link);
+        free(instruction);
+
+        if (toplevel->resize_pending) {
+            /* The geometry kept changing while we waited. */
+            toplevel->resize_pending = false;
+            toplevel_configure(toplevel, toplevel->pending_x, toplevel->pending_y,
+                toplevel->pending_width, toplevel->pending_height);
+        }
+    }
+    free(transaction);
+}
+
+static void transaction_check(struct planar_transaction *transaction) {
+    if (transaction->committed && transaction->n_waiting == 0) {
+        transaction_apply(transaction);
+    }
+}
+
+static int transaction_handle_timeout(void *data) {
+    struct planar_transaction *transaction = data;
+    wlr_log(WLR_DEBUG, "Transaction timed out with %zu clients not ready",
+        transaction->n_waiting);
+    wl_event_source_remove(transaction->timer);
+    transaction->timer = NULL;
+    transaction_apply(transaction);
+    return 0;
+}
+
+static void instruction_remove(struct planar_transaction_instruction *instruction) {
+    struct planar_transaction *transaction = instruction->transaction;
+    if (instruction->serial) {
+        transaction->n_waiting--;
+    }
+    instruction->toplevel->instruction = NULL;
+    wl_list_remove(&instruction->link);
+    free(instruction);
+    transaction_check(transaction);
+}
+
+struct planar_transaction *transaction_create(struct planar_server *server) {
+    struct planar_transaction *transaction = calloc(1, sizeof(*transaction));
+    if (!transaction) {
+        return NULL;
+    }
+    transaction->server = server;
+    wl_list_init(&transaction->instructions);
+    return transaction;
+}
+
+void transaction_add(struct planar_transaction *transaction,
+        struct planar_toplevel *toplevel, int x, int y, int width, int height) {
+    if (toplevel->instruction) {
+        instruction_remove(toplevel->instruction);
+    }
+    struct planar_transaction_instruction *instruction = calloc(1, sizeof(*instruction));
+    if (!instruction) {
+        return;
+    }
+    instruction->transaction = transaction;
+    instruction->toplevel = toplevel;
+    instruction->x = x;
+    instruction->y = y;
+
+    struct wlr_box *geo_box = &toplevel->xdg_toplevel->base->geometry;
+    if (width != geo_box->width || height != geo_box->height) {
+        instruction->serial = wlr_xdg_toplevel_set_size(toplevel->xdg_toplevel,
+            width, height);
+        transaction->n_waiting++;
+    }
+    toplevel->instruction = instruction;
+    wl_list_insert(transaction->instructions.prev, &instruction->link);
+}
+
+void transaction_commit(struct planar_transaction *transaction) {
+    transaction->committed = true;
+    if (transaction->n_waiting == 0) {
+        transaction_apply(transaction);
+        return;
+    }
+    transaction->timer = wl_event_loop_add_timer(
+        wl_display_get_event_loop(transaction->server->wl_display),
+        transaction_handle_timeout, transaction);
+    wl_event_source_timer_update(transaction->timer, PLANAR_TRANSACTION_TIMEOUT_MS);
+}
+
+void transaction_toplevel_commit(struct planar_toplevel *toplevel) {
+    struct planar_transaction_instruction *instruction = toplevel->instruction;
+    if (!instruction || !instruction->serial) {
+        return;
+    }
+    /* Any state at or past our configure has the new size. */
+    uint32_t current = toplevel->xdg_toplevel->base->current.configure_serial;
+    if ((int32_t)(current - instruction->serial) < 0) {
+        return;
+    }
+    instruction->serial = 0;
+    instruction->transaction->n_waiting--;
+    transaction_check(instruction->transaction);
+}
+
+void transaction_toplevel_destroy(struct planar_toplevel *toplevel) {
+    if (toplevel->instruction) {
+        instruction_remove(toplevel->instruction);
+    }
+}
@@ -0,0 +1,516 @@
+#define _GNU_SOURCE
+#include "upload.h"
+#include "server.h"
+#include "trace.h"
+
+#include <drm_fourcc.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/util/log.h>
+
+/* Below this many damaged pixels the copy costs less than waking a worker
+ * and holding the commit back. */
+#define UPLOAD_ASYNC_MIN_PIXELS (256 * 256)
+#define UPLOAD_BAND_ROWS 64
+
+struct planar_upload;
+
+struct upload_band {
+    struct wl_list link;
+    struct planar_upload *upload;
+    int y1, y2;
+};
+
+/* A commit that attached a new buffer, until it's applied. */
+struct planar_upload {
+    struct wl_list link;
+    struct wl_list flight_link;
+    struct wl_list done_link;
+    /* NULL once the surface is gone. */
+    struct planar_upload_surface *surface;
+    uint32_t seq;
+    /* The surface lock holding the commit back, while in flight. */
+    uint32_t lock_seq;
+    bool ready;
+
+    /* NULL if the buffer wasn't uploaded. */
+    struct planar_upload_image *image;
+    struct wlr_buffer *buffer;
+    const uint8_t *data;
+    size_t stride;
+    pixman_region32_t region;
+
+    struct upload_band *bands;
+    _Atomic size_t remaining;
+};
+
+static bool upload_format_supported(uint32_t format) {
+    /* What render threads can draw. */
+    return format == DRM_FORMAT_ARGB8888 || format == DRM_FORMAT_XRGB8888 ||
+        format == DRM_FORMAT_ABGR8888 || format == DRM_FORMAT_XBGR8888;
+}
+
+struct planar_upload_image *upload_image_ref(struct planar_upload_image *image) {
+    image->refs++;
+    return image;
+}
+
+void upload_image_unref(struct planar_upload_image *image) {
+    if (--image->refs > 0) {
+        return;
+    }
+    pixman_region32_fini(&image->stale);
+    free(image->data);
+    free(image);
+}
+
+static struct planar_upload_image *upload_image_create(int width, int height,
+        uint32_t format) {
+    struct planar_upload_image *image = calloc(1, sizeof(*image));
+    if (!image) {
+        return NULL;
+    }
+    image->stride = (size_t)width * 4;
+    image->data = malloc(image->stride * height);
+    if (!image->data) {
+        free(image);
+        return NULL;
+    }
+    image->refs = 1;
+    image->width = width;
+    image->height = height;
+    image->format = format;
+    pixman_region32_init_rect(&image->stale, 0, 0, width, height);
+    return image;
+}
+
+static void upload_copy_rows(struct planar_upload *upload, int y1, int y2) {
+    struct planar_upload_image *image = upload->image;
+    int n_boxes;
+    const pixman_box32_t *boxes = pixman_region32_rectangles(&upload->region, &n_boxes);
+    for (int i = 0; i < n_boxes; i++) {
+        int top = boxes[i].y1 > y1 ? boxes[i].y1 : y1;
+        int bottom = boxes[i].y2 < y2 ? boxes[i].y2 : y2;
+        size_t x = (size_t)boxes[i].x1 * 4;
+        size_t row = (size_t)(boxes[i].x2 - boxes[i].x1) * 4;
+        for (int y = top; y < bottom; y++) {
+            memcpy((uint8_t *)image->data + y * image->stride + x,
+                upload->data + y * upload->stride + x, row);
+        }
+    }
+}
+
+static void upload_destroy(struct planar_upload *upload) {
+    if (upload->buffer) {
+        wlr_buffer_unlock(upload->buffer);
+    }
+    if (upload->image) {
+        upload_image_unref(upload->image);
+    }
+    pixman_region32_fini(&upload->region);
+    free(upload->bands);
+    wl_list_remove(&upload->link);
+    free(upload);
+}
+
+static void upload_complete(struct planar_upload *upload) {
+    wl_list_remove(&upload->flight_link);
+    wl_list_init(&upload->flight_link);
+    wlr_buffer_unlock(upload->buffer);
+    upload->buffer = NULL;
+    free(upload->bands);
+    upload->bands = NULL;
+
+    if (!upload->surface) {
+        upload_destroy(upload);
+        return;
+    }
+    upload->ready = true;
+    /* Applies the commit, unless something else still holds it. */
+    wlr_surface_unlock_cached(upload->surface->surface, upload->lock_seq);
+}
+
+static void *upload_worker_run(void *data) {
+    struct planar_upload_pool *pool = data;
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (wl_list_empty(&pool->bands) && !pool->stop) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        struct upload_band *band = wl_container_of(pool->bands.next, band, link);
+        wl_list_remove(&band->link);
+        pthread_mutex_unlock(&pool->lock);
+
+        struct planar_upload *upload = band->upload;
+        upload_copy_rows(upload, band->y1, band->y2);
+        bool last = atomic_fetch_sub(&upload->remaining, 1) == 1;
+
+        pthread_mutex_lock(&pool->lock);
+        if (last) {
+            wl_list_insert(pool->done.prev, &upload->done_link);
+            uint64_t one = 1;
+            if (write(pool->event_fd, &one, sizeof(one)) < 0) {
+                wlr_log_errno(WLR_ERROR, "Unable to wake the main loop");
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static int upload_handle_event(int fd, uint32_t mask, void *data) {
+    struct planar_upload_pool *pool = data;
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0) {
+        return 0;
+    }
+
+    struct wl_list done;
+    wl_list_init(&done);
+    pthread_mutex_lock(&pool->lock);
+    wl_list_insert_list(&done, &pool->done);
+    wl_list_init(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+
+    /* Applying one commit never touches the others, they aren't ready. */
+    struct planar_upload *upload, *tmp;
+    wl_list_for_each_safe(upload, tmp, &done, done_link) {
+        wl_list_remove(&upload->done_link);
+        upload_complete(upload);
+    }
+    return 0;
+}
+
+static bool upload_queue(struct planar_upload_pool *pool, struct planar_upload *upload) {
+    const pixman_box32_t *extents = pixman_region32_extents(&upload->region);
+    size_t n_bands = (extents->y2 - extents->y1 + UPLOAD_BAND_ROWS - 1) / UPLOAD_BAND_ROWS;
+    upload->bands = calloc(n_bands, sizeof(*upload->bands));
+    if (!upload->bands) {
+        return false;
+    }
+    atomic_init(&upload->remaining, n_bands);
+    wl_list_insert(&pool->in_flight, &upload->flight_link);
+
+    pthread_mutex_lock(&pool->lock);
+    for (size_t i = 0; i < n_bands; i++) {
+        struct upload_band *band = &upload->bands[i];
+        band->upload = upload;
+        band->y1 = extents->y1 + i * UPLOAD_BAND_ROWS;
+        band->y2 = band->y1 + UPLOAD_BAND_ROWS < extents->y2 ?
+            band->y1 + UPLOAD_BAND_ROWS : extents->y2;
+        wl_list_insert(pool->bands.prev, &band->link);
+    }
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+static struct planar_upload_image *upload_surface_pick(struct planar_upload_surface *upload_surface,
+        int width, int height, uint32_t format) {
+    /* Images anyone else holds are being drawn or written. */
+    int slot = -1;
+    for (int i = 0; i < PLANAR_UPLOAD_IMAGES; i++) {
+        struct planar_upload_image *image = upload_surface->images[i];
+        if (!image) {
+            slot = slot < 0 ? i : slot;
+            continue;
+        }
+        if (image->refs > 1) {
+            continue;
+        }
+        if (image->width == width && image->height == height && image->format == format) {
+            return image;
+        }
+        slot = slot < 0 ? i : slot;
+    }
+    if (slot < 0) {
+        return NULL;
+    }
+    if (upload_surface->images[slot]) {
+        upload_image_unref(upload_surface->images[slot]);
+    }
+    upload_surface->images[slot] = upload_image_create(width, height, format);
+    return upload_surface->images[slot];
+}
+
+static void upload_commit_damage(struct wlr_surface *surface, struct wlr_buffer *buffer,
+        pixman_region32_t *damage) {
+    pixman_region32_init_rect(damage, 0, 0, buffer->width, buffer->height);
+    /* Surface-local damage would have to go through the scale, transform
+     * and viewport, take the whole buffer instead. */
+    if (!pixman_region32_not_empty(&surface->pending.surface_damage)) {
+        pixman_region32_intersect(damage, damage, &surface->pending.buffer_damage);
+    }
+}
+
+static uint64_t upload_region_pixels(const pixman_region32_t *region) {
+    int n_boxes;
+    const pixman_box32_t *boxes = pixman_region32_rectangles(region, &n_boxes);
+    uint64_t pixels = 0;
+    for (int i = 0; i < n_boxes; i++) {
+        pixels += (uint64_t)(boxes[i].x2 - boxes[i].x1) * (boxes[i].y2 - boxes[i].y1);
+    }
+    return pixels;
+}
+
+static void upload_handle_client_commit(struct wl_listener *listener, void *data) {
+    struct planar_upload_surface *upload_surface =
+        wl_container_of(listener, upload_surface, client_commit);
+    struct planar_upload_pool *pool = upload_surface->pool;
+    struct wlr_surface *surface = upload_surface->surface;
+    if (!(surface->pending.committed & WLR_SURFACE_STATE_BUFFER)) {
+        return;
+    }
+    TRACE_SCOPE("upload_client_commit");
+
+    struct planar_upload *upload = calloc(1, sizeof(*upload));
+    if (!upload) {
+        wl_client_post_no_memory(wl_resource_get_client(surface->resource));
+        return;
+    }
+    upload->surface = upload_surface;
+    upload->seq = surface->pending.seq;
+    upload->ready = true;
+    pixman_region32_init(&upload->region);
+    wl_list_init(&upload->flight_link);
+    wl_list_insert(upload_surface->uploads.prev, &upload->link);
+
+    /* Without an image, render threads fall back to the buffer itself. */
+    struct wlr_buffer *buffer = surface->pending.buffer;
+    void *buffer_data;
+    uint32_t format;
+    size_t stride;
+    if (!buffer || !wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+            &buffer_data, &format, &stride)) {
+        return;
+    }
+    wlr_buffer_end_data_ptr_access(buffer);
+    if (!upload_format_supported(format)) {
+        return;
+    }
+
+    pixman_region32_t damage;
+    upload_commit_damage(surface, buffer, &damage);
+    for (int i = 0; i < PLANAR_UPLOAD_IMAGES; i++) {
+        struct planar_upload_image *image = upload_surface->images[i];
+        if (image) {
+            pixman_region32_union(&image->stale, &image->stale, &damage);
+        }
+    }
+    pixman_region32_fini(&damage);
+
+    struct planar_upload_image *image = upload_surface_pick(upload_surface,
+        buffer->width, buffer->height, format);
+    if (!image) {
+        pool->skipped++;
+        return;
+    }
+    upload->image = upload_image_ref(image);
+    pixman_region32_copy(&upload->region, &image->stale);
+    pixman_region32_clear(&image->stale);
+    /* Locked, the mapping stays valid after the access is over. */
+    upload->buffer = wlr_buffer_lock(buffer);
+    upload->data = buffer_data;
+    upload->stride = stride;
+
+    uint64_t pixels = upload_region_pixels(&upload->region);
+    pool->bytes += pixels * 4;
+    if (pixels >= UPLOAD_ASYNC_MIN_PIXELS && upload_queue(pool, upload)) {
+        upload->ready = false;
+        upload->lock_seq = wlr_surface_lock_pending(surface);
+        pool->async_uploads++;
+        return;
+    }
+    const pixman_box32_t *extents = pixman_region32_extents(&upload->region);
+    upload_copy_rows(upload, extents->y1, extents->y2);
+    wlr_buffer_unlock(upload->buffer);
+    upload->buffer = NULL;
+    pool->sync_uploads++;
+}
+
+static void upload_handle_commit(struct wl_listener *listener, void *data) {
+    struct planar_upload_surface *upload_surface =
+        wl_container_of(listener, upload_surface, commit);
+    uint32_t seq = upload_surface->surface->current.seq;
+
+    /* Everything up to the applied commit is on screen now. */
+    struct planar_upload *upload, *tmp;
+    wl_list_for_each_safe(upload, tmp, &upload_surface->uploads, link) {
+        if ((int32_t)(upload->seq - seq) > 0 || !upload->ready) {
+            break;
+        }
+        if (upload_surface->current) {
+            upload_image_unref(upload_surface->current);
+        }
+        upload_surface->current = upload->image;
+        upload->image = NULL;
+        upload_destroy(upload);
+    }
+}
+
+static void upload_surface_destroy(struct planar_upload_surface *upload_surface) {
+    struct planar_upload *upload, *tmp;
+    wl_list_for_each_safe(upload, tmp, &upload_surface->uploads, link) {
+        if (wl_list_empty(&upload->flight_link)) {
+            upload_destroy(upload);
+            continue;
+        }
+        /* Still being copied, freed once the workers are done with it. */
+        upload->surface = NULL;
+        wl_list_remove(&upload->link);
+        wl_list_init(&upload->link);
+    }
+    for (int i = 0; i < PLANAR_UPLOAD_IMAGES; i++) {
+        if (upload_surface->images[i]) {
+            upload_image_unref(upload_surface->images[i]);
+        }
+    }
+    if (upload_surface->current) {
+        upload_image_unref(upload_surface->current);
+    }
+    wlr_addon_finish(&upload_surface->addon);
+    wl_list_remove(&upload_surface->client_commit.link);
+    wl_list_remove(&upload_surface->commit.link);
+    wl_list_remove(&upload_surface->link);
+    free(upload_surface);
+}
+
+static void upload_surface_addon_destroy(struct wlr_addon *addon) {
+    struct planar_upload_surface *upload_surface =
+        wl_container_of(addon, upload_surface, addon);
+    upload_surface_destroy(upload_surface);
+}
+
+static const struct wlr_addon_interface upload_surface_addon_impl = {
+    .name = "planar_upload_surface",
+    .destroy = upload_surface_addon_destroy,
+};
+
+static void upload_handle_new_surface(struct wl_listener *listener, void *data) {
+    struct planar_upload_pool *pool = wl_container_of(listener, pool, new_surface);
+    struct wlr_surface *surface = data;
+
+    struct planar_upload_surface *upload_surface = calloc(1, sizeof(*upload_surface));
+    if (!upload_surface) {
+        wl_client_post_no_memory(wl_resource_get_client(surface->resource));
+        return;
+    }
+    upload_surface->pool = pool;
+    upload_surface->surface = surface;
+    wl_list_init(&upload_surface->uploads);
+    wlr_addon_init(&upload_surface->addon, &surface->addons, pool,
+        &upload_surface_addon_impl);
+    upload_surface->client_commit.notify = upload_handle_client_commit;
+    wl_signal_add(&surface->events.client_commit, &upload_surface->client_commit);
+    upload_surface->commit.notify = upload_handle_commit;
+    wl_signal_add(&surface->events.commit, &upload_surface->commit);
+    wl_list_insert(&pool->surfaces, &upload_surface->link);
+}
+
+struct planar_upload_image *upload_surface_image(struct planar_server *server,
+        struct wlr_surface *surface) {
+    if (!server->uploads) {
+        return NULL;
+    }
+    struct wlr_addon *addon = wlr_addon_find(&surface->addons, server->uploads,
+        &upload_surface_addon_impl);
+    if (!addon) {
+        return NULL;
+    }
+    struct planar_upload_surface *upload_surface =
+        wl_container_of(addon, upload_surface, addon);
+    return upload_surface->current;
+}
+
+bool upload_init(struct planar_server *server, int n_threads) {
+    struct planar_upload_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        return false;
+    }
+    pool->threads = calloc(n_threads, sizeof(*pool->threads));
+    pool->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (!pool->threads || pool->event_fd < 0) {
+        wlr_log_errno(WLR_ERROR, "Unable to set up upload workers");
+        if (pool->event_fd >= 0) {
+            close(pool->event_fd);
+        }
+        free(pool->threads);
+        free(pool);
+        return false;
+    }
+    pool->server = server;
+    wl_list_init(&pool->surfaces);
+    wl_list_init(&pool->in_flight);
+    wl_list_init(&pool->bands);
+    wl_list_init(&pool->done);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    /* Signals stay with the main loop's signalfds. */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (int i = 0; i < n_threads; i++) {
+        int err = pthread_create(&pool->threads[i], NULL, upload_worker_run, pool);
+        if (err) {
+            wlr_log(WLR_ERROR, "Unable to start upload worker: %s", strerror(err));
+            break;
+        }
+        pool->n_threads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    pool->event_source = wl_event_loop_add_fd(wl_display_get_event_loop(server->wl_display),
+        pool->event_fd, WL_EVENT_READABLE, upload_handle_event, pool);
+    pool->new_surface.notify = upload_handle_new_surface;
+    wl_signal_add(&server->compositor->events.new_surface, &pool->new_surface);
+    server->uploads = pool;
+    if (pool->n_threads == 0) {
+        upload_finish(server);
+        return false;
+    }
+    return true;
+}
+
+void upload_finish(struct planar_server *server) {
+    struct planar_upload_pool *pool = server->uploads;
+    if (!pool) {
+        return;
+    }
+    wl_list_remove(&pool->new_surface.link);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    /* Whatever is left uncopied is let go as is. */
+    struct planar_upload *upload, *tmp;
+    wl_list_for_each_safe(upload, tmp, &pool->in_flight, flight_link) {
+        upload_complete(upload);
+    }
+    struct planar_upload_surface *upload_surface, *tmp_surface;
+    wl_list_for_each_safe(upload_surface, tmp_surface, &pool->surfaces, link) {
+        upload_surface_destroy(upload_surface);
+    }
+
+    wl_event_source_remove(pool->event_source);
+    close(pool->event_fd);
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+    server->uploads = NULL;
+}
@@ -0,0 +1,103 @@
+#include "virtual-input.h"
+#include "server.h"
+
+#include <stdlib.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/interfaces/wlr_pointer.h>
+
+static const struct wlr_pointer_impl virtual_pointer_impl = {
+    .name = "planar-virtual-pointer",
+};
+
+static const struct wlr_keyboard_impl virtual_keyboard_impl = {
+    .name = "planar-virtual-keyboard",
+};
+
+struct planar_virtual_input *virtual_input_create(struct planar_server *server) {
+    struct planar_virtual_input *input = calloc(1, sizeof(*input));
+    if (!input) {
+        return NULL;
+    }
+    input->server = server;
+
+    wlr_pointer_init(&input->pointer, &virtual_pointer_impl, virtual_pointer_impl.name);
+    wlr_keyboard_init(&input->keyboard, &virtual_keyboard_impl, virtual_keyboard_impl.name);
+
+    /* Announce the devices the same way the backend would. */
+    server->new_input.notify(&server->new_input, &input->pointer.base);
+    server->new_input.notify(&server->new_input, &input->keyboard.base);
+    return input;
+}
+
+void virtual_input_destroy(struct planar_virtual_input *input) {
+    if (!input) {
+        return;
+    }
+    wlr_pointer_finish(&input->pointer);
+    wlr_keyboard_finish(&input->keyboard);
+    free(input);
+}
+
+void virtual_input_motion(struct planar_virtual_input *input, uint32_t time_msec,
+        double dx, double dy) {
+    struct wlr_pointer_motion_event event = {
+        .pointer = &input->pointer,
+        .time_msec = time_msec,
+        .delta_x = dx,
+        .delta_y = dy,
+        .unaccel_dx = dx,
+        .unaccel_dy = dy,
+    };
+    wl_signal_emit_mutable(&input->pointer.events.motion, &event);
+}
+
+void virtual_input_motion_absolute(struct planar_virtual_input *input, uint32_t time_msec,
+        double x, double y) {
+    struct wlr_pointer_motion_absolute_event event = {
+        .pointer = &input->pointer,
+        .time_msec = time_msec,
+        .x = x,
+        .y = y,
+    };
+    wl_signal_emit_mutable(&input->pointer.events.motion_absolute, &event);
+}
+
+void virtual_input_button(struct planar_virtual_input *input, uint32_t time_msec,
+        uint32_t button, bool pressed) {
+    struct wlr_pointer_button_event event = {
+        .pointer = &input->pointer,
+        .time_msec = time_msec,
+        .button = button,
+        .state = pressed ? WL_POINTER_BUTTON_STATE_PRESSED : WL_POINTER_BUTTON_STATE_RELEASED,
+    };
+    wl_signal_emit_mutable(&input->pointer.events.button, &event);
+}
+
+void virtual_input_axis(struct planar_virtual_input *input, uint32_t time_msec,
+        enum wl_pointer_axis orientation, double delta, int32_t delta_discrete) {
+    struct wlr_pointer_axis_event event = {
+        .pointer = &input->pointer,
+        .time_msec = time_msec,
+        .source = WL_POINTER_AXIS_SOURCE_WHEEL,
+        .orientation = orientation,
+        .relative_direction = WL_POINTER_AXIS_RELATIVE_DIRECTION_IDENTICAL,
+        .delta = delta,
+        .delta_discrete = delta_discrete,
+    };
+    wl_signal_emit_mutable(&input->pointer.events.axis, &event);
+}
+
+void virtual_input_frame(struct planar_virtual_input *input) {
+    wl_signal_emit_mutable(&input->pointer.events.frame, &input->pointer);
+}
+
+void virtual_input_key(struct planar_virtual_input *input, uint32_t time_msec,
+        uint32_t keycode, bool pressed) {
+    struct wlr_keyboard_key_event event = {
+        .time_msec = time_msec,
+        .keycode = keycode,
+        .update_state = true,
+        .state = pressed ? WL_KEYBOARD_KEY_STATE_PRESSED : WL_KEYBOARD_KEY_STATE_RELEASED,
+    };
+    wlr_keyboard_notify_key(&input->keyboard, &event);
+}